@@ -156,6 +156,7 @@ void switch_mm_irqs_off(struct mm_struct *prev, struct mm_struct *next,
 {
 	struct mm_struct *real_prev = this_cpu_read(cpu_tlbstate.loaded_mm);
 	u16 prev_asid = this_cpu_read(cpu_tlbstate.loaded_mm_asid);
+	bool was_lazy = this_cpu_read(cpu_tlbstate.is_lazy);
 	unsigned cpu = smp_processor_id();
 	u64 next_tlb_gen;
 
@@ -215,6 +216,28 @@ void switch_mm_irqs_off(struct mm_struct *prev, struct mm_struct *next,
 				 !cpumask_test_cpu(cpu, mm_cpumask(next))))
 			cpumask_set_cpu(cpu, mm_cpumask(next));
 
+		/*
+		 * Switching between threads of the same process needs no
+		 * flush.  Leaving lazy mode does if flushes of the mm were
+		 * deferred meanwhile, see native_flush_tlb_others().  The
+		 * barrier orders our is_lazy write before the tlb_gen read
+		 * and pairs with the one in inc_mm_tlb_gen().
+		 */
+		if (!was_lazy)
+			return;
+
+		smp_mb();
+		next_tlb_gen = atomic64_read(&next->context.tlb_gen);
+		if (this_cpu_read(cpu_tlbstate.ctxs[prev_asid].tlb_gen) ==
+		    next_tlb_gen)
+			return;
+
+		this_cpu_write(cpu_tlbstate.ctxs[prev_asid].tlb_gen,
+			       next_tlb_gen);
+		load_new_mm_cr3(next->pgd, prev_asid, true);
+
+		/* See below wrt _rcuidle. */
+		trace_tlb_flush_rcuidle(TLB_FLUSH_ON_TASK_SWITCH, TLB_FLUSH_ALL);
 		return;
 	} else {
 		u16 new_asid;
@@ -496,6 +519,20 @@ static void flush_tlb_func_remote(void *info)
 	flush_tlb_func_common(f, false, TLB_REMOTE_SHOOTDOWN);
 }
 
+/* Scratch mask for native_flush_tlb_others(), which runs non-preemptible */
+static DEFINE_PER_CPU(cpumask_var_t, flush_tlb_mask);
+
+static int __init flush_tlb_mask_init(void)
+{
+	unsigned int cpu;
+
+	for_each_possible_cpu(cpu)
+		zalloc_cpumask_var_node(&per_cpu(flush_tlb_mask, cpu),
+					GFP_KERNEL, cpu_to_node(cpu));
+	return 0;
+}
+early_initcall(flush_tlb_mask_init);
+
 void native_flush_tlb_others(const struct cpumask *cpumask,
 			     const struct flush_tlb_info *info)
 {
@@ -531,6 +568,31 @@ void native_flush_tlb_others(const struct cpumask *cpumask,
 					       (void *)info, 1);
 		return;
 	}
+
+	/*
+	 * CPUs in lazy TLB mode don't run user code of the mm and catch up
+	 * with its tlb_gen when they leave lazy mode (see
+	 * switch_mm_irqs_off()), so their flush is deferred until then:
+	 * however many munmap()s and madvise(MADV_DONTNEED)s they sit
+	 * through cost them a single flush and no IPI.  The pages freed
+	 * meanwhile are safe, lazy CPUs never touch user addresses.  Page
+	 * tables are not, their paging-structure caches may still point
+	 * into freed ones, so such flushes go to every CPU.
+	 */
+	if (!info->freed_tables) {
+		struct cpumask *cpus = this_cpu_cpumask_var_ptr(flush_tlb_mask);
+		unsigned int cpu;
+
+		cpumask_clear(cpus);
+		for_each_cpu(cpu, cpumask) {
+			if (!READ_ONCE(per_cpu(cpu_tlbstate.is_lazy, cpu)))
+				__cpumask_set_cpu(cpu, cpus);
+		}
+		smp_call_function_many(cpus, flush_tlb_func_remote,
+				       (void *)info, 1);
+		return;
+	}
+
 	smp_call_function_many(cpumask, flush_tlb_func_remote,
 			       (void *)info, 1);
 }
@@ -548,12 +610,14 @@ void native_flush_tlb_others(const struct cpumask *cpumask,
 static unsigned long tlb_single_page_flush_ceiling __read_mostly = 33;
 
 void flush_tlb_mm_range(struct mm_struct *mm, unsigned long start,
-				unsigned long end, unsigned long vmflag)
+				unsigned long end, unsigned long vmflag,
+				bool freed_tables)
 {
 	int cpu;
 
 	struct flush_tlb_info info = {
 		.mm = mm,
+		.freed_tables = freed_tables,
 	};
 
 	cpu = get_cpu();
@@ -807,6 +807,7 @@ int bio_add_pc_page(struct request_queue *q, struct bio *bio, struct page
 		bio_clear_flag(bio, BIO_SEG_VALID);
 
  done:
+	bio_clear_flag(bio, BIO_SEG_LAST_VALID);
 	return len;
 
  failed:
@@ -1916,6 +1917,7 @@ void bio_trim(struct bio *bio, int offset, int size)
 		return;
 
 	bio_clear_flag(bio, BIO_SEG_VALID);
+	bio_clear_flag(bio, BIO_SEG_LAST_VALID);
 
 	bio_advance(bio, offset << 9);
 
@@ -2844,7 +2844,7 @@ void blk_finish_request(struct request *req, blk_status_t error)
 	WARN_ON_ONCE(q->mq_ops);
 
 	if (req->rq_flags & RQF_STATS)
-		blk_stat_add(req);
+		blk_stat_add(req, blk_stat_now());
 
 	if (req->rq_flags & RQF_QUEUED)
 		blk_queue_end_tag(q, req);
@@ -3230,20 +3230,17 @@ int kblockd_schedule_delayed_work_on(int cpu, struct delayed_work *dwork,
 EXPORT_SYMBOL(kblockd_schedule_delayed_work_on);
 
 /**
- * blk_start_plug - initialize blk_plug and track it inside the task_struct
+ * blk_start_plug_nr_ios - initialize blk_plug for a batch of known size
  * @plug:	The &struct blk_plug that needs to be initialized
+ * @nr_ios:	Number of I/Os the caller expects to submit under the plug
  *
  * Description:
- *   Tracking blk_plug inside the task_struct will help with auto-flushing the
- *   pending I/O should the task end up blocking between blk_start_plug() and
- *   blk_finish_plug(). This is important from a performance perspective, but
- *   also ensures that we don't deadlock. For instance, if the task is blocking
- *   for a memory allocation, memory reclaim could end up wanting to free a
- *   page belonging to that request that is currently residing in our private
- *   plug. By flushing the pending I/O when the process goes to sleep, we avoid
- *   this kind of deadlock.
+ *   Like blk_start_plug(), but lets blk-mq allocate up to @nr_ios requests
+ *   in one go when the first one is needed, and keep the rest on the plug
+ *   for the following submissions. Unused requests are freed when the plug
+ *   is finished, or flushed because the task is going to sleep.
  */
-void blk_start_plug(struct blk_plug *plug)
+void blk_start_plug_nr_ios(struct blk_plug *plug, unsigned short nr_ios)
 {
 	struct task_struct *tsk = current;
 
@@ -3256,12 +3253,34 @@ void blk_start_plug(struct blk_plug *plug)
 	INIT_LIST_HEAD(&plug->list);
 	INIT_LIST_HEAD(&plug->mq_list);
 	INIT_LIST_HEAD(&plug->cb_list);
+	INIT_LIST_HEAD(&plug->mq_cached);
+	plug->nr_ios = max_t(unsigned short, nr_ios, 1);
 	/*
 	 * Store ordering should not be needed here, since a potential
 	 * preempt will imply a full memory barrier
 	 */
 	tsk->plug = plug;
 }
+EXPORT_SYMBOL(blk_start_plug_nr_ios);
+
+/**
+ * blk_start_plug - initialize blk_plug and track it inside the task_struct
+ * @plug:	The &struct blk_plug that needs to be initialized
+ *
+ * Description:
+ *   Tracking blk_plug inside the task_struct will help with auto-flushing the
+ *   pending I/O should the task end up blocking between blk_start_plug() and
+ *   blk_finish_plug(). This is important from a performance perspective, but
+ *   also ensures that we don't deadlock. For instance, if the task is blocking
+ *   for a memory allocation, memory reclaim could end up wanting to free a
+ *   page belonging to that request that is currently residing in our private
+ *   plug. By flushing the pending I/O when the process goes to sleep, we avoid
+ *   this kind of deadlock.
+ */
+void blk_start_plug(struct blk_plug *plug)
+{
+	blk_start_plug_nr_ios(plug, 1);
+}
 EXPORT_SYMBOL(blk_start_plug);
 
 static int plug_rq_cmp(void *priv, struct list_head *a, struct list_head *b)
@@ -3349,6 +3368,15 @@ void blk_flush_plug_list(struct blk_plug *plug, bool from_schedule)
 	if (!list_empty(&plug->mq_list))
 		blk_mq_flush_plug_list(plug, from_schedule);
 
+	/*
+	 * Cached requests pin their queue and hold tags, don't hold on to
+	 * them while we sleep or someone freezing the queue, or waiting for
+	 * a tag, could wait on us forever. Otherwise they are kept for the
+	 * rest of the batch, until blk_finish_plug().
+	 */
+	if (from_schedule && !list_empty(&plug->mq_cached))
+		blk_mq_free_plug_rqs(plug);
+
 	if (list_empty(&plug->list))
 		return;
 
@@ -3412,6 +3440,8 @@ void blk_finish_plug(struct blk_plug *plug)
 	if (plug != current->plug)
 		return;
 	blk_flush_plug_list(plug, false);
+	if (!list_empty(&plug->mq_cached))
+		blk_mq_free_plug_rqs(plug);
 
 	current->plug = NULL;
 }
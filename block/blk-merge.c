@@ -165,6 +165,12 @@ static struct bio *blk_bio_segment_split(struct request_queue *q,
 	}
 
 	do_split = false;
+
+	/* Remember where the bio ends for merge checks against it. */
+	if (bvprvp) {
+		bio->bi_seg_last_bvec = bvprv;
+		bio_set_flag(bio, BIO_SEG_LAST_VALID);
+	}
 split:
 	*segs = nsegs;
 
@@ -404,6 +410,22 @@ static inline int __blk_bvec_map_sg(struct request_queue *q, struct bio_vec bv,
 	return 1;
 }
 
+/*
+ * A request that was counted as a single physical segment when it was built
+ * and merged is physically contiguous, so it maps to one sg entry covering
+ * all of it without walking its bvecs again.
+ */
+static inline int __blk_rq_map_single_sg(struct request_queue *q,
+					 struct request *rq,
+					 struct scatterlist *sglist,
+					 struct scatterlist **sg)
+{
+	struct bio_vec bv = bio_iovec(rq->bio);
+
+	bv.bv_len = blk_rq_bytes(rq);
+	return __blk_bvec_map_sg(q, bv, sglist, sg);
+}
+
 static int __blk_bios_map_sg(struct request_queue *q, struct bio *bio,
 			     struct scatterlist *sglist,
 			     struct scatterlist **sg)
@@ -434,6 +456,9 @@ int blk_rq_map_sg(struct request_queue *q, struct request *rq,
 		nsegs = __blk_bvec_map_sg(q, rq->special_vec, sglist, &sg);
 	else if (rq->bio && bio_op(rq->bio) == REQ_OP_WRITE_SAME)
 		nsegs = __blk_bvec_map_sg(q, bio_iovec(rq->bio), sglist, &sg);
+	else if (rq->bio && rq->nr_phys_segments == 1 &&
+		 bio_has_data(rq->bio))
+		nsegs = __blk_rq_map_single_sg(q, rq, sglist, &sg);
 	else if (rq->bio)
 		nsegs = __blk_bios_map_sg(q, rq->bio, sglist, &sg);
 
@@ -23,6 +23,7 @@
 #include "blk-mq.h"
 #include "blk-mq-debugfs.h"
 #include "blk-mq-tag.h"
+#include "blk-wbt.h"
 
 static int blk_flags_show(struct seq_file *m, const unsigned long flags,
 			  const char *const *flag_name, int flag_name_count)
@@ -175,6 +176,65 @@ static int queue_poll_stat_show(void *data, struct seq_file *m)
 	return 0;
 }
 
+#ifdef CONFIG_BLK_WBT
+static int queue_wbt_model_show(void *data, struct seq_file *m)
+{
+	struct request_queue *q = data;
+	struct rq_wb *rwb = q->rq_wb;
+	struct wbt_lat_model *model;
+	int i;
+
+	if (!rwb) {
+		seq_puts(m, "disabled\n");
+		return 0;
+	}
+
+	model = &rwb->model;
+	seq_printf(m, "learn=%d target=%lu max_depth=%u wb_max=%u\n",
+		   rwb->learn, rwb->min_lat_nsec, model->max_depth,
+		   rwb->wb_max);
+	for (i = 0; i < WBT_MODEL_BUCKETS; i++) {
+		if (!model->nr_windows[i])
+			continue;
+		seq_printf(m, "depth %u: windows=%u, lat=%llu\n", 1U << i,
+			   model->nr_windows[i], model->lat_nsec[i]);
+	}
+	return 0;
+}
+
+static ssize_t queue_wbt_model_write(void *data, const char __user *buf,
+				     size_t count, loff_t *ppos)
+{
+	struct request_queue *q = data;
+	char opbuf[16] = { }, *op;
+
+	if (!q->rq_wb)
+		return -ENOENT;
+
+	if (count >= sizeof(opbuf)) {
+		pr_err("%s: operation too long\n", __func__);
+		goto inval;
+	}
+
+	if (copy_from_user(opbuf, buf, count))
+		return -EFAULT;
+	op = strstrip(opbuf);
+	if (strcmp(op, "learn") == 0) {
+		wbt_set_learning(q->rq_wb, true);
+	} else if (strcmp(op, "fixed") == 0) {
+		wbt_set_learning(q->rq_wb, false);
+	} else if (strcmp(op, "reset") == 0) {
+		wbt_reset_model(q->rq_wb);
+	} else {
+		pr_err("%s: unsupported operation '%s'\n", __func__, op);
+inval:
+		pr_err("%s: use 'learn', 'fixed' or 'reset'\n", __func__);
+		return -EINVAL;
+	}
+	return count;
+}
+#endif
+
 #define HCTX_STATE_NAME(name) [BLK_MQ_S_##name] = #name
 static const char *const hctx_state_name[] = {
 	HCTX_STATE_NAME(STOPPED),
@@ -689,6 +749,19 @@ static ssize_t ctx_completed_write(void *data, const char __user *buf,
 	return count;
 }
 
+static int ctx_cached_tags_show(void *data, struct seq_file *m)
+{
+	struct blk_mq_ctx *ctx = data;
+	unsigned int i;
+
+	spin_lock_irq(&ctx->tag_cache_lock);
+	for (i = 0; i < ctx->nr_cached_tags; i++)
+		seq_printf(m, "%s%u", i ? " " : "", ctx->cached_tags[i]);
+	spin_unlock_irq(&ctx->tag_cache_lock);
+	seq_putc(m, '\n');
+	return 0;
+}
+
 static int blk_mq_debugfs_show(struct seq_file *m, void *v)
 {
 	const struct blk_mq_debugfs_attr *attr = m->private;
@@ -755,6 +828,9 @@ static const struct blk_mq_debugfs_attr blk_mq_debugfs_queue_attrs[] = {
 	{"requeue_list", 0400, .seq_ops = &queue_requeue_list_seq_ops},
 	{"state", 0600, queue_state_show, queue_state_write},
 	{"write_hints", 0600, queue_write_hint_show, queue_write_hint_store},
+#ifdef CONFIG_BLK_WBT
+	{"wbt_model", 0600, queue_wbt_model_show, queue_wbt_model_write},
+#endif
 	{},
 };
 
@@ -781,6 +857,7 @@ static const struct blk_mq_debugfs_attr blk_mq_debugfs_ctx_attrs[] = {
 	{"dispatched", 0600, ctx_dispatched_show, ctx_dispatched_write},
 	{"merged", 0600, ctx_merged_show, ctx_merged_write},
 	{"completed", 0600, ctx_completed_show, ctx_completed_write},
+	{"cached_tags", 0400, ctx_cached_tags_show},
 	{},
 };
 
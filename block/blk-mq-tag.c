@@ -62,32 +62,176 @@ void __blk_mq_tag_idle(struct blk_mq_hw_ctx *hctx)
 /*
  * For shared tag users, we track the number of currently active users
  * and attempt to provide a fair share of the tag depth for each of them.
+ * Returns how many more tags @hctx may allocate from @bt, UINT_MAX if it
+ * isn't limited.
  */
-static inline bool hctx_may_queue(struct blk_mq_hw_ctx *hctx,
-				  struct sbitmap_queue *bt)
+static inline unsigned int hctx_tags_allowed(struct blk_mq_hw_ctx *hctx,
+					     struct sbitmap_queue *bt)
 {
-	unsigned int depth, users;
+	unsigned int depth, users, active;
 
 	if (!hctx || !(hctx->flags & BLK_MQ_F_TAG_SHARED))
-		return true;
+		return UINT_MAX;
 	if (!test_bit(BLK_MQ_S_TAG_ACTIVE, &hctx->state))
-		return true;
+		return UINT_MAX;
 
 	/*
 	 * Don't try dividing an ant
 	 */
 	if (bt->sb.depth == 1)
-		return true;
+		return UINT_MAX;
 
 	users = atomic_read(&hctx->tags->active_queues);
 	if (!users)
-		return true;
+		return UINT_MAX;
 
 	/*
 	 * Allow at least some tags
 	 */
 	depth = max((bt->sb.depth + users - 1) / users, 4U);
-	return atomic_read(&hctx->nr_active) < depth;
+	active = atomic_read(&hctx->nr_active);
+	return active < depth ? depth - active : 0;
+}
+
+static inline bool hctx_may_queue(struct blk_mq_hw_ctx *hctx,
+				  struct sbitmap_queue *bt)
+{
+	return hctx_tags_allowed(hctx, bt) != 0;
+}
+
+/*
+ * Per-cpu tag cache: normal driver tags are handed out from a small stack
+ * in the blk_mq_ctx, refilled from and spilled back to the shared sbitmap
+ * in batches, so the sbitmap cachelines are touched once per batch rather
+ * than once per request.  Frees only go to the cache on the ctx's own cpu.
+ *
+ * All the ctxs of a hardware queue together may cache at most half of its
+ * tag space, or of its fair share of it if the tag map is shared, and the
+ * caches are bypassed and drained as soon as someone has to wait for a tag.
+ */
+static unsigned int blk_mq_tag_cache_limit(struct blk_mq_hw_ctx *hctx,
+					   struct sbitmap_queue *bt)
+{
+	unsigned int depth = bt->sb.depth, users;
+
+	if (atomic_read(&hctx->tags->nr_waiters))
+		return 0;
+
+	if ((hctx->flags & BLK_MQ_F_TAG_SHARED) &&
+	    test_bit(BLK_MQ_S_TAG_ACTIVE, &hctx->state)) {
+		users = atomic_read(&hctx->tags->active_queues);
+		if (users > 1)
+			depth = max((depth + users - 1) / users, 4U);
+	}
+
+	return min_t(unsigned int, BLK_MQ_CTX_TAG_CACHE,
+		     depth / (2 * max(hctx->nr_ctx, 1U)));
+}
+
+/* Must be called with ctx->tag_cache_lock held. */
+static void blk_mq_tag_cache_release(struct blk_mq_tags *tags,
+				     struct blk_mq_ctx *ctx, unsigned int keep)
+{
+	while (ctx->nr_cached_tags > keep) {
+		unsigned int tag = ctx->cached_tags[--ctx->nr_cached_tags];
+
+		sbitmap_queue_clear(&tags->bitmap_tags,
+				    tag - tags->nr_reserved_tags, ctx->cpu);
+	}
+}
+
+void blk_mq_tag_cache_drain(struct blk_mq_hw_ctx *hctx)
+{
+	struct blk_mq_ctx *ctx;
+	unsigned long flags;
+	unsigned int i;
+
+	hctx_for_each_ctx(hctx, ctx, i) {
+		if (!READ_ONCE(ctx->nr_cached_tags))
+			continue;
+		spin_lock_irqsave(&ctx->tag_cache_lock, flags);
+		blk_mq_tag_cache_release(hctx->tags, ctx, 0);
+		spin_unlock_irqrestore(&ctx->tag_cache_lock, flags);
+	}
+}
+
+void blk_mq_tag_cache_drain_queue(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i;
+
+	queue_for_each_hw_ctx(q, hctx, i)
+		blk_mq_tag_cache_drain(hctx);
+}
+
+static bool blk_mq_tag_cacheable(struct blk_mq_alloc_data *data)
+{
+	return data->ctx && !data->shallow_depth &&
+		!(data->flags & (BLK_MQ_REQ_INTERNAL | BLK_MQ_REQ_RESERVED));
+}
+
+/*
+ * Returns a tag from the ctx cache, refilling it first if it is empty,
+ * or -1 if the caller should go to the sbitmap itself.
+ */
+static int blk_mq_get_cached_tag(struct blk_mq_alloc_data *data,
+				 struct sbitmap_queue *bt)
+{
+	struct blk_mq_ctx *ctx = data->ctx;
+	unsigned int limit, offset, i;
+	unsigned long flags, mask;
+	int tag = -1;
+
+	if (!hctx_may_queue(data->hctx, bt))
+		return -1;
+
+	spin_lock_irqsave(&ctx->tag_cache_lock, flags);
+	if (!ctx->nr_cached_tags) {
+		limit = blk_mq_tag_cache_limit(data->hctx, bt);
+		if (limit < 2)
+			goto out;
+
+		mask = blk_mq_get_tags(data, limit, &offset);
+		for_each_set_bit(i, &mask, BITS_PER_LONG)
+			ctx->cached_tags[ctx->nr_cached_tags++] = offset + i;
+	}
+	if (ctx->nr_cached_tags)
+		tag = ctx->cached_tags[--ctx->nr_cached_tags];
+out:
+	spin_unlock_irqrestore(&ctx->tag_cache_lock, flags);
+	return tag;
+}
+
+/* Returns false if @tag has to go back to the sbitmap. */
+static bool blk_mq_put_cached_tag(struct blk_mq_hw_ctx *hctx,
+				  struct blk_mq_tags *tags,
+				  struct blk_mq_ctx *ctx, unsigned int tag)
+{
+	unsigned int limit;
+	unsigned long flags;
+	bool cached = false;
+
+	/*
+	 * With an I/O scheduler, driver tags are allocated at dispatch time
+	 * without a ctx and so never from the cache: don't let them pile up
+	 * in it.
+	 */
+	if (tags != hctx->tags || hctx->queue->elevator ||
+	    ctx->cpu != raw_smp_processor_id())
+		return false;
+
+	limit = blk_mq_tag_cache_limit(hctx, &tags->bitmap_tags);
+
+	spin_lock_irqsave(&ctx->tag_cache_lock, flags);
+	if (ctx->nr_cached_tags >= limit)
+		blk_mq_tag_cache_release(tags, ctx, limit / 2);
+	if (ctx->nr_cached_tags < limit) {
+		ctx->cached_tags[ctx->nr_cached_tags++] = tag;
+		cached = true;
+	}
+	spin_unlock_irqrestore(&ctx->tag_cache_lock, flags);
+
+	return cached;
 }
 
 static int __blk_mq_get_tag(struct blk_mq_alloc_data *data,
@@ -104,7 +248,7 @@ static int __blk_mq_get_tag(struct blk_mq_alloc_data *data,
 
 unsigned int blk_mq_get_tag(struct blk_mq_alloc_data *data)
 {
-	struct blk_mq_tags *tags = blk_mq_tags_from_data(data);
+	struct blk_mq_tags *tags = blk_mq_tags_from_data(data), *wait_tags;
 	struct sbitmap_queue *bt;
 	struct sbq_wait_state *ws;
 	DEFINE_WAIT(wait);
@@ -122,6 +266,12 @@ unsigned int blk_mq_get_tag(struct blk_mq_alloc_data *data)
 	} else {
 		bt = &tags->bitmap_tags;
 		tag_offset = tags->nr_reserved_tags;
+
+		if (blk_mq_tag_cacheable(data)) {
+			tag = blk_mq_get_cached_tag(data, bt);
+			if (tag != -1)
+				return tag;
+		}
 	}
 
 	tag = __blk_mq_get_tag(data, bt);
@@ -131,6 +281,14 @@ unsigned int blk_mq_get_tag(struct blk_mq_alloc_data *data)
 	if (data->flags & BLK_MQ_REQ_NOWAIT)
 		return BLK_MQ_TAG_FAIL;
 
+	/*
+	 * Stop the per-cpu caches from hoarding tags while we wait, and make
+	 * the ones they already hold available.
+	 */
+	wait_tags = tags;
+	atomic_inc(&wait_tags->nr_waiters);
+	blk_mq_tag_cache_drain(data->hctx);
+
 	ws = bt_wait_ptr(bt, data->hctx);
 	drop_ctx = data->ctx == NULL;
 	do {
@@ -176,11 +334,40 @@ unsigned int blk_mq_get_tag(struct blk_mq_alloc_data *data)
 		blk_mq_put_ctx(data->ctx);
 
 	finish_wait(&ws->wait, &wait);
+	atomic_dec(&wait_tags->nr_waiters);
 
 found_tag:
 	return tag + tag_offset;
 }
 
+/*
+ * Grab up to @nr_tags normal tags in one go, without waiting. On a shared
+ * tag map the batch is clamped to what hctx_may_queue() would still allow.
+ * Returns a mask of the allocated tags relative to *@offset, 0 if none
+ * could be had; the caller then falls back to blk_mq_get_tag().
+ */
+unsigned long blk_mq_get_tags(struct blk_mq_alloc_data *data,
+			      unsigned int nr_tags, unsigned int *offset)
+{
+	struct blk_mq_tags *tags = blk_mq_tags_from_data(data);
+	struct sbitmap_queue *bt = &tags->bitmap_tags;
+	unsigned long mask;
+
+	if (WARN_ON_ONCE(data->flags & BLK_MQ_REQ_RESERVED) ||
+	    data->shallow_depth)
+		return 0;
+
+	if (!(data->flags & BLK_MQ_REQ_INTERNAL))
+		nr_tags = min(nr_tags, hctx_tags_allowed(data->hctx, bt));
+	nr_tags = min3(nr_tags, 1U << bt->sb.shift, BITS_PER_LONG - 1U);
+	if (!nr_tags)
+		return 0;
+
+	mask = __sbitmap_queue_get_batch(bt, nr_tags, offset);
+	*offset += tags->nr_reserved_tags;
+	return mask;
+}
+
 void blk_mq_put_tag(struct blk_mq_hw_ctx *hctx, struct blk_mq_tags *tags,
 		    struct blk_mq_ctx *ctx, unsigned int tag)
 {
@@ -188,6 +375,8 @@ void blk_mq_put_tag(struct blk_mq_hw_ctx *hctx, struct blk_mq_tags *tags,
 		const int real_tag = tag - tags->nr_reserved_tags;
 
 		BUG_ON(real_tag >= tags->nr_tags);
+		if (blk_mq_put_cached_tag(hctx, tags, ctx, tag))
+			return;
 		sbitmap_queue_clear(&tags->bitmap_tags, real_tag, ctx->cpu);
 	} else {
 		BUG_ON(tag >= tags->nr_reserved_tags);
@@ -195,6 +384,35 @@ void blk_mq_put_tag(struct blk_mq_hw_ctx *hctx, struct blk_mq_tags *tags,
 	}
 }
 
+/*
+ * Free a batch of tags allocated from @tags, typically on completion of a
+ * batch of requests. Normal tags are cleared from the bitmap a word at a
+ * time with a single round of wakeups instead of going through the per-ctx
+ * cache one by one. @tag_array is clobbered.
+ */
+void blk_mq_put_tags(struct blk_mq_tags *tags, unsigned int *tag_array,
+		     int nr_tags)
+{
+	const int cpu = raw_smp_processor_id();
+	int i, nr = 0;
+
+	for (i = 0; i < nr_tags; i++) {
+		unsigned int tag = tag_array[i];
+
+		if (blk_mq_tag_is_reserved(tags, tag)) {
+			BUG_ON(tag >= tags->nr_reserved_tags);
+			sbitmap_queue_clear(&tags->breserved_tags, tag, cpu);
+			continue;
+		}
+
+		tag -= tags->nr_reserved_tags;
+		BUG_ON(tag >= tags->nr_tags);
+		tag_array[nr++] = tag;
+	}
+
+	sbitmap_queue_clear_batch(&tags->bitmap_tags, tag_array, nr, cpu);
+}
+
 struct bt_iter_data {
 	struct blk_mq_hw_ctx *hctx;
 	busy_iter_fn *fn;
@@ -160,6 +160,13 @@ void blk_freeze_queue(struct request_queue *q)
 	 */
 	blk_freeze_queue_start(q);
 	blk_mq_freeze_queue_wait(q);
+
+	/*
+	 * Tags parked in the per-cpu caches don't hold a queue reference,
+	 * give them back before the caller reconfigures the tag maps.
+	 */
+	if (q->mq_ops)
+		blk_mq_tag_cache_drain_queue(q);
 }
 
 void blk_mq_freeze_queue(struct request_queue *q)
@@ -329,12 +336,82 @@ static struct request *blk_mq_rq_ctx_init(struct blk_mq_alloc_data *data,
 	return rq;
 }
 
+/*
+ * Take the next request of a batch preallocated on the plug. Cached
+ * requests hold their own queue reference, so the one our caller took
+ * is dropped. The batch is given up if we moved to another queue or CPU.
+ */
+static struct request *blk_mq_get_cached_request(struct blk_plug *plug,
+		struct blk_mq_alloc_data *data, unsigned int op)
+{
+	struct request *rq;
+
+	if (list_empty(&plug->mq_cached))
+		return NULL;
+
+	rq = list_first_entry(&plug->mq_cached, struct request, queuelist);
+	if (rq->q != data->q || rq->mq_ctx != data->ctx) {
+		blk_mq_free_plug_rqs(plug);
+		return NULL;
+	}
+
+	list_del_init(&rq->queuelist);
+	rq->cmd_flags = op;
+	rq->start_time = jiffies;
+#ifdef CONFIG_BLK_CGROUP
+	set_start_time_ns(rq);
+#endif
+	blk_queue_exit(data->q);
+	return rq;
+}
+
+/*
+ * Allocate as much of the plug's expected batch as one bitmap word can
+ * hand out, return the first request and keep the rest on the plug.
+ */
+static struct request *blk_mq_get_request_batch(struct blk_plug *plug,
+		struct blk_mq_alloc_data *data, unsigned int op)
+{
+	struct request *rq = NULL, *next;
+	unsigned long tag_mask;
+	unsigned int tag_offset, i;
+
+	tag_mask = blk_mq_get_tags(data, plug->nr_ios, &tag_offset);
+	if (!tag_mask)
+		return NULL;
+
+	plug->nr_ios -= min_t(unsigned int, plug->nr_ios - 1,
+			      hweight_long(tag_mask));
+
+	for_each_set_bit(i, &tag_mask, BITS_PER_LONG) {
+		next = blk_mq_rq_ctx_init(data, tag_offset + i, op);
+		if (!rq) {
+			rq = next;
+			continue;
+		}
+		blk_queue_enter_live(data->q);
+		list_add_tail(&next->queuelist, &plug->mq_cached);
+	}
+	return rq;
+}
+
+void blk_mq_free_plug_rqs(struct blk_plug *plug)
+{
+	struct request *rq, *next;
+
+	list_for_each_entry_safe(rq, next, &plug->mq_cached, queuelist) {
+		list_del_init(&rq->queuelist);
+		blk_mq_free_request(rq);
+	}
+}
+
 static struct request *blk_mq_get_request(struct request_queue *q,
 		struct bio *bio, unsigned int op,
 		struct blk_mq_alloc_data *data)
 {
 	struct elevator_queue *e = q->elevator;
-	struct request *rq;
+	struct blk_plug *plug = current->plug;
+	struct request *rq = NULL;
 	unsigned int tag;
 	struct blk_mq_ctx *local_ctx = NULL;
 
@@ -356,19 +433,31 @@ static struct request *blk_mq_get_request(struct request_queue *q,
 		 */
 		if (!op_is_flush(op) && e->type->ops.mq.limit_depth)
 			e->type->ops.mq.limit_depth(op, data);
+	} else if (bio && plug && !op_is_flush(op)) {
+		/*
+		 * Without a scheduler, requests need no per-bio setup, so
+		 * a submitter that announced a batch can have its requests
+		 * allocated up front.
+		 */
+		rq = blk_mq_get_cached_request(plug, data, op);
+		if (!rq && plug->nr_ios > 1)
+			rq = blk_mq_get_request_batch(plug, data, op);
 	}
 
-	tag = blk_mq_get_tag(data);
-	if (tag == BLK_MQ_TAG_FAIL) {
-		if (local_ctx) {
-			blk_mq_put_ctx(local_ctx);
-			data->ctx = NULL;
+	if (!rq) {
+		tag = blk_mq_get_tag(data);
+		if (tag == BLK_MQ_TAG_FAIL) {
+			if (local_ctx) {
+				blk_mq_put_ctx(local_ctx);
+				data->ctx = NULL;
+			}
+			blk_queue_exit(q);
+			return NULL;
 		}
-		blk_queue_exit(q);
-		return NULL;
+
+		rq = blk_mq_rq_ctx_init(data, tag, op);
 	}
 
-	rq = blk_mq_rq_ctx_init(data, tag, op);
 	if (!op_is_flush(op)) {
 		rq->elv.icq = NULL;
 		if (e && e->type->ops.mq.prepare_request) {
@@ -455,13 +544,15 @@ struct request *blk_mq_alloc_request_hctx(struct request_queue *q,
 }
 EXPORT_SYMBOL_GPL(blk_mq_alloc_request_hctx);
 
-void blk_mq_free_request(struct request *rq)
+/*
+ * Everything that freeing a request does before giving its tags back.
+ */
+static void blk_mq_finish_request(struct request *rq,
+				  struct blk_mq_hw_ctx *hctx)
 {
 	struct request_queue *q = rq->q;
 	struct elevator_queue *e = q->elevator;
 	struct blk_mq_ctx *ctx = rq->mq_ctx;
-	struct blk_mq_hw_ctx *hctx = blk_mq_map_queue(q, ctx->cpu);
-	const int sched_tag = rq->internal_tag;
 
 	if (rq->rq_flags & RQF_ELVPRIV) {
 		if (e && e->type->ops.mq.finish_request)
@@ -480,6 +571,16 @@ void blk_mq_free_request(struct request *rq)
 
 	clear_bit(REQ_ATOM_STARTED, &rq->atomic_flags);
 	clear_bit(REQ_ATOM_POLL_SLEPT, &rq->atomic_flags);
+}
+
+void blk_mq_free_request(struct request *rq)
+{
+	struct request_queue *q = rq->q;
+	struct blk_mq_ctx *ctx = rq->mq_ctx;
+	struct blk_mq_hw_ctx *hctx = blk_mq_map_queue(q, ctx->cpu);
+	const int sched_tag = rq->internal_tag;
+
+	blk_mq_finish_request(rq, hctx);
 	if (rq->tag != -1)
 		blk_mq_put_tag(hctx, hctx->tags, ctx, rq->tag);
 	if (sched_tag != -1)
@@ -529,7 +630,7 @@ static void __blk_mq_complete_request(struct request *rq)
 		blk_mq_sched_completed_request(rq);
 	if (rq->rq_flags & RQF_STATS) {
 		blk_mq_poll_stats_start(rq->q);
-		blk_stat_add(rq);
+		blk_stat_add(rq, blk_stat_now());
 	}
 
 	if (!test_bit(QUEUE_FLAG_SAME_COMP, &rq->q->queue_flags)) {
@@ -571,6 +672,108 @@ void blk_mq_complete_request(struct request *rq)
 }
 EXPORT_SYMBOL(blk_mq_complete_request);
 
+#define BLK_MQ_FREE_BATCH	32
+
+/* Completed requests of one hardware queue whose tags are freed together. */
+struct blk_mq_free_batch {
+	struct blk_mq_hw_ctx *hctx;
+	int nr_rqs;
+	int nr_tags;
+	int nr_sched_tags;
+	unsigned int tags[BLK_MQ_FREE_BATCH];
+	unsigned int sched_tags[BLK_MQ_FREE_BATCH];
+};
+
+static void blk_mq_flush_free_batch(struct blk_mq_free_batch *fb)
+{
+	struct blk_mq_hw_ctx *hctx = fb->hctx;
+
+	if (!fb->nr_rqs)
+		return;
+
+	if (fb->nr_tags)
+		blk_mq_put_tags(hctx->tags, fb->tags, fb->nr_tags);
+	if (fb->nr_sched_tags)
+		blk_mq_put_tags(hctx->sched_tags, fb->sched_tags,
+				fb->nr_sched_tags);
+	blk_mq_sched_restart(hctx);
+	percpu_ref_put_many(&hctx->queue->q_usage_counter, fb->nr_rqs);
+
+	fb->nr_rqs = fb->nr_tags = fb->nr_sched_tags = 0;
+}
+
+static void blk_mq_free_request_batch(struct request *rq,
+				      struct blk_mq_free_batch *fb)
+{
+	struct blk_mq_hw_ctx *hctx = blk_mq_map_queue(rq->q, rq->mq_ctx->cpu);
+
+	if (hctx != fb->hctx || fb->nr_rqs == BLK_MQ_FREE_BATCH) {
+		blk_mq_flush_free_batch(fb);
+		fb->hctx = hctx;
+	}
+
+	blk_mq_finish_request(rq, hctx);
+	if (rq->tag != -1)
+		fb->tags[fb->nr_tags++] = rq->tag;
+	if (rq->internal_tag != -1)
+		fb->sched_tags[fb->nr_sched_tags++] = rq->internal_tag;
+	fb->nr_rqs++;
+}
+
+/**
+ * blk_mq_complete_request_batch - end I/O on a batch of successful requests
+ * @list:	the requests, linked through ->queuelist
+ *
+ * Description:
+ *	For drivers that reap several completions at once, e.g. from their
+ *	interrupt handler. Each request is completed and ended with
+ *	BLK_STS_OK, as if by blk_mq_complete_request() and a ->complete
+ *	handler calling blk_mq_end_request(), except that everything runs
+ *	in the caller's context and ->complete is not called. Statistics
+ *	share one timestamp, and tags are given back with one bitmap update
+ *	and one round of wakeups per hardware queue and batch. Requests
+ *	already claimed by the timeout handler are skipped. @list is empty
+ *	on return.
+ **/
+void blk_mq_complete_request_batch(struct list_head *list)
+{
+	struct blk_mq_free_batch fb = { .hctx = NULL, };
+	struct request *rq, *next;
+	u64 now = 0;
+
+	list_for_each_entry_safe(rq, next, list, queuelist) {
+		struct request_queue *q = rq->q;
+
+		list_del_init(&rq->queuelist);
+		if (unlikely(blk_should_fake_timeout(q)))
+			continue;
+		if (blk_mark_rq_complete(rq))
+			continue;
+
+		if (rq->internal_tag != -1)
+			blk_mq_sched_completed_request(rq);
+		if (rq->rq_flags & RQF_STATS) {
+			if (!now)
+				now = blk_stat_now();
+			blk_mq_poll_stats_start(q);
+			blk_stat_add(rq, now);
+		}
+
+		if (blk_update_request(rq, BLK_STS_OK, blk_rq_bytes(rq)))
+			BUG();
+
+		if (rq->end_io || unlikely(blk_bidi_rq(rq))) {
+			__blk_mq_end_request(rq, BLK_STS_OK);
+			continue;
+		}
+
+		blk_account_io_done(rq);
+		blk_mq_free_request_batch(rq, &fb);
+	}
+	blk_mq_flush_free_batch(&fb);
+}
+EXPORT_SYMBOL(blk_mq_complete_request_batch);
+
 int blk_mq_request_started(struct request *rq)
 {
 	return test_bit(REQ_ATOM_STARTED, &rq->atomic_flags);
@@ -2041,6 +2244,7 @@ static void blk_mq_init_cpu_queues(struct request_queue *q,
 		__ctx->cpu = i;
 		spin_lock_init(&__ctx->lock);
 		INIT_LIST_HEAD(&__ctx->rq_list);
+		spin_lock_init(&__ctx->tag_cache_lock);
 		__ctx->queue = q;
 
 		/* If the cpu isn't present, the cpu is mapped to first hctx */
@@ -2099,6 +2303,9 @@ static void blk_mq_map_swqueue(struct request_queue *q)
 	 */
 	mutex_lock(&q->sysfs_lock);
 
+	/* cached tags belong to the hctx their ctx is mapped to right now */
+	blk_mq_tag_cache_drain_queue(q);
+
 	queue_for_each_hw_ctx(q, hctx, i) {
 		cpumask_clear(hctx->cpumask);
 		hctx->nr_ctx = 0;
@@ -6,6 +6,8 @@
 
 struct blk_mq_tag_set;
 
+#define BLK_MQ_CTX_TAG_CACHE	16
+
 struct blk_mq_ctx {
 	struct {
 		spinlock_t		lock;
@@ -22,6 +24,13 @@ struct blk_mq_ctx {
 	/* incremented at completion time */
 	unsigned long		____cacheline_aligned_in_smp rq_completed[2];
 
+	/* driver tags cached for allocations on this cpu, see blk-mq-tag.c */
+	struct {
+		spinlock_t		tag_cache_lock;
+		unsigned int		nr_cached_tags;
+		unsigned int		cached_tags[BLK_MQ_CTX_TAG_CACHE];
+	} ____cacheline_aligned_in_smp;
+
 	struct request_queue	*queue;
 	struct kobject		kobj;
 } ____cacheline_aligned_in_smp;
@@ -31,6 +40,7 @@ void blk_mq_freeze_queue(struct request_queue *q);
 void blk_mq_free_queue(struct request_queue *q);
 int blk_mq_update_nr_requests(struct request_queue *q, unsigned int nr);
 void blk_mq_wake_waiters(struct request_queue *q);
+void blk_mq_free_plug_rqs(struct blk_plug *plug);
 bool blk_mq_dispatch_rq_list(struct request_queue *, struct list_head *);
 void blk_mq_flush_busy_ctxs(struct blk_mq_hw_ctx *hctx, struct list_head *list);
 bool blk_mq_hctx_has_pending(struct blk_mq_hw_ctx *hctx);
@@ -80,7 +80,7 @@ struct blk_stat_callback {
 struct blk_queue_stats *blk_alloc_queue_stats(void);
 void blk_free_queue_stats(struct blk_queue_stats *);
 
-void blk_stat_add(struct request *);
+void blk_stat_add(struct request *rq, u64 now);
 
 static inline u64 __blk_stat_time(u64 time)
 {
@@ -92,6 +92,12 @@ static inline u64 blk_stat_time(struct blk_issue_stat *stat)
 	return __blk_stat_time(stat->stat);
 }
 
+/* Current time in the format of blk_stat_time(), for blk_stat_add(). */
+static inline u64 blk_stat_now(void)
+{
+	return __blk_stat_time(ktime_to_ns(ktime_get()));
+}
+
 static inline sector_t blk_capped_size(sector_t size)
 {
 	return size & ((1ULL << BLK_STAT_SIZE_BITS) - 1);
@@ -202,4 +208,17 @@ static inline void blk_stat_activate_msecs(struct blk_stat_callback *cb,
 	mod_timer(&cb->timer, jiffies + msecs_to_jiffies(msecs));
 }
 
+/**
+ * blk_rq_stat_init() - Reset a statistics bucket.
+ * @stat: The bucket.
+ */
+void blk_rq_stat_init(struct blk_rq_stat *stat);
+
+/**
+ * blk_rq_stat_sum() - Fold one statistics bucket into another.
+ * @dst: Bucket to accumulate into.
+ * @src: Bucket to add. Any pending batch in @src is flushed first.
+ */
+void blk_rq_stat_sum(struct blk_rq_stat *dst, struct blk_rq_stat *src);
+
 #endif
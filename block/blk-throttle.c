@@ -38,6 +38,9 @@ static int throtl_quantum = 32;
 
 #define SKIP_LATENCY (((u64)1) << BLK_STAT_RES_SHIFT)
 
+/* Max number of bios pre-charged into a per-cpu budget in one refill */
+#define THROTL_BUDGET_IOS (8)
+
 static struct blkcg_policy blkcg_policy_throtl;
 
 /* A workqueue to queue throttle related work */
@@ -106,6 +109,20 @@ enum {
 	LIMIT_CNT,
 };
 
+/*
+ * Dispatch budget a cpu may spend without taking the queue lock. It has
+ * already been charged to the group and all of its ancestors, see
+ * tg_refill_budget(). Starting or trimming a slice at any of those levels
+ * resets the counters the budget was charged to, so every such event bumps
+ * the queue wide td->budget_gen. A budget whose @gen doesn't match is
+ * stale and treated as empty.
+ */
+struct throtl_budget {
+	uint64_t bytes[2];
+	unsigned int ios[2];
+	unsigned int gen;
+};
+
 struct throtl_grp {
 	/* must be the first member */
 	struct blkg_policy_data pd;
@@ -179,6 +196,9 @@ struct throtl_grp {
 	unsigned int bio_cnt; /* total bios */
 	unsigned int bad_bio_cnt; /* bios exceeding latency threshold */
 	unsigned long bio_cnt_reset_time;
+
+	/* lockless dispatch budget, see struct throtl_budget */
+	struct throtl_budget __percpu *budget;
 };
 
 /* We measure latency for request size from <= 4k to >= 1M */
@@ -223,6 +243,9 @@ struct throtl_data
 	unsigned long filtered_latency;
 
 	bool track_bio_latency;
+
+	/* generation of valid per-cpu budgets, see throtl_drop_budgets() */
+	unsigned int budget_gen;
 };
 
 static void throtl_pending_timer_fn(unsigned long arg);
@@ -491,6 +514,12 @@ static struct blkg_policy_data *throtl_pd_alloc(gfp_t gfp, int node)
 	if (!tg)
 		return NULL;
 
+	tg->budget = alloc_percpu_gfp(struct throtl_budget, gfp);
+	if (!tg->budget) {
+		kfree(tg);
+		return NULL;
+	}
+
 	throtl_service_queue_init(&tg->service_queue);
 
 	for (rw = READ; rw <= WRITE; rw++) {
@@ -611,6 +640,7 @@ static void throtl_pd_free(struct blkg_policy_data *pd)
 	struct throtl_grp *tg = pd_to_tg(pd);
 
 	del_timer_sync(&tg->service_queue.pending_timer);
+	free_percpu(tg->budget);
 	kfree(tg);
 }
 
@@ -766,9 +796,21 @@ static bool throtl_schedule_next_dispatch(struct throtl_service_queue *sq,
 	return false;
 }
 
+/*
+ * Invalidate all per-cpu dispatch budgets on the queue. They were charged
+ * to bytes_disp/io_disp of every level of their group's hierarchy, which
+ * the caller is about to reset or trim, so the remainder must not be spent
+ * against the new accounting.
+ */
+static inline void throtl_drop_budgets(struct throtl_data *td)
+{
+	WRITE_ONCE(td->budget_gen, td->budget_gen + 1);
+}
+
 static inline void throtl_start_new_slice_with_credit(struct throtl_grp *tg,
 		bool rw, unsigned long start)
 {
+	throtl_drop_budgets(tg->td);
 	tg->bytes_disp[rw] = 0;
 	tg->io_disp[rw] = 0;
 
@@ -790,6 +832,7 @@ static inline void throtl_start_new_slice_with_credit(struct throtl_grp *tg,
 
 static inline void throtl_start_new_slice(struct throtl_grp *tg, bool rw)
 {
+	throtl_drop_budgets(tg->td);
 	tg->bytes_disp[rw] = 0;
 	tg->io_disp[rw] = 0;
 	tg->slice_start[rw] = jiffies;
@@ -867,6 +910,8 @@ static inline void throtl_trim_slice(struct throtl_grp *tg, bool rw)
 	if (!bytes_trim && !io_trim)
 		return;
 
+	throtl_drop_budgets(tg->td);
+
 	if (tg->bytes_disp[rw] >= bytes_trim)
 		tg->bytes_disp[rw] -= bytes_trim;
 	else
@@ -2119,11 +2164,127 @@ static void blk_throtl_assoc_bio(struct throtl_grp *tg, struct bio *bio)
 #endif
 }
 
+/*
+ * Number of bytes and ios @tg may still dispatch in the current slice
+ * without exceeding its limits.
+ */
+static void tg_dispatch_headroom(struct throtl_grp *tg, bool rw,
+				 uint64_t *bytes, unsigned int *ios)
+{
+	unsigned long jiffy_elapsed_rnd;
+	uint64_t bps_limit = tg_bps_limit(tg, rw);
+	unsigned int iops_limit = tg_iops_limit(tg, rw);
+	u64 tmp;
+
+	jiffy_elapsed_rnd = jiffies - tg->slice_start[rw];
+	if (!jiffy_elapsed_rnd)
+		jiffy_elapsed_rnd = tg->td->throtl_slice;
+	jiffy_elapsed_rnd = roundup(jiffy_elapsed_rnd, tg->td->throtl_slice);
+
+	*bytes = U64_MAX;
+	if (bps_limit != U64_MAX) {
+		tmp = bps_limit * jiffy_elapsed_rnd;
+		do_div(tmp, HZ);
+		*bytes = tmp > tg->bytes_disp[rw] ? tmp - tg->bytes_disp[rw] : 0;
+	}
+
+	*ios = UINT_MAX;
+	if (iops_limit != UINT_MAX) {
+		tmp = (u64)iops_limit * jiffy_elapsed_rnd;
+		do_div(tmp, HZ);
+		*ios = tmp > tg->io_disp[rw] ?
+			min_t(u64, tmp - tg->io_disp[rw], UINT_MAX) : 0;
+	}
+}
+
+/*
+ * @bio from @tg was just dispatched through the whole hierarchy. Assume
+ * more bios of the same size follow, and pre-charge a budget for up to
+ * THROTL_BUDGET_IOS of them to every level, limited by what the most
+ * constrained level can still dispatch in its current slice. The budget
+ * lands on the local cpu, where blk_throtl_bio_fast() spends it without
+ * the queue lock.
+ */
+static void tg_refill_budget(struct throtl_grp *tg, struct bio *bio)
+{
+	bool rw = bio_data_dir(bio);
+	unsigned int bio_size = throtl_bio_data_size(bio);
+	struct throtl_service_queue *sq;
+	struct throtl_budget *budget;
+	struct throtl_grp *pos;
+	uint64_t bytes = U64_MAX, tg_bytes;
+	unsigned int ios = THROTL_BUDGET_IOS, tg_ios;
+
+	lockdep_assert_held(tg->td->queue->queue_lock);
+
+	if (tg->td->limit_valid[LIMIT_LOW] || !bio_size)
+		return;
+
+	for (pos = tg; pos; pos = sq_to_tg(sq)) {
+		sq = pos->service_queue.parent_sq;
+		tg_dispatch_headroom(pos, rw, &tg_bytes, &tg_ios);
+		bytes = min(bytes, tg_bytes);
+		ios = min(ios, tg_ios);
+	}
+
+	ios = min_t(uint64_t, ios, div_u64(bytes, bio_size));
+	if (!ios)
+		return;
+	bytes = (uint64_t)ios * bio_size;
+
+	for (pos = tg; pos; pos = sq_to_tg(sq)) {
+		sq = pos->service_queue.parent_sq;
+		pos->bytes_disp[rw] += bytes;
+		pos->io_disp[rw] += ios;
+		pos->last_bytes_disp[rw] += bytes;
+		pos->last_io_disp[rw] += ios;
+	}
+
+	budget = this_cpu_ptr(tg->budget);
+	if (budget->gen != tg->td->budget_gen) {
+		memset(budget, 0, sizeof(*budget));
+		budget->gen = tg->td->budget_gen;
+	}
+	budget->bytes[rw] += bytes;
+	budget->ios[rw] += ios;
+}
+
+/*
+ * Try to admit @bio from the local cpu's pre-charged budget of @tg. Only
+ * used while no low limits are configured, as those need the upgrade and
+ * downgrade checks in the slow path for every bio.
+ */
+static bool blk_throtl_bio_fast(struct throtl_grp *tg, struct bio *bio)
+{
+	bool rw = bio_data_dir(bio);
+	unsigned int bio_size = throtl_bio_data_size(bio);
+	struct throtl_budget *budget;
+	unsigned long flags;
+	bool ret = false;
+
+	if (READ_ONCE(tg->td->limit_valid[LIMIT_LOW]) ||
+	    READ_ONCE(tg->service_queue.nr_queued[rw]))
+		return false;
+
+	local_irq_save(flags);
+	budget = this_cpu_ptr(tg->budget);
+	if (budget->gen == READ_ONCE(tg->td->budget_gen) && budget->ios[rw] &&
+	    budget->bytes[rw] >= bio_size) {
+		budget->ios[rw]--;
+		budget->bytes[rw] -= bio_size;
+		ret = true;
+	}
+	local_irq_restore(flags);
+
+	return ret;
+}
+
 bool blk_throtl_bio(struct request_queue *q, struct blkcg_gq *blkg,
 		    struct bio *bio)
 {
 	struct throtl_qnode *qn = NULL;
 	struct throtl_grp *tg = blkg_to_tg(blkg ?: q->root_blkg);
+	struct throtl_grp *leaf = tg;
 	struct throtl_service_queue *sq;
 	bool rw = bio_data_dir(bio);
 	bool throttled = false;
@@ -2135,6 +2296,11 @@ bool blk_throtl_bio(struct request_queue *q, struct blkcg_gq *blkg,
 	if (bio_flagged(bio, BIO_THROTTLED) || !tg->has_rules[rw])
 		goto out;
 
+	if (blk_throtl_bio_fast(tg, bio)) {
+		blk_throtl_assoc_bio(tg, bio);
+		goto out;
+	}
+
 	spin_lock_irq(q->queue_lock);
 
 	throtl_update_latency_buckets(td);
@@ -2191,8 +2357,10 @@ bool blk_throtl_bio(struct request_queue *q, struct blkcg_gq *blkg,
 		qn = &tg->qnode_on_parent[rw];
 		sq = sq->parent_sq;
 		tg = sq_to_tg(sq);
-		if (!tg)
+		if (!tg) {
+			tg_refill_budget(leaf, bio);
 			goto out_unlock;
+		}
 	}
 
 	/* out-of-limit, queue to @tg */
@@ -14,6 +14,10 @@
  *   scaling step of 0 if reads show up or the heavy writers finish. Unlike
  *   positive scaling steps where we shrink the monitoring window, a negative
  *   scaling step retains the default step==0 window size.
+ * - Optionally, learn how read latency behaves at each write depth. Every
+ *   window with a valid read/write mix feeds the mean read latency into a
+ *   per-depth model. Once a depth is known to push reads past the target,
+ *   don't scale up into it again until that knowledge goes stale.
  *
  * Copyright (C) 2016 Jens Axboe
  *
@@ -51,6 +55,17 @@ enum {
 	 * information to scale up or down, scale up.
 	 */
 	RWB_UNKNOWN_BUMP	= 5,
+
+	/*
+	 * Windows a model bucket needs before we trust it
+	 */
+	RWB_MODEL_MIN_WINDOWS	= 4,
+
+	/*
+	 * Forget a model bucket if it hasn't been sampled in this many
+	 * windows, so we eventually probe a capped depth again.
+	 */
+	RWB_MODEL_STALE		= 50,
 };
 
 static inline bool rwb_enabled(struct rq_wb *rwb)
@@ -235,6 +250,16 @@ static bool calc_wb_limits(struct rq_wb *rwb)
 			}
 		}
 
+		/*
+		 * If we have learned that deeper writes hurt reads, don't
+		 * go there.
+		 */
+		if (rwb->learn && rwb->model.max_depth &&
+		    depth >= rwb->model.max_depth) {
+			depth = rwb->model.max_depth;
+			ret = true;
+		}
+
 		/*
 		 * Set our max/normal/bg queue depths based on how far
 		 * we have scaled down (->scale_step).
@@ -329,6 +354,59 @@ static int latency_exceeded(struct rq_wb *rwb, struct blk_rq_stat *stat)
 	return LAT_OK;
 }
 
+static unsigned int rwb_model_bucket(unsigned int depth)
+{
+	return min_t(unsigned int, ilog2(depth), WBT_MODEL_BUCKETS - 1);
+}
+
+/*
+ * The cap is the largest depth below the first bucket whose read latency
+ * exceeds the target. If no trusted bucket exceeds it, there's no cap.
+ */
+static void rwb_model_calc_depth(struct rq_wb *rwb)
+{
+	struct wbt_lat_model *model = &rwb->model;
+	unsigned int i;
+
+	model->max_depth = 0;
+	for (i = 0; i < WBT_MODEL_BUCKETS; i++) {
+		if (model->nr_windows[i] < RWB_MODEL_MIN_WINDOWS)
+			continue;
+		if (model->lat_nsec[i] > rwb->min_lat_nsec) {
+			model->max_depth = max(1U, (1U << i) - 1);
+			break;
+		}
+	}
+}
+
+static void rwb_model_update(struct rq_wb *rwb, struct blk_rq_stat *stat)
+{
+	struct wbt_lat_model *model = &rwb->model;
+	unsigned int i;
+
+	model->window++;
+
+	if (rwb->wb_max && stat_sample_valid(stat)) {
+		i = rwb_model_bucket(rwb->wb_max);
+		if (!model->nr_windows[i])
+			model->lat_nsec[i] = stat[READ].mean;
+		else
+			model->lat_nsec[i] = (model->lat_nsec[i] * 7 +
+					      stat[READ].mean) >> 3;
+		if (model->nr_windows[i] < UINT_MAX)
+			model->nr_windows[i]++;
+		model->last_window[i] = model->window;
+	}
+
+	for (i = 0; i < WBT_MODEL_BUCKETS; i++) {
+		if (model->nr_windows[i] &&
+		    model->window - model->last_window[i] > RWB_MODEL_STALE)
+			model->nr_windows[i] = 0;
+	}
+
+	rwb_model_calc_depth(rwb);
+}
+
 static void rwb_trace_step(struct rq_wb *rwb, const char *msg)
 {
 	struct backing_dev_info *bdi = rwb->queue->backing_dev_info;
@@ -409,6 +487,8 @@ static void wb_timer_fn(struct blk_stat_callback *cb)
 	int status;
 
 	status = latency_exceeded(rwb, cb->stat);
+	if (rwb->learn)
+		rwb_model_update(rwb, cb->stat);
 
 	trace_wbt_timer(rwb->queue->backing_dev_info, status, rwb->scale_step,
 			inflight);
@@ -461,6 +541,7 @@ void wbt_update_limits(struct rq_wb *rwb)
 {
 	rwb->scale_step = 0;
 	rwb->scaled_max = false;
+	rwb_model_calc_depth(rwb);
 	calc_wb_limits(rwb);
 
 	rwb_wake_all(rwb);
@@ -653,6 +734,26 @@ void wbt_set_write_cache(struct rq_wb *rwb, bool write_cache_on)
 		rwb->wc = write_cache_on;
 }
 
+/*
+ * Switch the learned latency model on or off. The model is kept when
+ * learning is turned off, but no longer limits the write depth.
+ */
+void wbt_set_learning(struct rq_wb *rwb, bool learn)
+{
+	if (rwb) {
+		rwb->learn = learn;
+		wbt_update_limits(rwb);
+	}
+}
+
+void wbt_reset_model(struct rq_wb *rwb)
+{
+	if (rwb) {
+		memset(&rwb->model, 0, sizeof(rwb->model));
+		wbt_update_limits(rwb);
+	}
+}
+
 /*
  * Disable wbt, if enabled by default.
  */
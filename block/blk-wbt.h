@@ -31,6 +31,22 @@ enum {
 	WBT_STATE_ON_MANUAL	= 2,
 };
 
+/*
+ * Depth buckets of the learned latency model. Bucket 'i' covers write
+ * depths [2^i, 2^(i+1) - 1], the last bucket everything above that.
+ */
+enum {
+	WBT_MODEL_BUCKETS	= 10,
+};
+
+struct wbt_lat_model {
+	u64 lat_nsec[WBT_MODEL_BUCKETS];	/* read latency, ewma of means */
+	unsigned int nr_windows[WBT_MODEL_BUCKETS];
+	unsigned int last_window[WBT_MODEL_BUCKETS];
+	unsigned int window;			/* windows seen so far */
+	unsigned int max_depth;			/* learned cap, 0 if none */
+};
+
 static inline void wbt_clear_state(struct blk_issue_stat *stat)
 {
 	stat->stat &= ~BLK_STAT_RES_MASK;
@@ -73,6 +89,13 @@ struct rq_wb {
 
 	short enable_state;			/* WBT_STATE_* */
 
+	/*
+	 * If set, cap the write depth by what the latency model says
+	 * keeps reads within ->min_lat_nsec.
+	 */
+	bool learn;
+	struct wbt_lat_model model;
+
 	/*
 	 * Number of consecutive periods where we don't have enough
 	 * information to make a firm scale up/down decision.
@@ -122,6 +145,8 @@ void wbt_enable_default(struct request_queue *);
 
 void wbt_set_queue_depth(struct rq_wb *, unsigned int);
 void wbt_set_write_cache(struct rq_wb *, bool);
+void wbt_set_learning(struct rq_wb *, bool);
+void wbt_reset_model(struct rq_wb *);
 
 u64 wbt_default_latency_nsec(struct request_queue *);
 
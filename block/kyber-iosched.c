@@ -19,6 +19,7 @@
 
 #include <linux/kernel.h>
 #include <linux/blkdev.h>
+#include <linux/blk-cgroup.h>
 #include <linux/blk-mq.h>
 #include <linux/elevator.h>
 #include <linux/module.h>
@@ -72,6 +73,47 @@ static const unsigned int kyber_batch_size[] = {
 	[KYBER_OTHER] = 8,
 };
 
+/*
+ * Number of groups with their own statistics buckets. Slot 0 is shared by
+ * the root group and by any group that couldn't get a slot of its own.
+ */
+#ifdef CONFIG_KYBER_GROUP_IOSCHED
+#define KYBER_NR_GROUPS 16
+#else
+#define KYBER_NR_GROUPS 1
+#endif
+
+struct kyber_queue_data;
+
+struct kyber_group {
+#ifdef CONFIG_KYBER_GROUP_IOSCHED
+	/* Must be the first member. */
+	struct blkg_policy_data pd;
+#endif
+	struct kyber_queue_data *kqd;
+
+	/* Statistics bucket, see KYBER_NR_GROUPS. */
+	int slot;
+
+	/*
+	 * Number of dispatched requests of this group per domain and the
+	 * limit on that number. A group is only throttled while its depth is
+	 * below kyber_depth[] for the domain.
+	 */
+	unsigned int depth[KYBER_NUM_DOMAINS];
+	atomic_t inflight[KYBER_NUM_DOMAINS];
+};
+
+#ifdef CONFIG_KYBER_GROUP_IOSCHED
+struct kyber_cgroup {
+	/* Must be the first member. */
+	struct blkcg_policy_data cpd;
+
+	/* Target latencies in nanoseconds, 0 to use the queue's targets. */
+	u64 read_lat_nsec, write_lat_nsec;
+};
+#endif
+
 struct kyber_queue_data {
 	struct request_queue *q;
 
@@ -92,6 +134,17 @@ struct kyber_queue_data {
 
 	/* Target latencies in nanoseconds. */
 	u64 read_lat_nsec, write_lat_nsec;
+
+	/* Group for requests without a cgroup of their own, slot 0. */
+	struct kyber_group default_group;
+
+#ifdef CONFIG_KYBER_GROUP_IOSCHED
+	/* Groups indexed by slot, protected by the queue lock. */
+	struct kyber_group *groups[KYBER_NR_GROUPS];
+
+	/* Whether any group's depth is currently below kyber_depth[]. */
+	bool groups_throttled;
+#endif
 };
 
 struct kyber_hctx_data {
@@ -126,15 +179,20 @@ enum {
 #define IS_GOOD(status) ((status) > 0)
 #define IS_BAD(status) ((status) < 0)
 
-static int kyber_lat_status(struct blk_stat_callback *cb,
-			    unsigned int sched_domain, u64 target)
+static struct blk_rq_stat *kyber_stat(struct blk_stat_callback *cb, int slot,
+				      unsigned int sched_domain)
+{
+	return &cb->stat[slot * KYBER_NUM_DOMAINS + sched_domain];
+}
+
+static int kyber_lat_status(struct blk_rq_stat *stat, u64 target)
 {
 	u64 latency;
 
-	if (!cb->stat[sched_domain].nr_samples)
+	if (!stat->nr_samples)
 		return NONE;
 
-	latency = cb->stat[sched_domain].mean;
+	latency = stat->mean;
 	if (latency >= 2 * target)
 		return AWFUL;
 	else if (latency > target)
@@ -146,26 +204,20 @@ static int kyber_lat_status(struct blk_stat_callback *cb,
 }
 
 /*
- * Adjust the read or synchronous write depth given the status of reads and
- * writes. The goal is that the latencies of the two domains are fair (i.e., if
- * one is good, then the other is good).
+ * Compute a new depth given the status of this domain and the status of the
+ * one it competes with, capped at @max_depth.
  */
-static void kyber_adjust_rw_depth(struct kyber_queue_data *kqd,
-				  unsigned int sched_domain, int this_status,
-				  int other_status)
+static unsigned int kyber_next_depth(unsigned int depth, unsigned int max_depth,
+				     int this_status, int other_status)
 {
-	unsigned int orig_depth, depth;
-
 	/*
-	 * If this domain had no samples, or reads and writes are both good or
-	 * both bad, don't adjust the depth.
+	 * If this domain had no samples, or both are good or both are bad,
+	 * don't adjust the depth.
 	 */
 	if (this_status == NONE ||
 	    (IS_GOOD(this_status) && IS_GOOD(other_status)) ||
 	    (IS_BAD(this_status) && IS_BAD(other_status)))
-		return;
-
-	orig_depth = depth = kqd->domain_tokens[sched_domain].sb.depth;
+		return depth;
 
 	if (other_status == NONE) {
 		depth++;
@@ -195,7 +247,23 @@ static void kyber_adjust_rw_depth(struct kyber_queue_data *kqd,
 		}
 	}
 
-	depth = clamp(depth, 1U, kyber_depth[sched_domain]);
+	return clamp(depth, 1U, max_depth);
+}
+
+/*
+ * Adjust the read or synchronous write depth given the status of reads and
+ * writes. The goal is that the latencies of the two domains are fair (i.e., if
+ * one is good, then the other is good).
+ */
+static void kyber_adjust_rw_depth(struct kyber_queue_data *kqd,
+				  unsigned int sched_domain, int this_status,
+				  int other_status)
+{
+	unsigned int orig_depth, depth;
+
+	orig_depth = kqd->domain_tokens[sched_domain].sb.depth;
+	depth = kyber_next_depth(orig_depth, kyber_depth[sched_domain],
+				 this_status, other_status);
 	if (depth != orig_depth)
 		sbitmap_queue_resize(&kqd->domain_tokens[sched_domain], depth);
 }
@@ -244,6 +312,152 @@ static void kyber_adjust_other_depth(struct kyber_queue_data *kqd,
 		sbitmap_queue_resize(&kqd->domain_tokens[KYBER_OTHER], depth);
 }
 
+#ifdef CONFIG_KYBER_GROUP_IOSCHED
+static struct blkcg_policy blkcg_policy_kyber;
+
+static struct kyber_group *pd_to_kg(struct blkg_policy_data *pd)
+{
+	return pd ? container_of(pd, struct kyber_group, pd) : NULL;
+}
+
+static struct kyber_group *blkg_to_kg(struct blkcg_gq *blkg)
+{
+	return pd_to_kg(blkg_to_pd(blkg, &blkcg_policy_kyber));
+}
+
+static struct kyber_cgroup *cpd_to_kcg(struct blkcg_policy_data *cpd)
+{
+	return cpd ? container_of(cpd, struct kyber_cgroup, cpd) : NULL;
+}
+
+static struct kyber_cgroup *blkcg_to_kcg(struct blkcg *blkcg)
+{
+	return cpd_to_kcg(blkcg_to_cpd(blkcg, &blkcg_policy_kyber));
+}
+#endif
+
+/*
+ * The latency target of a group for a domain: the one configured for its
+ * cgroup, if any, or else the queue's.
+ */
+static u64 kyber_group_lat_nsec(struct kyber_queue_data *kqd,
+				struct kyber_group *kg,
+				unsigned int sched_domain)
+{
+	u64 target = 0;
+
+#ifdef CONFIG_KYBER_GROUP_IOSCHED
+	if (kg->pd.blkg) {
+		struct kyber_cgroup *kcg = blkcg_to_kcg(kg->pd.blkg->blkcg);
+
+		if (sched_domain == KYBER_READ)
+			target = READ_ONCE(kcg->read_lat_nsec);
+		else
+			target = READ_ONCE(kcg->write_lat_nsec);
+	}
+#endif
+	if (!target)
+		target = sched_domain == KYBER_READ ? kqd->read_lat_nsec :
+						      kqd->write_lat_nsec;
+	return target;
+}
+
+#ifdef CONFIG_KYBER_GROUP_IOSCHED
+static struct kyber_group *kyber_slot_group(struct kyber_queue_data *kqd,
+					    int slot)
+{
+	return slot ? kqd->groups[slot] : &kqd->default_group;
+}
+
+/*
+ * Adjust the depth of each group. A group that is meeting its own target is
+ * throttled while the worst off of the other groups is missing its target,
+ * using the same steps as the device-wide read and write depths, and gets its
+ * depth back once the others are doing fine. Returns true if we need to keep
+ * monitoring, i.e., a group is throttled or is missing its target.
+ */
+static bool kyber_adjust_group_depths(struct kyber_queue_data *kqd,
+				      struct blk_stat_callback *cb)
+{
+	static const unsigned int domains[] = { KYBER_READ, KYBER_SYNC_WRITE };
+	int status[KYBER_NR_GROUPS][ARRAY_SIZE(domains)];
+	bool throttled = false, bad = false;
+	struct kyber_group *kg;
+	int slot, i, j;
+
+	spin_lock_irq(kqd->q->queue_lock);
+
+	for (slot = 0; slot < KYBER_NR_GROUPS; slot++) {
+		kg = kyber_slot_group(kqd, slot);
+		for (i = 0; i < ARRAY_SIZE(domains); i++) {
+			status[slot][i] = NONE;
+			if (!kg)
+				continue;
+			status[slot][i] = kyber_lat_status(
+				kyber_stat(cb, slot, domains[i]),
+				kyber_group_lat_nsec(kqd, kg, domains[i]));
+			if (IS_BAD(status[slot][i]))
+				bad = true;
+		}
+	}
+
+	for (slot = 1; slot < KYBER_NR_GROUPS; slot++) {
+		kg = kqd->groups[slot];
+		if (!kg)
+			continue;
+
+		for (i = 0; i < ARRAY_SIZE(domains); i++) {
+			unsigned int sched_domain = domains[i];
+			unsigned int max_depth = kyber_depth[sched_domain];
+			unsigned int domain_depth, depth;
+			int other_status = NONE;
+
+			for (j = 0; j < KYBER_NR_GROUPS; j++) {
+				if (j == slot || status[j][i] == NONE)
+					continue;
+				if (other_status == NONE ||
+				    status[j][i] < other_status)
+					other_status = status[j][i];
+			}
+
+			/*
+			 * Start from the device-wide depth so that throttling
+			 * takes effect right away, and treat anything at or
+			 * above it as not throttled. An idle group isn't held
+			 * back when it comes back.
+			 */
+			domain_depth = kqd->domain_tokens[sched_domain].sb.depth;
+			if (status[slot][i] == NONE) {
+				depth = max_depth;
+			} else {
+				depth = min(kg->depth[sched_domain], domain_depth);
+				depth = kyber_next_depth(depth, max_depth,
+							 status[slot][i],
+							 other_status);
+				if (depth >= domain_depth)
+					depth = max_depth;
+			}
+
+			WRITE_ONCE(kg->depth[sched_domain], depth);
+			if (depth < max_depth)
+				throttled = true;
+		}
+	}
+
+	WRITE_ONCE(kqd->groups_throttled, throttled);
+
+	spin_unlock_irq(kqd->q->queue_lock);
+
+	return throttled || bad;
+}
+#else
+static bool kyber_adjust_group_depths(struct kyber_queue_data *kqd,
+				      struct blk_stat_callback *cb)
+{
+	return false;
+}
+#endif
+
 /*
  * Apply heuristics for limiting queue depths based on gathered latency
  * statistics.
@@ -251,22 +465,35 @@ static void kyber_adjust_other_depth(struct kyber_queue_data *kqd,
 static void kyber_stat_timer_fn(struct blk_stat_callback *cb)
 {
 	struct kyber_queue_data *kqd = cb->data;
+	struct blk_rq_stat stat[KYBER_NUM_DOMAINS];
 	int read_status, write_status;
+	bool groups_bad;
+	int i, slot;
+
+	/* The device-wide depths are driven by the totals over all groups. */
+	for (i = 0; i < KYBER_NUM_DOMAINS; i++) {
+		blk_rq_stat_init(&stat[i]);
+		for (slot = 0; slot < KYBER_NR_GROUPS; slot++)
+			blk_rq_stat_sum(&stat[i], kyber_stat(cb, slot, i));
+	}
 
-	read_status = kyber_lat_status(cb, KYBER_READ, kqd->read_lat_nsec);
-	write_status = kyber_lat_status(cb, KYBER_SYNC_WRITE, kqd->write_lat_nsec);
+	read_status = kyber_lat_status(&stat[KYBER_READ], kqd->read_lat_nsec);
+	write_status = kyber_lat_status(&stat[KYBER_SYNC_WRITE],
+					kqd->write_lat_nsec);
 
 	kyber_adjust_rw_depth(kqd, KYBER_READ, read_status, write_status);
 	kyber_adjust_rw_depth(kqd, KYBER_SYNC_WRITE, write_status, read_status);
 	kyber_adjust_other_depth(kqd, read_status, write_status,
-				 cb->stat[KYBER_OTHER].nr_samples != 0);
+				 stat[KYBER_OTHER].nr_samples != 0);
+
+	groups_bad = kyber_adjust_group_depths(kqd, cb);
 
 	/*
 	 * Continue monitoring latencies if we aren't hitting the targets or
-	 * we're still throttling other requests.
+	 * we're still throttling other requests or groups.
 	 */
 	if (!blk_stat_is_active(kqd->cb) &&
-	    ((IS_BAD(read_status) || IS_BAD(write_status) ||
+	    ((IS_BAD(read_status) || IS_BAD(write_status) || groups_bad ||
 	      kqd->domain_tokens[KYBER_OTHER].sb.depth < kyber_depth[KYBER_OTHER])))
 		blk_stat_activate_msecs(kqd->cb, 100);
 }
@@ -280,6 +507,37 @@ static unsigned int kyber_sched_tags_shift(struct kyber_queue_data *kqd)
 	return kqd->q->queue_hw_ctx[0]->sched_tags->bitmap_tags.sb.shift;
 }
 
+static void kyber_group_init(struct kyber_queue_data *kqd,
+			     struct kyber_group *kg)
+{
+	int i;
+
+	kg->kqd = kqd;
+	kg->slot = 0;
+	for (i = 0; i < KYBER_NUM_DOMAINS; i++) {
+		kg->depth[i] = kyber_depth[i];
+		atomic_set(&kg->inflight[i], 0);
+	}
+}
+
+static struct kyber_group *rq_get_group(struct kyber_queue_data *kqd,
+					const struct request *rq)
+{
+#ifdef CONFIG_KYBER_GROUP_IOSCHED
+	if ((rq->rq_flags & RQF_ELVPRIV) && rq->elv.priv[1])
+		return rq->elv.priv[1];
+#endif
+	return &kqd->default_group;
+}
+
+static int kyber_bucket_fn(const struct request *rq)
+{
+	struct kyber_queue_data *kqd = rq->q->elevator->elevator_data;
+	int slot = READ_ONCE(rq_get_group(kqd, rq)->slot);
+
+	return slot * KYBER_NUM_DOMAINS + rq_sched_domain(rq);
+}
+
 static struct kyber_queue_data *kyber_queue_data_alloc(struct request_queue *q)
 {
 	struct kyber_queue_data *kqd;
@@ -288,13 +546,15 @@ static struct kyber_queue_data *kyber_queue_data_alloc(struct request_queue *q)
 	int ret = -ENOMEM;
 	int i;
 
-	kqd = kmalloc_node(sizeof(*kqd), GFP_KERNEL, q->node);
+	kqd = kzalloc_node(sizeof(*kqd), GFP_KERNEL, q->node);
 	if (!kqd)
 		goto err;
 	kqd->q = q;
+	kyber_group_init(kqd, &kqd->default_group);
 
-	kqd->cb = blk_stat_alloc_callback(kyber_stat_timer_fn, rq_sched_domain,
-					  KYBER_NUM_DOMAINS, kqd);
+	kqd->cb = blk_stat_alloc_callback(kyber_stat_timer_fn, kyber_bucket_fn,
+					  KYBER_NUM_DOMAINS * KYBER_NR_GROUPS,
+					  kqd);
 	if (!kqd->cb)
 		goto err_kqd;
 
@@ -335,10 +595,23 @@ static struct kyber_queue_data *kyber_queue_data_alloc(struct request_queue *q)
 	return ERR_PTR(ret);
 }
 
+static void kyber_queue_data_free(struct kyber_queue_data *kqd)
+{
+	int i;
+
+	for (i = 0; i < KYBER_NUM_DOMAINS; i++)
+		sbitmap_queue_free(&kqd->domain_tokens[i]);
+	blk_stat_free_callback(kqd->cb);
+	kfree(kqd);
+}
+
 static int kyber_init_sched(struct request_queue *q, struct elevator_type *e)
 {
 	struct kyber_queue_data *kqd;
 	struct elevator_queue *eq;
+#ifdef CONFIG_KYBER_GROUP_IOSCHED
+	int ret;
+#endif
 
 	eq = elevator_alloc(q, e);
 	if (!eq)
@@ -353,6 +626,15 @@ static int kyber_init_sched(struct request_queue *q, struct elevator_type *e)
 	eq->elevator_data = kqd;
 	q->elevator = eq;
 
+#ifdef CONFIG_KYBER_GROUP_IOSCHED
+	ret = blkcg_activate_policy(q, &blkcg_policy_kyber);
+	if (ret) {
+		kyber_queue_data_free(kqd);
+		kobject_put(&eq->kobj);
+		return ret;
+	}
+#endif
+
 	blk_stat_add_callback(q, kqd->cb);
 
 	return 0;
@@ -362,14 +644,14 @@ static void kyber_exit_sched(struct elevator_queue *e)
 {
 	struct kyber_queue_data *kqd = e->elevator_data;
 	struct request_queue *q = kqd->q;
-	int i;
 
 	blk_stat_remove_callback(q, kqd->cb);
 
-	for (i = 0; i < KYBER_NUM_DOMAINS; i++)
-		sbitmap_queue_free(&kqd->domain_tokens[i]);
-	blk_stat_free_callback(kqd->cb);
-	kfree(kqd);
+#ifdef CONFIG_KYBER_GROUP_IOSCHED
+	blkcg_deactivate_policy(q, &blkcg_policy_kyber);
+#endif
+
+	kyber_queue_data_free(kqd);
 }
 
 static int kyber_init_hctx(struct blk_mq_hw_ctx *hctx, unsigned int hctx_idx)
@@ -412,6 +694,22 @@ static void rq_set_domain_token(struct request *rq, int token)
 	rq->elv.priv[0] = (void *)(long)token;
 }
 
+static void kyber_group_done(struct kyber_queue_data *kqd,
+			     struct kyber_group *kg, unsigned int sched_domain)
+{
+	unsigned int depth = READ_ONCE(kg->depth[sched_domain]);
+	int inflight;
+
+	inflight = atomic_dec_return(&kg->inflight[sched_domain]);
+
+	/*
+	 * If the group was throttled and at its depth, requests held back
+	 * behind it won't be looked at again until the queues are run.
+	 */
+	if (depth < kyber_depth[sched_domain] && inflight + 1 >= depth)
+		blk_mq_run_hw_queues(kqd->q, true);
+}
+
 static void rq_clear_domain_token(struct kyber_queue_data *kqd,
 				  struct request *rq)
 {
@@ -423,6 +721,7 @@ static void rq_clear_domain_token(struct kyber_queue_data *kqd,
 		sched_domain = rq_sched_domain(rq);
 		sbitmap_queue_clear(&kqd->domain_tokens[sched_domain], nr,
 				    rq->mq_ctx->cpu);
+		kyber_group_done(kqd, rq_get_group(kqd, rq), sched_domain);
 	}
 }
 
@@ -439,9 +738,36 @@ static void kyber_limit_depth(unsigned int op, struct blk_mq_alloc_data *data)
 	}
 }
 
+#ifdef CONFIG_KYBER_GROUP_IOSCHED
+/*
+ * Look up the group of the cgroup issuing @bio. The request holds a reference
+ * on the blkg until it is finished.
+ */
+static struct kyber_group *kyber_get_group(struct request_queue *q,
+					   struct bio *bio)
+{
+	struct kyber_group *kg = NULL;
+	struct blkcg_gq *blkg;
+
+	rcu_read_lock();
+	blkg = blkg_lookup(bio_blkcg(bio), q);
+	if (blkg && blkg_tryget(blkg)) {
+		kg = blkg_to_kg(blkg);
+		if (!kg)
+			blkg_put(blkg);
+	}
+	rcu_read_unlock();
+
+	return kg;
+}
+#endif
+
 static void kyber_prepare_request(struct request *rq, struct bio *bio)
 {
 	rq_set_domain_token(rq, -1);
+#ifdef CONFIG_KYBER_GROUP_IOSCHED
+	rq->elv.priv[1] = kyber_get_group(rq->q, bio);
+#endif
 }
 
 static void kyber_finish_request(struct request *rq)
@@ -449,6 +775,14 @@ static void kyber_finish_request(struct request *rq)
 	struct kyber_queue_data *kqd = rq->q->elevator->elevator_data;
 
 	rq_clear_domain_token(kqd, rq);
+#ifdef CONFIG_KYBER_GROUP_IOSCHED
+	if (rq->elv.priv[1]) {
+		struct kyber_group *kg = rq->elv.priv[1];
+
+		rq->elv.priv[1] = NULL;
+		blkg_put(pd_to_blkg(&kg->pd));
+	}
+#endif
 }
 
 static void kyber_completed_request(struct request *rq)
@@ -465,10 +799,9 @@ static void kyber_completed_request(struct request *rq)
 	sched_domain = rq_sched_domain(rq);
 	switch (sched_domain) {
 	case KYBER_READ:
-		target = kqd->read_lat_nsec;
-		break;
 	case KYBER_SYNC_WRITE:
-		target = kqd->write_lat_nsec;
+		target = kyber_group_lat_nsec(kqd, rq_get_group(kqd, rq),
+					      sched_domain);
 		break;
 	default:
 		return;
@@ -548,18 +881,52 @@ static int kyber_get_domain_token(struct kyber_queue_data *kqd,
 	return nr;
 }
 
+#ifdef CONFIG_KYBER_GROUP_IOSCHED
+static bool kyber_group_may_dispatch(struct kyber_group *kg,
+				     unsigned int sched_domain)
+{
+	return atomic_read(&kg->inflight[sched_domain]) <
+		READ_ONCE(kg->depth[sched_domain]);
+}
+
+#endif
+
+/*
+ * Pick the first request on @rqs whose group may dispatch. If no group is
+ * throttled, that is simply the first request.
+ */
+static struct request *kyber_first_request(struct kyber_queue_data *kqd,
+					   struct list_head *rqs,
+					   unsigned int sched_domain)
+{
+#ifdef CONFIG_KYBER_GROUP_IOSCHED
+	struct request *rq;
+
+	if (READ_ONCE(kqd->groups_throttled)) {
+		list_for_each_entry(rq, rqs, queuelist) {
+			if (kyber_group_may_dispatch(rq_get_group(kqd, rq),
+						     sched_domain))
+				return rq;
+		}
+		return NULL;
+	}
+#endif
+	return list_first_entry_or_null(rqs, struct request, queuelist);
+}
+
 static struct request *
 kyber_dispatch_cur_domain(struct kyber_queue_data *kqd,
 			  struct kyber_hctx_data *khd,
 			  struct blk_mq_hw_ctx *hctx,
 			  bool *flushed)
 {
+	unsigned int sched_domain = khd->cur_domain;
 	struct list_head *rqs;
 	struct request *rq;
 	int nr;
 
-	rqs = &khd->rqs[khd->cur_domain];
-	rq = list_first_entry_or_null(rqs, struct request, queuelist);
+	rqs = &khd->rqs[sched_domain];
+	rq = kyber_first_request(kqd, rqs, sched_domain);
 
 	/*
 	 * If there wasn't already a pending request and we haven't flushed the
@@ -568,7 +935,7 @@ kyber_dispatch_cur_domain(struct kyber_queue_data *kqd,
 	if (!rq && !*flushed) {
 		kyber_flush_busy_ctxs(khd, hctx);
 		*flushed = true;
-		rq = list_first_entry_or_null(rqs, struct request, queuelist);
+		rq = kyber_first_request(kqd, rqs, sched_domain);
 	}
 
 	if (rq) {
@@ -576,6 +943,7 @@ kyber_dispatch_cur_domain(struct kyber_queue_data *kqd,
 		if (nr >= 0) {
 			khd->batching++;
 			rq_set_domain_token(rq, nr);
+			atomic_inc(&rq_get_group(kqd, rq)->inflight[sched_domain]);
 			list_del_init(&rq->queuelist);
 			return rq;
 		}
@@ -805,6 +1173,137 @@ static const struct blk_mq_debugfs_attr kyber_hctx_debugfs_attrs[] = {
 #undef KYBER_HCTX_DOMAIN_ATTRS
 #endif
 
+#ifdef CONFIG_KYBER_GROUP_IOSCHED
+static struct blkcg_policy_data *kyber_cpd_alloc(gfp_t gfp)
+{
+	struct kyber_cgroup *kcg;
+
+	kcg = kzalloc(sizeof(*kcg), gfp);
+	if (!kcg)
+		return NULL;
+	return &kcg->cpd;
+}
+
+static void kyber_cpd_free(struct blkcg_policy_data *cpd)
+{
+	kfree(cpd_to_kcg(cpd));
+}
+
+static struct blkg_policy_data *kyber_pd_alloc(gfp_t gfp, int node)
+{
+	struct kyber_group *kg;
+
+	kg = kzalloc_node(sizeof(*kg), gfp, node);
+	if (!kg)
+		return NULL;
+	return &kg->pd;
+}
+
+/*
+ * Called with the queue lock held. Give the group a statistics slot of its
+ * own if there is one left; otherwise it is accounted with the default group
+ * and never throttled.
+ */
+static void kyber_pd_init(struct blkg_policy_data *pd)
+{
+	struct blkcg_gq *blkg = pd_to_blkg(pd);
+	struct kyber_queue_data *kqd = blkg->q->elevator->elevator_data;
+	struct kyber_group *kg = pd_to_kg(pd);
+	int slot;
+
+	kyber_group_init(kqd, kg);
+
+	if (!blkg->parent)
+		return;
+
+	for (slot = 1; slot < KYBER_NR_GROUPS; slot++) {
+		if (!kqd->groups[slot]) {
+			kqd->groups[slot] = kg;
+			WRITE_ONCE(kg->slot, slot);
+			break;
+		}
+	}
+}
+
+/*
+ * Called with the queue lock held. Requests of the group may still be in
+ * flight, so just stop accounting and throttling it separately.
+ */
+static void kyber_pd_offline(struct blkg_policy_data *pd)
+{
+	struct kyber_group *kg = pd_to_kg(pd);
+	int i;
+
+	if (kg->slot) {
+		kg->kqd->groups[kg->slot] = NULL;
+		WRITE_ONCE(kg->slot, 0);
+	}
+	for (i = 0; i < KYBER_NUM_DOMAINS; i++)
+		WRITE_ONCE(kg->depth[i], kyber_depth[i]);
+}
+
+static void kyber_pd_free(struct blkg_policy_data *pd)
+{
+	kfree(pd_to_kg(pd));
+}
+
+static u64 kyber_cgroup_lat_read(struct cgroup_subsys_state *css,
+				 struct cftype *cft)
+{
+	struct kyber_cgroup *kcg = blkcg_to_kcg(css_to_blkcg(css));
+
+	if (cft->private == KYBER_READ)
+		return kcg->read_lat_nsec;
+	return kcg->write_lat_nsec;
+}
+
+static int kyber_cgroup_lat_write(struct cgroup_subsys_state *css,
+				  struct cftype *cft, u64 val)
+{
+	struct kyber_cgroup *kcg = blkcg_to_kcg(css_to_blkcg(css));
+
+	if (cft->private == KYBER_READ)
+		WRITE_ONCE(kcg->read_lat_nsec, val);
+	else
+		WRITE_ONCE(kcg->write_lat_nsec, val);
+	return 0;
+}
+
+#define KYBER_CGROUP_LAT_FILE(op, domain)				\
+	{								\
+		.name = "kyber." #op "_lat_nsec",			\
+		.flags = CFTYPE_NOT_ON_ROOT,				\
+		.private = domain,					\
+		.read_u64 = kyber_cgroup_lat_read,			\
+		.write_u64 = kyber_cgroup_lat_write,			\
+	}
+static struct cftype kyber_blkg_files[] = {
+	KYBER_CGROUP_LAT_FILE(read, KYBER_READ),
+	KYBER_CGROUP_LAT_FILE(write, KYBER_SYNC_WRITE),
+	{} /* terminate */
+};
+
+static struct cftype kyber_blkcg_legacy_files[] = {
+	KYBER_CGROUP_LAT_FILE(read, KYBER_READ),
+	KYBER_CGROUP_LAT_FILE(write, KYBER_SYNC_WRITE),
+	{} /* terminate */
+};
+#undef KYBER_CGROUP_LAT_FILE
+
+static struct blkcg_policy blkcg_policy_kyber = {
+	.dfl_cftypes		= kyber_blkg_files,
+	.legacy_cftypes		= kyber_blkcg_legacy_files,
+
+	.cpd_alloc_fn		= kyber_cpd_alloc,
+	.cpd_free_fn		= kyber_cpd_free,
+
+	.pd_alloc_fn		= kyber_pd_alloc,
+	.pd_init_fn		= kyber_pd_init,
+	.pd_offline_fn		= kyber_pd_offline,
+	.pd_free_fn		= kyber_pd_free,
+};
+#endif
+
 static struct elevator_type kyber_sched = {
 	.ops.mq = {
 		.init_sched = kyber_init_sched,
@@ -830,12 +1329,33 @@ static struct elevator_type kyber_sched = {
 
 static int __init kyber_init(void)
 {
-	return elv_register(&kyber_sched);
+	int ret;
+
+#ifdef CONFIG_KYBER_GROUP_IOSCHED
+	ret = blkcg_policy_register(&blkcg_policy_kyber);
+	if (ret)
+		return ret;
+#endif
+
+	ret = elv_register(&kyber_sched);
+	if (ret)
+		goto err_pol_unreg;
+
+	return 0;
+
+err_pol_unreg:
+#ifdef CONFIG_KYBER_GROUP_IOSCHED
+	blkcg_policy_unregister(&blkcg_policy_kyber);
+#endif
+	return ret;
 }
 
 static void __exit kyber_exit(void)
 {
 	elv_unregister(&kyber_sched);
+#ifdef CONFIG_KYBER_GROUP_IOSCHED
+	blkcg_policy_unregister(&blkcg_policy_kyber);
+#endif
 }
 
 module_init(kyber_init);
@@ -12,6 +12,7 @@
 #include <linux/node.h>
 #include <linux/hugetlb.h>
 #include <linux/compaction.h>
+#include <linux/khugepaged.h>
 #include <linux/cpumask.h>
 #include <linux/topology.h>
 #include <linux/nodemask.h>
@@ -228,6 +229,15 @@ static ssize_t node_read_distance(struct device *dev,
 }
 static DEVICE_ATTR(distance, S_IRUGO, node_read_distance, NULL);
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+static ssize_t node_read_khugepaged(struct device *dev,
+				    struct device_attribute *attr, char *buf)
+{
+	return khugepaged_report_node(dev->id, buf);
+}
+static DEVICE_ATTR(khugepaged, S_IRUGO, node_read_khugepaged, NULL);
+#endif
+
 static struct attribute *node_dev_attrs[] = {
 	&dev_attr_cpumap.attr,
 	&dev_attr_cpulist.attr,
@@ -235,6 +245,9 @@ static struct attribute *node_dev_attrs[] = {
 	&dev_attr_numastat.attr,
 	&dev_attr_distance.attr,
 	&dev_attr_vmstat.attr,
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	&dev_attr_khugepaged.attr,
+#endif
 	NULL
 };
 ATTRIBUTE_GROUPS(node_dev);
@@ -76,6 +76,7 @@
 #include <linux/miscdevice.h>
 #include <linux/falloc.h>
 #include <linux/uio.h>
+#include <linux/list_sort.h>
 #include "loop.h"
 
 #include <linux/uaccess.h>
@@ -85,6 +86,7 @@ static DEFINE_MUTEX(loop_index_mutex);
 
 static int max_part;
 static int part_shift;
+static unsigned int nr_hw_queues = 1;
 
 static int transfer_xor(struct loop_device *lo, int cmd,
 			struct page *raw_page, unsigned raw_off,
@@ -414,7 +416,7 @@ static int lo_read_transfer(struct loop_device *lo, struct request *rq,
 	return ret;
 }
 
-static int lo_discard(struct loop_device *lo, struct request *rq, loff_t pos)
+static int lo_discard(struct loop_device *lo, loff_t pos, loff_t len)
 {
 	/*
 	 * We use punch hole to reclaim the free space used by the
@@ -431,7 +433,7 @@ static int lo_discard(struct loop_device *lo, struct request *rq, loff_t pos)
 		goto out;
 	}
 
-	ret = file->f_op->fallocate(file, mode, pos, blk_rq_bytes(rq));
+	ret = file->f_op->fallocate(file, mode, pos, len);
 	if (unlikely(ret && ret != -EINVAL && ret != -EOPNOTSUPP))
 		ret = -EIO;
  out:
@@ -567,7 +569,7 @@ static int do_req_filebacked(struct loop_device *lo, struct request *rq)
 		return lo_req_flush(lo, rq);
 	case REQ_OP_DISCARD:
 	case REQ_OP_WRITE_ZEROES:
-		return lo_discard(lo, rq, pos);
+		return lo_discard(lo, pos, blk_rq_bytes(rq));
 	case REQ_OP_WRITE:
 		if (lo->transfer)
 			return lo_write_transfer(lo, rq, pos);
@@ -826,8 +828,17 @@ static void loop_config_discard(struct loop_device *lo)
 
 static void loop_unprepare_queue(struct loop_device *lo)
 {
-	kthread_flush_worker(&lo->worker);
-	kthread_stop(lo->worker_task);
+	unsigned int i;
+
+	for (i = 0; i < lo->tag_set.nr_hw_queues; i++) {
+		struct loop_hw_queue *lq = &lo->hw_queues[i];
+
+		if (!lq->worker_task)
+			continue;
+		kthread_flush_worker(&lq->worker);
+		kthread_stop(lq->worker_task);
+		lq->worker_task = NULL;
+	}
 }
 
 static int loop_kthread_worker_fn(void *worker_ptr)
@@ -838,12 +849,26 @@ static int loop_kthread_worker_fn(void *worker_ptr)
 
 static int loop_prepare_queue(struct loop_device *lo)
 {
-	kthread_init_worker(&lo->worker);
-	lo->worker_task = kthread_run(loop_kthread_worker_fn,
-			&lo->worker, "loop%d", lo->lo_number);
-	if (IS_ERR(lo->worker_task))
-		return -ENOMEM;
-	set_user_nice(lo->worker_task, MIN_NICE);
+	unsigned int i;
+
+	for (i = 0; i < lo->tag_set.nr_hw_queues; i++) {
+		struct loop_hw_queue *lq = &lo->hw_queues[i];
+		struct task_struct *task;
+
+		kthread_init_worker(&lq->worker);
+		if (lo->tag_set.nr_hw_queues == 1)
+			task = kthread_run(loop_kthread_worker_fn, &lq->worker,
+					   "loop%d", lo->lo_number);
+		else
+			task = kthread_run(loop_kthread_worker_fn, &lq->worker,
+					   "loop%d-%u", lo->lo_number, i);
+		if (IS_ERR(task)) {
+			loop_unprepare_queue(lo);
+			return -ENOMEM;
+		}
+		lq->worker_task = task;
+		set_user_nice(task, MIN_NICE);
+	}
 	return 0;
 }
 
@@ -1623,6 +1648,8 @@ module_param(max_loop, int, S_IRUGO);
 MODULE_PARM_DESC(max_loop, "Maximum number of loop devices");
 module_param(max_part, int, S_IRUGO);
 MODULE_PARM_DESC(max_part, "Maximum number of partitions per loop device");
+module_param(nr_hw_queues, uint, S_IRUGO);
+MODULE_PARM_DESC(nr_hw_queues, "Number of hardware queues, each with its own worker, per loop device. Default: 1");
 MODULE_LICENSE("GPL");
 MODULE_ALIAS_BLOCKDEV_MAJOR(LOOP_MAJOR);
 
@@ -1669,6 +1696,7 @@ static blk_status_t loop_queue_rq(struct blk_mq_hw_ctx *hctx,
 {
 	struct loop_cmd *cmd = blk_mq_rq_to_pdu(bd->rq);
 	struct loop_device *lo = cmd->rq->q->queuedata;
+	struct loop_hw_queue *lq = hctx->driver_data;
 
 	blk_mq_start_request(bd->rq);
 
@@ -1676,9 +1704,15 @@ static blk_status_t loop_queue_rq(struct blk_mq_hw_ctx *hctx,
 		return BLK_STS_IOERR;
 
 	switch (req_op(cmd->rq)) {
-	case REQ_OP_FLUSH:
 	case REQ_OP_DISCARD:
 	case REQ_OP_WRITE_ZEROES:
+		cmd->use_aio = false;
+		spin_lock(&lq->fallocate_lock);
+		list_add_tail(&cmd->list, &lq->fallocate_list);
+		spin_unlock(&lq->fallocate_lock);
+		kthread_queue_work(&lq->worker, &lq->fallocate_work);
+		return BLK_STS_OK;
+	case REQ_OP_FLUSH:
 		cmd->use_aio = false;
 		break;
 	default:
@@ -1686,11 +1720,76 @@ static blk_status_t loop_queue_rq(struct blk_mq_hw_ctx *hctx,
 		break;
 	}
 
-	kthread_queue_work(&lo->worker, &cmd->work);
+	kthread_queue_work(&lq->worker, &cmd->work);
 
 	return BLK_STS_OK;
 }
 
+static loff_t loop_cmd_pos(struct loop_device *lo, struct loop_cmd *cmd)
+{
+	return ((loff_t) blk_rq_pos(cmd->rq) << 9) + lo->lo_offset;
+}
+
+static int loop_cmd_cmp(void *priv, struct list_head *a, struct list_head *b)
+{
+	struct loop_cmd *ca = list_entry(a, struct loop_cmd, list);
+	struct loop_cmd *cb = list_entry(b, struct loop_cmd, list);
+
+	if (blk_rq_pos(ca->rq) != blk_rq_pos(cb->rq))
+		return blk_rq_pos(ca->rq) < blk_rq_pos(cb->rq) ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Handle all discard and write-zeroes commands queued since the last run.
+ * Both punch a hole in the backing file, so commands whose ranges touch or
+ * overlap are passed to it as a single fallocate() call.
+ */
+static void loop_fallocate_work(struct kthread_work *work)
+{
+	struct loop_hw_queue *lq =
+		container_of(work, struct loop_hw_queue, fallocate_work);
+	struct loop_device *lo = lq->lo;
+	struct loop_cmd *cmd, *next;
+	LIST_HEAD(list);
+	LIST_HEAD(group);
+
+	spin_lock(&lq->fallocate_lock);
+	list_splice_init(&lq->fallocate_list, &list);
+	spin_unlock(&lq->fallocate_lock);
+
+	list_sort(NULL, &list, loop_cmd_cmp);
+
+	while (!list_empty(&list)) {
+		loff_t start, end;
+		int ret = 0;
+
+		cmd = list_first_entry(&list, struct loop_cmd, list);
+		start = loop_cmd_pos(lo, cmd);
+		end = start;
+
+		list_for_each_entry_safe(cmd, next, &list, list) {
+			loff_t pos = loop_cmd_pos(lo, cmd);
+
+			if (!list_empty(&group) && pos > end)
+				break;
+			end = max_t(loff_t, end, pos + blk_rq_bytes(cmd->rq));
+			list_move_tail(&cmd->list, &group);
+		}
+
+		if (lo->lo_flags & LO_FLAGS_READ_ONLY)
+			ret = -EIO;
+		else if (end > start)
+			ret = lo_discard(lo, start, end - start);
+
+		list_for_each_entry_safe(cmd, next, &group, list) {
+			list_del_init(&cmd->list);
+			cmd->ret = ret ? -EIO : 0;
+			blk_mq_complete_request(cmd->rq);
+		}
+	}
+}
+
 static void loop_handle_cmd(struct loop_cmd *cmd)
 {
 	const bool write = op_is_write(req_op(cmd->rq));
@@ -1726,6 +1825,22 @@ static int loop_init_request(struct blk_mq_tag_set *set, struct request *rq,
 
 	cmd->rq = rq;
 	kthread_init_work(&cmd->work, loop_queue_work);
+	INIT_LIST_HEAD(&cmd->list);
+
+	return 0;
+}
+
+static int loop_init_hctx(struct blk_mq_hw_ctx *hctx, void *data,
+		unsigned int hctx_idx)
+{
+	struct loop_device *lo = data;
+	struct loop_hw_queue *lq = &lo->hw_queues[hctx_idx];
+
+	lq->lo = lo;
+	spin_lock_init(&lq->fallocate_lock);
+	INIT_LIST_HEAD(&lq->fallocate_list);
+	kthread_init_work(&lq->fallocate_work, loop_fallocate_work);
+	hctx->driver_data = lq;
 
 	return 0;
 }
@@ -1733,6 +1848,7 @@ static int loop_init_request(struct blk_mq_tag_set *set, struct request *rq,
 static const struct blk_mq_ops loop_mq_ops = {
 	.queue_rq       = loop_queue_rq,
 	.init_request	= loop_init_request,
+	.init_hctx	= loop_init_hctx,
 	.complete	= lo_complete_rq,
 };
 
@@ -1762,8 +1878,13 @@ static int loop_add(struct loop_device **l, int i)
 	i = err;
 
 	err = -ENOMEM;
+	lo->hw_queues = kcalloc(nr_hw_queues, sizeof(*lo->hw_queues),
+				GFP_KERNEL);
+	if (!lo->hw_queues)
+		goto out_free_idr;
+
 	lo->tag_set.ops = &loop_mq_ops;
-	lo->tag_set.nr_hw_queues = 1;
+	lo->tag_set.nr_hw_queues = nr_hw_queues;
 	lo->tag_set.queue_depth = 128;
 	lo->tag_set.numa_node = NUMA_NO_NODE;
 	lo->tag_set.cmd_size = sizeof(struct loop_cmd);
@@ -1772,7 +1893,7 @@ static int loop_add(struct loop_device **l, int i)
 
 	err = blk_mq_alloc_tag_set(&lo->tag_set);
 	if (err)
-		goto out_free_idr;
+		goto out_free_hw_queues;
 
 	lo->lo_queue = blk_mq_init_queue(&lo->tag_set);
 	if (IS_ERR_OR_NULL(lo->lo_queue)) {
@@ -1835,6 +1956,8 @@ static int loop_add(struct loop_device **l, int i)
 	blk_cleanup_queue(lo->lo_queue);
 out_cleanup_tags:
 	blk_mq_free_tag_set(&lo->tag_set);
+out_free_hw_queues:
+	kfree(lo->hw_queues);
 out_free_idr:
 	idr_remove(&loop_index_idr, i);
 out_free_dev:
@@ -1849,6 +1972,7 @@ static void loop_remove(struct loop_device *lo)
 	del_gendisk(lo->lo_disk);
 	blk_mq_free_tag_set(&lo->tag_set);
 	put_disk(lo->lo_disk);
+	kfree(lo->hw_queues);
 	kfree(lo);
 }
 
@@ -2006,6 +2130,11 @@ static int __init loop_init(void)
 		goto err_out;
 	}
 
+	if (!nr_hw_queues || nr_hw_queues > nr_cpu_ids) {
+		err = -EINVAL;
+		goto err_out;
+	}
+
 	/*
 	 * If max_loop is specified, create that many devices upfront.
 	 * This also becomes a hard limit. If max_loop is not specified,
@@ -26,6 +26,18 @@ enum {
 
 struct loop_func_table;
 
+/* Per hw queue worker */
+struct loop_hw_queue {
+	struct kthread_worker	worker;
+	struct task_struct	*worker_task;
+
+	/* discard/write-zeroes commands, coalesced into fallocate calls */
+	spinlock_t		fallocate_lock;
+	struct list_head	fallocate_list;
+	struct kthread_work	fallocate_work;
+	struct loop_device	*lo;
+};
+
 struct loop_device {
 	int		lo_number;
 	atomic_t	lo_refcnt;
@@ -55,8 +67,7 @@ struct loop_device {
 	spinlock_t		lo_lock;
 	int			lo_state;
 	struct mutex		lo_ctl_mutex;
-	struct kthread_worker	worker;
-	struct task_struct	*worker_task;
+	struct loop_hw_queue	*hw_queues;
 	bool			use_dio;
 
 	struct request_queue	*lo_queue;
@@ -66,6 +77,7 @@ struct loop_device {
 
 struct loop_cmd {
 	struct kthread_work work;
+	struct list_head list; /* on loop_hw_queue->fallocate_list */
 	struct request *rq;
 	bool use_aio; /* use AIO interface to handle I/O */
 	atomic_t ref; /* only for aio */
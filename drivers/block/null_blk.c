@@ -51,6 +51,7 @@ struct nullb_queue {
 	struct nullb_device *dev;
 
 	struct nullb_cmd *cmds;
+	struct llist_head comp_list; /* completions held for complete_batch */
 };
 
 /*
@@ -110,6 +111,7 @@ struct nullb_device {
 	bool use_lightnvm; /* register as a LightNVM device */
 	bool blocking; /* blocking blk-mq device */
 	bool use_per_node_hctx; /* use per-node allocation for hardware context */
+	bool complete_batch; /* complete a dispatch batch at once */
 	bool power; /* power on/off the device */
 	bool memory_backed; /* if data is stored in memory */
 	bool discard; /* if support discard */
@@ -244,6 +246,10 @@ static bool g_use_per_node_hctx;
 module_param_named(use_per_node_hctx, g_use_per_node_hctx, bool, S_IRUGO);
 MODULE_PARM_DESC(use_per_node_hctx, "Use per-node allocation for hardware context queues. Default: false");
 
+static bool g_complete_batch;
+module_param_named(complete_batch, g_complete_batch, bool, S_IRUGO);
+MODULE_PARM_DESC(complete_batch, "Complete the requests of a dispatch batch together (queue_mode=2, irqmode=0). Default: false");
+
 static struct nullb_device *null_alloc_dev(void);
 static void null_free_dev(struct nullb_device *dev);
 static void null_del_dev(struct nullb *nullb);
@@ -344,6 +350,7 @@ NULLB_DEVICE_ATTR(index, uint);
 NULLB_DEVICE_ATTR(use_lightnvm, bool);
 NULLB_DEVICE_ATTR(blocking, bool);
 NULLB_DEVICE_ATTR(use_per_node_hctx, bool);
+NULLB_DEVICE_ATTR(complete_batch, bool);
 NULLB_DEVICE_ATTR(memory_backed, bool);
 NULLB_DEVICE_ATTR(discard, bool);
 NULLB_DEVICE_ATTR(mbps, uint);
@@ -454,6 +461,7 @@ static struct configfs_attribute *nullb_device_attrs[] = {
 	&nullb_device_attr_use_lightnvm,
 	&nullb_device_attr_blocking,
 	&nullb_device_attr_use_per_node_hctx,
+	&nullb_device_attr_complete_batch,
 	&nullb_device_attr_power,
 	&nullb_device_attr_memory_backed,
 	&nullb_device_attr_discard,
@@ -573,6 +581,7 @@ static struct nullb_device *null_alloc_dev(void)
 	dev->use_lightnvm = g_use_lightnvm;
 	dev->blocking = g_blocking;
 	dev->use_per_node_hctx = g_use_per_node_hctx;
+	dev->complete_batch = g_complete_batch;
 	return dev;
 }
 
@@ -700,6 +709,28 @@ static void null_cmd_end_timer(struct nullb_cmd *cmd)
 	hrtimer_start(&cmd->timer, kt, HRTIMER_MODE_REL);
 }
 
+/*
+ * Complete the commands held back by complete_batch, as an interrupt handler
+ * reaping several completions from a hardware queue would.
+ */
+static void null_complete_batch(struct nullb_queue *nq)
+{
+	struct llist_node *entry = llist_del_all(&nq->comp_list);
+	struct nullb_cmd *cmd, *next;
+	LIST_HEAD(list);
+
+	llist_for_each_entry_safe(cmd, next, entry, ll_list) {
+		if (cmd->error) {
+			end_cmd(cmd);
+			continue;
+		}
+		/* llist is LIFO, so this restores submission order */
+		list_add(&cmd->rq->queuelist, &list);
+	}
+
+	blk_mq_complete_request_batch(&list);
+}
+
 static void null_softirq_done_fn(struct request *rq)
 {
 	struct nullb *nullb = rq->q->queuedata;
@@ -1286,7 +1317,10 @@ static blk_status_t null_handle_cmd(struct nullb_cmd *cmd)
 		}
 		break;
 	case NULL_IRQ_NONE:
-		end_cmd(cmd);
+		if (dev->queue_mode == NULL_Q_MQ && dev->complete_batch)
+			llist_add(&cmd->ll_list, &cmd->nq->comp_list);
+		else
+			end_cmd(cmd);
 		break;
 	case NULL_IRQ_TIMER:
 		null_cmd_end_timer(cmd);
@@ -1380,6 +1414,7 @@ static blk_status_t null_queue_rq(struct blk_mq_hw_ctx *hctx,
 {
 	struct nullb_cmd *cmd = blk_mq_rq_to_pdu(bd->rq);
 	struct nullb_queue *nq = hctx->driver_data;
+	blk_status_t ret;
 
 	might_sleep_if(hctx->flags & BLK_MQ_F_BLOCKING);
 
@@ -1392,7 +1427,15 @@ static blk_status_t null_queue_rq(struct blk_mq_hw_ctx *hctx,
 
 	blk_mq_start_request(bd->rq);
 
-	return null_handle_cmd(cmd);
+	ret = null_handle_cmd(cmd);
+
+	/*
+	 * Held back completions must not outlive the dispatch batch, which
+	 * ends either with the last request or with one we can't take.
+	 */
+	if (nq->dev->complete_batch && (bd->last || ret != BLK_STS_OK))
+		null_complete_batch(nq);
+	return ret;
 }
 
 static const struct blk_mq_ops null_mq_ops = {
@@ -1643,6 +1686,7 @@ static void null_init_queue(struct nullb *nullb, struct nullb_queue *nq)
 	BUG_ON(!nq);
 
 	init_waitqueue_head(&nq->wait);
+	init_llist_head(&nq->comp_list);
 	nq->queue_depth = nullb->queue_depth;
 	nq->dev = nullb->dev;
 }
@@ -41,6 +41,8 @@ static DEFINE_MUTEX(zram_index_mutex);
 
 static int zram_major;
 static const char *default_compressor = "lzo";
+/* Compression workers for batched writes */
+static struct workqueue_struct *zram_wq;
 
 /* Module params (documentation at end) */
 static unsigned int num_devices = 1;
@@ -1148,14 +1150,8 @@ static void zram_bio_discard(struct zram *zram, u32 index,
 static int zram_bvec_rw(struct zram *zram, struct bio_vec *bvec, u32 index,
 			int offset, bool is_write, struct bio *bio)
 {
-	unsigned long start_time = jiffies;
-	int rw_acct = is_write ? REQ_OP_WRITE : REQ_OP_READ;
-	struct request_queue *q = zram->disk->queue;
 	int ret;
 
-	generic_start_io_acct(q, rw_acct, bvec->bv_len >> SECTOR_SHIFT,
-			&zram->disk->part0);
-
 	if (!is_write) {
 		atomic64_inc(&zram->stats.num_reads);
 		ret = zram_bvec_read(zram, bvec, index, offset, bio);
@@ -1165,8 +1161,6 @@ static int zram_bvec_rw(struct zram *zram, struct bio_vec *bvec, u32 index,
 		ret = zram_bvec_write(zram, bvec, index, offset, bio);
 	}
 
-	generic_end_io_acct(q, rw_acct, &zram->disk->part0, start_time);
-
 	if (unlikely(ret < 0)) {
 		if (!is_write)
 			atomic64_inc(&zram->stats.failed_reads);
@@ -1177,7 +1171,7 @@ static int zram_bvec_rw(struct zram *zram, struct bio_vec *bvec, u32 index,
 	return ret;
 }
 
-static void __zram_make_request(struct zram *zram, struct bio *bio)
+static int __zram_bio_rw(struct zram *zram, struct bio *bio)
 {
 	int offset;
 	u32 index;
@@ -1192,8 +1186,7 @@ static void __zram_make_request(struct zram *zram, struct bio *bio)
 	case REQ_OP_DISCARD:
 	case REQ_OP_WRITE_ZEROES:
 		zram_bio_discard(zram, index, offset, bio);
-		bio_endio(bio);
-		return;
+		return 0;
 	default:
 		break;
 	}
@@ -1207,7 +1200,7 @@ static void __zram_make_request(struct zram *zram, struct bio *bio)
 							unwritten);
 			if (zram_bvec_rw(zram, &bv, index, offset,
 					op_is_write(bio_op(bio)), bio) < 0)
-				goto out;
+				return -EIO;
 
 			bv.bv_offset += bv.bv_len;
 			unwritten -= bv.bv_len;
@@ -1216,34 +1209,140 @@ static void __zram_make_request(struct zram *zram, struct bio *bio)
 		} while (unwritten);
 	}
 
-	bio_endio(bio);
-	return;
+	return 0;
+}
+
+static blk_status_t zram_rq_rw(struct zram *zram, struct request *rq)
+{
+	struct bio *bio;
+
+	if (!valid_io_request(zram, blk_rq_pos(rq), blk_rq_bytes(rq))) {
+		atomic64_inc(&zram->stats.invalid_io);
+		return BLK_STS_IOERR;
+	}
+
+	__rq_for_each_bio(bio, rq) {
+		if (__zram_bio_rw(zram, bio))
+			return BLK_STS_IOERR;
+	}
 
-out:
-	bio_io_error(bio);
+	return BLK_STS_OK;
 }
 
 /*
- * Handler function for all zram I/O requests.
+ * Compress and store a batch of write requests. Runs on the cpu the batch
+ * was queued to, using that cpu's compression stream.
  */
-static blk_qc_t zram_make_request(struct request_queue *queue, struct bio *bio)
+static void zram_batch_fn(struct work_struct *work)
 {
-	struct zram *zram = queue->queuedata;
+	struct zram_cmd *cmd = container_of(work, struct zram_cmd, work);
+	struct zram *zram;
+	struct request *rq;
+	LIST_HEAD(batch);
 
-	if (!valid_io_request(zram, bio->bi_iter.bi_sector,
-					bio->bi_iter.bi_size)) {
-		atomic64_inc(&zram->stats.invalid_io);
-		goto error;
+	/*
+	 * The leading request may complete and be reused before we are
+	 * done with the rest of the batch, take the list off it first.
+	 */
+	list_splice_init(&cmd->batch, &batch);
+
+	while (!list_empty(&batch)) {
+		cmd = list_first_entry(&batch, struct zram_cmd, node);
+		list_del_init(&cmd->node);
+
+		rq = blk_mq_rq_from_pdu(cmd);
+		zram = rq->q->queuedata;
+		blk_mq_end_request(rq, zram_rq_rw(zram, rq));
 	}
+}
 
-	__zram_make_request(zram, bio);
-	return BLK_QC_T_NONE;
+/*
+ * Send everything pending on @zq to the next cpu's worker, with @cmd
+ * leading the batch. Called with zq->lock held.
+ */
+static void zram_queue_batch(struct zram_queue *zq, struct zram_cmd *cmd)
+{
+	list_splice_init(&zq->pending, &cmd->batch);
+	zq->nr_pending = 0;
 
-error:
-	bio_io_error(bio);
-	return BLK_QC_T_NONE;
+	zq->cpu = cpumask_next(zq->cpu, cpu_online_mask);
+	if (zq->cpu >= nr_cpu_ids)
+		zq->cpu = cpumask_first(cpu_online_mask);
+	queue_work_on(zq->cpu, zram_wq, &cmd->work);
 }
 
+static blk_status_t zram_queue_rq(struct blk_mq_hw_ctx *hctx,
+				  const struct blk_mq_queue_data *bd)
+{
+	struct zram *zram = hctx->queue->queuedata;
+	struct zram_queue *zq = hctx->driver_data;
+	struct request *rq = bd->rq;
+	struct zram_cmd *cmd = blk_mq_rq_to_pdu(rq);
+
+	blk_mq_start_request(rq);
+
+	/*
+	 * Reads and discards are cheap compared to compression, and
+	 * latency sensitive. Serve them right here.
+	 */
+	if (req_op(rq) != REQ_OP_WRITE) {
+		blk_mq_end_request(rq, zram_rq_rw(zram, rq));
+		goto out;
+	}
+
+	spin_lock(&zq->lock);
+	list_add_tail(&cmd->node, &zq->pending);
+	if (++zq->nr_pending >= ZRAM_MQ_BATCH || bd->last)
+		zram_queue_batch(zq, cmd);
+	spin_unlock(&zq->lock);
+	return BLK_STS_OK;
+
+out:
+	/*
+	 * A write before us may be waiting for more requests that won't
+	 * come, don't leave it behind.
+	 */
+	if (bd->last) {
+		spin_lock(&zq->lock);
+		if (zq->nr_pending)
+			zram_queue_batch(zq, list_last_entry(&zq->pending,
+						struct zram_cmd, node));
+		spin_unlock(&zq->lock);
+	}
+	return BLK_STS_OK;
+}
+
+static int zram_init_hctx(struct blk_mq_hw_ctx *hctx, void *data,
+			  unsigned int index)
+{
+	struct zram *zram = data;
+	struct zram_queue *zq = &zram->queues[index];
+
+	spin_lock_init(&zq->lock);
+	INIT_LIST_HEAD(&zq->pending);
+	zq->nr_pending = 0;
+	zq->cpu = -1;
+	hctx->driver_data = zq;
+	return 0;
+}
+
+static int zram_init_request(struct blk_mq_tag_set *set, struct request *rq,
+			     unsigned int hctx_idx, unsigned int numa_node)
+{
+	struct zram_cmd *cmd = blk_mq_rq_to_pdu(rq);
+
+	INIT_WORK(&cmd->work, zram_batch_fn);
+	INIT_LIST_HEAD(&cmd->batch);
+	INIT_LIST_HEAD(&cmd->node);
+	return 0;
+}
+
+static const struct blk_mq_ops zram_mq_ops = {
+	.queue_rq	= zram_queue_rq,
+	.init_hctx	= zram_init_hctx,
+	.init_request	= zram_init_request,
+};
+
 static void zram_slot_free_notify(struct block_device *bdev,
 				unsigned long index)
 {
@@ -1264,8 +1363,13 @@ static int zram_rw_page(struct block_device *bdev, sector_t sector,
 	u32 index;
 	struct zram *zram;
 	struct bio_vec bv;
+	unsigned long start_time = jiffies;
 
-	if (PageTransHuge(page))
+	/*
+	 * Writes go through the request queue, so that they are batched
+	 * and compressed in parallel rather than on the submitting cpu.
+	 */
+	if (PageTransHuge(page) || is_write)
 		return -ENOTSUPP;
 	zram = bdev->bd_disk->private_data;
 
@@ -1282,7 +1386,11 @@ static int zram_rw_page(struct block_device *bdev, sector_t sector,
 	bv.bv_len = PAGE_SIZE;
 	bv.bv_offset = 0;
 
+	generic_start_io_acct(zram->disk->queue, REQ_OP_READ, SECTORS_PER_PAGE,
+			&zram->disk->part0);
 	ret = zram_bvec_rw(zram, &bv, index, offset, is_write, NULL);
+	generic_end_io_acct(zram->disk->queue, REQ_OP_READ,
+			&zram->disk->part0, start_time);
 out:
 	/*
 	 * If I/O fails, just return error(ie, non-zero) without
@@ -1507,15 +1615,32 @@ static int zram_add(void)
 
 	init_rwsem(&zram->init_lock);
 
-	queue = blk_alloc_queue(GFP_KERNEL);
-	if (!queue) {
-		pr_err("Error allocating disk queue for device %d\n",
-			device_id);
+	zram->queues = kcalloc(nr_cpu_ids, sizeof(*zram->queues), GFP_KERNEL);
+	if (!zram->queues) {
 		ret = -ENOMEM;
 		goto out_free_idr;
 	}
 
-	blk_queue_make_request(queue, zram_make_request);
+	zram->tag_set.ops = &zram_mq_ops;
+	zram->tag_set.nr_hw_queues = nr_cpu_ids;
+	zram->tag_set.queue_depth = ZRAM_MQ_DEPTH;
+	zram->tag_set.numa_node = NUMA_NO_NODE;
+	zram->tag_set.cmd_size = sizeof(struct zram_cmd);
+	zram->tag_set.flags = BLK_MQ_F_SHOULD_MERGE | BLK_MQ_F_BLOCKING;
+	zram->tag_set.driver_data = zram;
+
+	ret = blk_mq_alloc_tag_set(&zram->tag_set);
+	if (ret)
+		goto out_free_queues;
+
+	queue = blk_mq_init_queue(&zram->tag_set);
+	if (IS_ERR(queue)) {
+		pr_err("Error allocating disk queue for device %d\n",
+			device_id);
+		ret = PTR_ERR(queue);
+		goto out_free_tag_set;
+	}
+	queue->queuedata = zram;
 
 	/* gendisk structure */
 	zram->disk = alloc_disk(1);
@@ -1582,6 +1707,10 @@ static int zram_add(void)
 	put_disk(zram->disk);
 out_free_queue:
 	blk_cleanup_queue(queue);
+out_free_tag_set:
+	blk_mq_free_tag_set(&zram->tag_set);
+out_free_queues:
+	kfree(zram->queues);
 out_free_idr:
 	idr_remove(&zram_index_idr, device_id);
 out_free_dev:
@@ -1627,6 +1756,8 @@ static int zram_remove(struct zram *zram)
 	blk_cleanup_queue(zram->disk->queue);
 	del_gendisk(zram->disk);
 	put_disk(zram->disk);
+	blk_mq_free_tag_set(&zram->tag_set);
+	kfree(zram->queues);
 	kfree(zram);
 	return 0;
 }
@@ -1711,6 +1842,7 @@ static void destroy_devices(void)
 	idr_for_each(&zram_index_idr, &zram_remove_cb, NULL);
 	idr_destroy(&zram_index_idr);
 	unregister_blkdev(zram_major, "zram");
+	destroy_workqueue(zram_wq);
 	cpuhp_remove_multi_state(CPUHP_ZCOMP_PREPARE);
 }
 
@@ -1723,9 +1855,16 @@ static int __init zram_init(void)
 	if (ret < 0)
 		return ret;
 
+	zram_wq = alloc_workqueue("zram", WQ_MEM_RECLAIM | WQ_HIGHPRI, 0);
+	if (!zram_wq) {
+		cpuhp_remove_multi_state(CPUHP_ZCOMP_PREPARE);
+		return -ENOMEM;
+	}
+
 	ret = class_register(&zram_control_class);
 	if (ret) {
 		pr_err("Unable to register zram-control class\n");
+		destroy_workqueue(zram_wq);
 		cpuhp_remove_multi_state(CPUHP_ZCOMP_PREPARE);
 		return ret;
 	}
@@ -1734,6 +1873,7 @@ static int __init zram_init(void)
 	if (zram_major <= 0) {
 		pr_err("Unable to get major number\n");
 		class_unregister(&zram_control_class);
+		destroy_workqueue(zram_wq);
 		cpuhp_remove_multi_state(CPUHP_ZCOMP_PREPARE);
 		return -EBUSY;
 	}
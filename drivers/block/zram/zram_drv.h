@@ -16,6 +16,7 @@
 #define _ZRAM_DRV_H_
 
 #include <linux/rwsem.h>
+#include <linux/blk-mq.h>
 #include <linux/zsmalloc.h>
 #include <linux/crypto.h>
 
@@ -45,6 +46,10 @@ static const size_t max_zpage_size = PAGE_SIZE / 4 * 3;
 #define ZRAM_SECTOR_PER_LOGICAL_BLOCK	\
 	(1 << (ZRAM_LOGICAL_BLOCK_SHIFT - SECTOR_SHIFT))
 
+/* Max number of write requests handed to a compression worker at once */
+#define ZRAM_MQ_BATCH		16
+#define ZRAM_MQ_DEPTH		128
+
 
 /*
  * The lower ZRAM_FLAG_SHIFT bits of table.value is for
@@ -70,6 +75,21 @@ enum zram_pageflags {
 
 /*-- Data structures */
 
+/* Per-request driver data */
+struct zram_cmd {
+	struct work_struct work;
+	struct list_head batch;		/* requests this one compresses */
+	struct list_head node;		/* on zram_queue->pending or a batch */
+};
+
+/* Per hw queue state, collects writes into batches for the workers */
+struct zram_queue {
+	spinlock_t lock;
+	struct list_head pending;
+	unsigned int nr_pending;
+	int cpu;			/* cpu the last batch was sent to */
+};
+
 /* Allocated for each disk page */
 struct zram_table_entry {
 	union {
@@ -98,6 +118,8 @@ struct zram {
 	struct zs_pool *mem_pool;
 	struct zcomp *comp;
 	struct gendisk *disk;
+	struct blk_mq_tag_set tag_set;
+	struct zram_queue *queues;
 	/* Prevent concurrent execution of device init */
 	struct rw_semaphore init_lock;
 	/*
@@ -459,6 +459,10 @@ static int i915_gem_object_info(struct seq_file *m, void *data)
 		   count, size);
 	seq_printf(m, "%u purgeable objects, %llu bytes\n",
 		   purgeable_count, purgeable_size);
+	seq_printf(m, "%lu shrinkable objects, %lu swappable pages, %lu purgeable pages\n",
+		   atomic_long_read(&dev_priv->mm.shrink_count),
+		   atomic_long_read(&dev_priv->mm.shrink_pages),
+		   atomic_long_read(&dev_priv->mm.shrink_purgeable));
 	seq_printf(m, "%u mapped objects, %llu bytes\n",
 		   mapped_count, mapped_size);
 	seq_printf(m, "%u display objects (pinned), %llu bytes\n",
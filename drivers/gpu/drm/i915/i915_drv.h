@@ -1475,6 +1475,19 @@ struct i915_gem_mm {
 	struct notifier_block vmap_notifier;
 	struct shrinker shrinker;
 
+	/**
+	 * Running tally of the shrinkable objects that have backing pages,
+	 * and of those pages split by whether they can be discarded or need
+	 * to be swapped out. Lets the shrinker report how much it may be able
+	 * to reclaim without walking the object lists under struct_mutex.
+	 */
+	atomic_long_t shrink_count;
+	atomic_long_t shrink_pages;
+	atomic_long_t shrink_purgeable;
+
+	/** Sequence number of the i915_gem_shrink() passes, see there */
+	unsigned int shrink_scan;
+
 	/** LRU list of objects with fence regs on them. */
 	struct list_head fence_list;
 
@@ -3771,6 +3784,8 @@ unsigned long i915_gem_shrink(struct drm_i915_private *dev_priv,
 #define I915_SHRINK_ACTIVE 0x8
 #define I915_SHRINK_VMAPS 0x10
 unsigned long i915_gem_shrink_all(struct drm_i915_private *dev_priv);
+void __i915_gem_object_track_pages(struct drm_i915_gem_object *obj);
+void __i915_gem_object_untrack_pages(struct drm_i915_gem_object *obj);
 void i915_gem_shrinker_init(struct drm_i915_private *dev_priv);
 void i915_gem_shrinker_cleanup(struct drm_i915_private *dev_priv);
 
@@ -4329,6 +4344,10 @@ __i915_request_irq_complete(const struct drm_i915_gem_request *req)
 
 void i915_memcpy_init_early(struct drm_i915_private *dev_priv);
 bool i915_memcpy_from_wc(void *dst, const void *src, unsigned long len);
+void i915_unaligned_memcpy_from_wc(void *dst, const void *src,
+				   unsigned long len);
+unsigned long i915_memcpy_to_user_from_wc(void __user *dst, const void *src,
+					  unsigned long len);
 
 /* The movntdqa instructions used for memcpy-from-wc require 16-byte alignment,
  * as well as SSE4.1 support. i915_memcpy_from_wc() will report if it cannot
@@ -4338,7 +4357,9 @@ bool i915_memcpy_from_wc(void *dst, const void *src, unsigned long len);
  * always valid.
  *
  * For just checking for SSE4.1, in the foreknowledge that the future use
- * will be correctly aligned, just use i915_has_memcpy_from_wc().
+ * will be correctly aligned, just use i915_has_memcpy_from_wc(). The same
+ * check guards i915_unaligned_memcpy_from_wc() and
+ * i915_memcpy_to_user_from_wc(), which accept any alignment.
  */
 #define i915_can_memcpy_from_wc(dst, src, len) \
 	i915_memcpy_from_wc((void *)((unsigned long)(dst) | (unsigned long)(src) | (len)), NULL, 0)
@@ -1013,9 +1013,23 @@ gtt_user_read(struct io_mapping *mapping,
 	void *vaddr;
 	unsigned long unwritten;
 
-	/* We can use the cpu mem copy function because this is X86. */
+	/* We can use the cpu mem copy function because this is X86. Reading
+	 * from WC with streaming loads is much faster, if available.
+	 */
 	vaddr = (void __force *)io_mapping_map_atomic_wc(mapping, base);
-	unwritten = __copy_to_user_inatomic(user_data, vaddr + offset, length);
+	if (i915_has_memcpy_from_wc()) {
+		unwritten = i915_memcpy_to_user_from_wc(user_data,
+							vaddr + offset,
+							length);
+		if (unwritten) {
+			offset += length - unwritten;
+			user_data += length - unwritten;
+			length = unwritten;
+		}
+	} else {
+		unwritten = __copy_to_user_inatomic(user_data,
+						    vaddr + offset, length);
+	}
 	io_mapping_unmap_atomic(vaddr);
 	if (unwritten) {
 		vaddr = (void __force *)
@@ -1537,6 +1551,8 @@ static void i915_gem_object_bump_inactive_ggtt(struct drm_i915_gem_object *obj)
 	i915 = to_i915(obj->base.dev);
 	list = obj->bind_count ? &i915->mm.bound_list : &i915->mm.unbound_list;
 	list_move_tail(&obj->global_link, list);
+
+	WRITE_ONCE(obj->mm.referenced, true);
 }
 
 /**
@@ -2256,6 +2272,7 @@ void __i915_gem_object_put_pages(struct drm_i915_gem_object *obj,
 	 * lists early. */
 	pages = fetch_and_zero(&obj->mm.pages);
 	GEM_BUG_ON(!pages);
+	__i915_gem_object_untrack_pages(obj);
 
 	if (obj->mm.mapping) {
 		void *ptr;
@@ -2476,6 +2493,7 @@ void __i915_gem_object_set_pages(struct drm_i915_gem_object *obj,
 	obj->mm.get_page.sg_idx = 0;
 
 	obj->mm.pages = pages;
+	__i915_gem_object_track_pages(obj);
 
 	if (i915_gem_object_is_tiled(obj) &&
 	    to_i915(obj->base.dev)->quirks & QUIRK_PIN_SWIZZLED_PAGES) {
@@ -4294,8 +4312,13 @@ i915_gem_madvise_ioctl(struct drm_device *dev, void *data,
 		}
 	}
 
-	if (obj->mm.madv != __I915_MADV_PURGED)
+	if (obj->mm.madv != __I915_MADV_PURGED) {
+		/* Move the pages between the shrinker's swap/purge tallies */
+		__i915_gem_object_untrack_pages(obj);
 		obj->mm.madv = args->madv;
+		if (!IS_ERR_OR_NULL(obj->mm.pages))
+			__i915_gem_object_track_pages(obj);
+	}
 
 	/* if the object is no longer attached, discard its backing storage */
 	if (obj->mm.madv == I915_MADV_DONTNEED && !obj->mm.pages)
@@ -5410,6 +5433,7 @@ int i915_gem_object_attach_phys(struct drm_i915_gem_object *obj, int align)
 	}
 
 	pages = obj->mm.pages;
+	__i915_gem_object_untrack_pages(obj);
 	obj->ops = &i915_gem_phys_ops;
 
 	err = ____i915_gem_object_get_pages(obj);
@@ -5427,6 +5451,8 @@ int i915_gem_object_attach_phys(struct drm_i915_gem_object *obj, int align)
 err_xfer:
 	obj->ops = &i915_gem_object_ops;
 	obj->mm.pages = pages;
+	if (!IS_ERR_OR_NULL(pages))
+		__i915_gem_object_track_pages(obj);
 err_unlock:
 	mutex_unlock(&obj->mm.lock);
 	return err;
@@ -1859,6 +1859,7 @@ void i915_vma_move_to_active(struct i915_vma *vma,
 	i915_vma_set_active(vma, idx);
 	i915_gem_active_set(&vma->last_read[idx], req);
 	list_move_tail(&vma->vm_link, &vma->vm->active_list);
+	WRITE_ONCE(obj->mm.referenced, true);
 
 	obj->base.write_domain = 0;
 	if (flags & EXEC_OBJECT_WRITE) {
@@ -194,6 +194,28 @@ struct drm_i915_gem_object {
 		 * swizzling.
 		 */
 		bool quirked:1;
+
+		/**
+		 * How the backing pages are currently accounted for by the
+		 * shrinker, see __i915_gem_object_track_pages().
+		 */
+		unsigned int shrink_state:2;
+#define I915_MM_SHRINK_NONE	0
+#define I915_MM_SHRINK_SWAP	1
+#define I915_MM_SHRINK_PURGE	2
+
+		/**
+		 * Set whenever the object is used, and cleared again by the
+		 * shrinker as the object ages towards reclaim. Objects found
+		 * with the bit set are given a second pass around the LRU.
+		 */
+		bool referenced;
+
+		/**
+		 * The last i915_gem_shrink() pass that looked at the object,
+		 * so that a pass does not walk into objects it already saw.
+		 */
+		unsigned int shrink_scan;
 	} mm;
 
 	/** Breadcrumb of last rendering to the buffer.
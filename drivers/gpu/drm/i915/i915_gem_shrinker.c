@@ -125,11 +125,110 @@ static bool can_release_pages(struct drm_i915_gem_object *obj)
 	return swap_available() || obj->mm.madv == I915_MADV_DONTNEED;
 }
 
-static bool unsafe_drop_pages(struct drm_i915_gem_object *obj)
+/*
+ * Objects are unbound from the GTT under struct_mutex, but the release of
+ * their backing storage (which for shmem objects means touching every page
+ * in turn) only requires the object's own mm.lock. So we gather a batch of
+ * unbound objects and then drop struct_mutex (if we are allowed to) whilst
+ * we hand their pages back to the system.
+ */
+#define I915_SHRINK_BATCH 32
+
+struct shrink_batch {
+	unsigned int nr;
+	unsigned long pages;
+	struct drm_i915_gem_object *objects[I915_SHRINK_BATCH];
+};
+
+static bool shrink_batch_add(struct shrink_batch *batch,
+			     struct drm_i915_gem_object *obj)
+{
+	GEM_BUG_ON(batch->nr >= ARRAY_SIZE(batch->objects));
+
+	/* Off the lists whilst we still hold struct_mutex */
+	list_del_init(&obj->global_link);
+	batch->objects[batch->nr++] = i915_gem_object_get(obj);
+	batch->pages += obj->base.size >> PAGE_SHIFT;
+
+	return batch->nr == ARRAY_SIZE(batch->objects);
+}
+
+static unsigned long shrink_batch_release(struct shrink_batch *batch,
+					  unsigned long *scanned)
 {
-	if (i915_gem_object_unbind(obj) == 0)
+	unsigned long count = 0;
+	unsigned int n;
+
+	for (n = 0; n < batch->nr; n++) {
+		struct drm_i915_gem_object *obj = batch->objects[n];
+
+		/* The object may have been rebound whilst we were unlocked,
+		 * in which case its pages are pinned again and left alone.
+		 */
 		__i915_gem_object_put_pages(obj, I915_MM_SHRINKER);
-	return !READ_ONCE(obj->mm.pages);
+
+		/* May arrive from get_pages on another bo */
+		mutex_lock_nested(&obj->mm.lock, I915_MM_SHRINKER);
+		if (!obj->mm.pages) {
+			__i915_gem_object_invalidate(obj);
+			count += obj->base.size >> PAGE_SHIFT;
+		}
+		mutex_unlock(&obj->mm.lock);
+		*scanned += obj->base.size >> PAGE_SHIFT;
+	}
+
+	return count;
+}
+
+/*
+ * Drop our references to a released batch. An object that kept its pages
+ * (because it was pinned again whilst we were unlocked) and was not rebound
+ * meanwhile goes back on the unbound list, if we hold struct_mutex to do so.
+ */
+static void shrink_batch_reap(struct drm_i915_private *dev_priv,
+			      struct shrink_batch *batch,
+			      bool locked)
+{
+	unsigned int n;
+
+	for (n = 0; n < batch->nr; n++) {
+		struct drm_i915_gem_object *obj = batch->objects[n];
+
+		if (locked && READ_ONCE(obj->mm.pages) &&
+		    list_empty(&obj->global_link))
+			list_add_tail(&obj->global_link,
+				      obj->bind_count ?
+				      &dev_priv->mm.bound_list :
+				      &dev_priv->mm.unbound_list);
+
+		i915_gem_object_put(obj);
+	}
+
+	batch->nr = 0;
+	batch->pages = 0;
+}
+
+/*
+ * Second chance aging: an object that has been used since the shrinker last
+ * looked at it is rotated to the tail of its list rather than reclaimed, so
+ * that the lists approximate an active/inactive LRU without having to move
+ * objects around on every use. Purgeable objects and the aggressive passes
+ * (I915_SHRINK_ACTIVE) do not honour the referenced bit.
+ */
+static bool shrink_object_is_young(struct drm_i915_gem_object *obj,
+				   unsigned int flags)
+{
+	if (flags & (I915_SHRINK_PURGEABLE | I915_SHRINK_ACTIVE))
+		return false;
+
+	if (obj->mm.madv == I915_MADV_DONTNEED)
+		return false;
+
+	if (!READ_ONCE(obj->mm.referenced))
+		return false;
+
+	WRITE_ONCE(obj->mm.referenced, false);
+	return true;
 }
 
 /**
@@ -152,7 +251,8 @@ static bool unsafe_drop_pages(struct drm_i915_gem_object *obj)
  *
  * Also note that any kind of pinning (both per-vma address space pins and
  * backing storage pins at the buffer object level) result in the shrinker code
- * having to skip the object.
+ * having to skip the object. Objects that have been used since the previous
+ * scan are likewise skipped once, unless purging or shrinking active objects.
  *
  * Returns:
  * The number of pages of backing storage actually released.
@@ -171,13 +271,16 @@ i915_gem_shrink(struct drm_i915_private *dev_priv,
 		{ &dev_priv->mm.bound_list, I915_SHRINK_BOUND },
 		{ NULL, 0 },
 	}, *phase;
+	struct shrink_batch batch = {};
 	unsigned long count = 0;
 	unsigned long scanned = 0;
+	unsigned int scan;
 	bool unlock;
 
 	if (!shrinker_lock(dev_priv, &unlock))
 		return 0;
 
+	scan = ++dev_priv->mm.shrink_scan;
 	trace_i915_gem_shrink(dev_priv, target, flags);
 	i915_gem_retire_requests(dev_priv);
 
@@ -208,6 +311,15 @@ i915_gem_shrink(struct drm_i915_private *dev_priv,
 	 * unreferencing and the bound_list are both protected by the
 	 * dev->struct_mutex and so we won't ever be able to observe an
 	 * object on the bound_list with a reference count equals 0.
+	 *
+	 * Objects that have been unbound are collected into a batch, and
+	 * their pages are released once the batch is full (or the scan is
+	 * complete). If we took struct_mutex ourselves, we drop it across
+	 * the release so that we do not stall everyone else behind the
+	 * page freeing. The objects looked at so far must then be put back
+	 * on the list, as we may fail to retake the lock, and they are
+	 * stamped with this scan so that we stop on meeting them again
+	 * rather than rescanning them.
 	 */
 	for (phase = phases; phase->list; phase++) {
 		struct list_head still_in_list;
@@ -217,10 +329,14 @@ i915_gem_shrink(struct drm_i915_private *dev_priv,
 			continue;
 
 		INIT_LIST_HEAD(&still_in_list);
-		while (count < target &&
+		while (count + batch.pages < target &&
 		       (obj = list_first_entry_or_null(phase->list,
 						       typeof(*obj),
 						       global_link))) {
+			if (obj->mm.shrink_scan == scan)
+				break;
+
+			obj->mm.shrink_scan = scan;
 			list_move_tail(&obj->global_link, &still_in_list);
 			if (!obj->mm.pages) {
 				list_del_init(&obj->global_link);
@@ -243,29 +359,56 @@ i915_gem_shrink(struct drm_i915_private *dev_priv,
 			if (!can_release_pages(obj))
 				continue;
 
-			if (unsafe_drop_pages(obj)) {
-				/* May arrive from get_pages on another bo */
-				mutex_lock_nested(&obj->mm.lock,
-						  I915_MM_SHRINKER);
-				if (!obj->mm.pages) {
-					__i915_gem_object_invalidate(obj);
-					list_del_init(&obj->global_link);
-					count += obj->base.size >> PAGE_SHIFT;
-				}
-				mutex_unlock(&obj->mm.lock);
-				scanned += obj->base.size >> PAGE_SHIFT;
+			if (shrink_object_is_young(obj, flags))
+				continue;
+
+			if (i915_gem_object_unbind(obj))
+				continue;
+
+			if (!shrink_batch_add(&batch, obj))
+				continue;
+
+			if (!unlock) {
+				count += shrink_batch_release(&batch, &scanned);
+				shrink_batch_reap(dev_priv, &batch, true);
+				continue;
 			}
+
+			list_splice_tail_init(&still_in_list, phase->list);
+			mutex_unlock(&dev_priv->drm.struct_mutex);
+
+			count += shrink_batch_release(&batch, &scanned);
+
+			if (!shrinker_lock(dev_priv, &unlock)) {
+				shrink_batch_reap(dev_priv, &batch, false);
+				goto out_unlocked;
+			}
+			shrink_batch_reap(dev_priv, &batch, true);
 		}
 		list_splice_tail(&still_in_list, phase->list);
 	}
 
-	if (flags & I915_SHRINK_BOUND)
-		intel_runtime_pm_put(dev_priv);
+	if (batch.nr) {
+		if (unlock)
+			mutex_unlock(&dev_priv->drm.struct_mutex);
+
+		count += shrink_batch_release(&batch, &scanned);
+
+		if (unlock && !shrinker_lock(dev_priv, &unlock)) {
+			shrink_batch_reap(dev_priv, &batch, false);
+			goto out_unlocked;
+		}
+		shrink_batch_reap(dev_priv, &batch, true);
+	}
 
 	i915_gem_retire_requests(dev_priv);
 
 	shrinker_unlock(dev_priv, unlock);
 
+out_unlocked:
+	if (flags & I915_SHRINK_BOUND)
+		intel_runtime_pm_put(dev_priv);
+
 	if (nr_scanned)
 		*nr_scanned += scanned;
 	return count;
@@ -304,27 +447,33 @@ i915_gem_shrinker_count(struct shrinker *shrinker, struct shrink_control *sc)
 {
 	struct drm_i915_private *dev_priv =
 		container_of(shrinker, struct drm_i915_private, mm.shrinker);
-	struct drm_i915_gem_object *obj;
+	unsigned long num_objects;
 	unsigned long count;
-	bool unlock;
 
-	if (!shrinker_lock(dev_priv, &unlock))
-		return 0;
-
-	i915_gem_retire_requests(dev_priv);
-
-	count = 0;
-	list_for_each_entry(obj, &dev_priv->mm.unbound_list, global_link)
-		if (can_release_pages(obj))
-			count += obj->base.size >> PAGE_SHIFT;
+	/* This is only an estimate: pinned and active objects are included
+	 * in the tally, and are skipped over by the scan instead. That is a
+	 * much better trade than serialising every reclaimer on struct_mutex
+	 * just to walk the object lists.
+	 */
+	count = atomic_long_read(&dev_priv->mm.shrink_purgeable);
+	if (swap_available())
+		count += atomic_long_read(&dev_priv->mm.shrink_pages);
+
+	/* Update our preferred vmscan batch size for the next pass.
+	 * Our rough guess for an effective batch size is two available
+	 * GEM objects worth of pages. That is we don't want the shrinker
+	 * to fire, until it is worth the cost of freeing an entire GEM
+	 * object.
+	 */
+	num_objects = atomic_long_read(&dev_priv->mm.shrink_count);
+	if (num_objects) {
+		unsigned long avg = 2 * count / num_objects;
 
-	list_for_each_entry(obj, &dev_priv->mm.bound_list, global_link) {
-		if (!i915_gem_object_is_active(obj) && can_release_pages(obj))
-			count += obj->base.size >> PAGE_SHIFT;
+		dev_priv->mm.shrinker.batch =
+			max((dev_priv->mm.shrinker.batch + avg) >> 1,
+			    128ul /* default SHRINK_BATCH */);
 	}
 
-	shrinker_unlock(dev_priv, unlock);
-
 	return count;
 }
 
@@ -334,13 +483,12 @@ i915_gem_shrinker_scan(struct shrinker *shrinker, struct shrink_control *sc)
 	struct drm_i915_private *dev_priv =
 		container_of(shrinker, struct drm_i915_private, mm.shrinker);
 	unsigned long freed;
-	bool unlock;
 
+	/* Each pass takes struct_mutex for itself, so that it is free to
+	 * drop the lock whilst releasing each batch of pages.
+	 */
 	sc->nr_scanned = 0;
 
-	if (!shrinker_lock(dev_priv, &unlock))
-		return SHRINK_STOP;
-
 	freed = i915_gem_shrink(dev_priv,
 				sc->nr_to_scan,
 				&sc->nr_scanned,
@@ -364,8 +512,6 @@ i915_gem_shrinker_scan(struct shrinker *shrinker, struct shrink_control *sc)
 		intel_runtime_pm_put(dev_priv);
 	}
 
-	shrinker_unlock(dev_priv, unlock);
-
 	return sc->nr_scanned ? freed : SHRINK_STOP;
 }
 
@@ -487,6 +633,65 @@ i915_gem_shrinker_vmap(struct notifier_block *nb, unsigned long event, void *ptr
 	return NOTIFY_DONE;
 }
 
+/**
+ * __i915_gem_object_track_pages - Account for an object's pages in the shrinker
+ * @obj: the object whose backing storage was just attached
+ *
+ * Adds the object's pages to the running tally reported to the core mm by
+ * i915_gem_shrinker_count(). Must be paired with
+ * __i915_gem_object_untrack_pages() before the pages are released or the
+ * object changes its madvise state. Both are called under obj->mm.lock.
+ */
+void __i915_gem_object_track_pages(struct drm_i915_gem_object *obj)
+{
+	struct drm_i915_private *i915 = to_i915(obj->base.dev);
+	long pages = obj->base.size >> PAGE_SHIFT;
+
+	lockdep_assert_held(&obj->mm.lock);
+	GEM_BUG_ON(obj->mm.shrink_state != I915_MM_SHRINK_NONE);
+
+	if (!i915_gem_object_is_shrinkable(obj))
+		return;
+
+	if (obj->mm.madv == I915_MADV_DONTNEED) {
+		obj->mm.shrink_state = I915_MM_SHRINK_PURGE;
+		atomic_long_add(pages, &i915->mm.shrink_purgeable);
+	} else {
+		obj->mm.shrink_state = I915_MM_SHRINK_SWAP;
+		atomic_long_add(pages, &i915->mm.shrink_pages);
+	}
+	atomic_long_inc(&i915->mm.shrink_count);
+}
+
+/**
+ * __i915_gem_object_untrack_pages - Remove an object's pages from the shrinker
+ * @obj: the object whose backing storage is being released
+ *
+ * Reverses whatever __i915_gem_object_track_pages() recorded for @obj, if
+ * anything.
+ */
+void __i915_gem_object_untrack_pages(struct drm_i915_gem_object *obj)
+{
+	struct drm_i915_private *i915 = to_i915(obj->base.dev);
+	long pages = obj->base.size >> PAGE_SHIFT;
+
+	lockdep_assert_held(&obj->mm.lock);
+
+	switch (obj->mm.shrink_state) {
+	case I915_MM_SHRINK_NONE:
+		return;
+	case I915_MM_SHRINK_PURGE:
+		atomic_long_sub(pages, &i915->mm.shrink_purgeable);
+		break;
+	case I915_MM_SHRINK_SWAP:
+		atomic_long_sub(pages, &i915->mm.shrink_pages);
+		break;
+	}
+	atomic_long_dec(&i915->mm.shrink_count);
+
+	obj->mm.shrink_state = I915_MM_SHRINK_NONE;
+}
+
 /**
  * i915_gem_shrinker_init - Initialize i915 shrinker
  * @dev_priv: i915 device
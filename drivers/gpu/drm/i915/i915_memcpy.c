@@ -23,11 +23,13 @@
  */
 
 #include <linux/kernel.h>
+#include <linux/uaccess.h>
 #include <asm/fpu/api.h>
 
 #include "i915_drv.h"
 
 static DEFINE_STATIC_KEY_FALSE(has_movntdqa);
+static DEFINE_STATIC_KEY_FALSE(has_avx2_movntdqa);
 
 #ifdef CONFIG_AS_MOVNTDQA
 static void __memcpy_ntdqa(void *dst, const void *src, unsigned long len)
@@ -59,6 +61,149 @@ static void __memcpy_ntdqa(void *dst, const void *src, unsigned long len)
 
 	kernel_fpu_end();
 }
+
+/*
+ * As __memcpy_ntdqa(), but only the source is required to be aligned (to 16
+ * bytes); the stores are unaligned. Must be called between kernel_fpu_begin()
+ * and kernel_fpu_end(), @len is in bytes and a multiple of 16.
+ */
+static void __memcpy_ntdqu(void *dst, const void *src, unsigned long len)
+{
+	len >>= 4;
+	while (len >= 4) {
+		asm("movntdqa   (%0), %%xmm0\n"
+		    "movntdqa 16(%0), %%xmm1\n"
+		    "movntdqa 32(%0), %%xmm2\n"
+		    "movntdqa 48(%0), %%xmm3\n"
+		    "movups %%xmm0,   (%1)\n"
+		    "movups %%xmm1, 16(%1)\n"
+		    "movups %%xmm2, 32(%1)\n"
+		    "movups %%xmm3, 48(%1)\n"
+		    :: "r" (src), "r" (dst) : "memory");
+		src += 64;
+		dst += 64;
+		len -= 4;
+	}
+	while (len--) {
+		asm("movntdqa (%0), %%xmm0\n"
+		    "movups %%xmm0, (%1)\n"
+		    :: "r" (src), "r" (dst) : "memory");
+		src += 16;
+		dst += 16;
+	}
+}
+
+/*
+ * Read the aligned 16 byte block containing @src with a streaming load,
+ * and copy @len bytes of it starting from @src. As the aligned block never
+ * crosses a page boundary, we never touch memory outside of the page(s)
+ * the caller asked us to read.
+ */
+static void __memcpy_ntdqa_partial(void *dst, const void *src,
+				   unsigned long len)
+{
+	u8 tmp[16] __aligned(16);
+	unsigned long offset = (unsigned long)src & 15;
+
+	GEM_BUG_ON(offset + len > 16);
+
+	asm("movntdqa (%0), %%xmm0\n"
+	    "movaps %%xmm0, (%1)\n"
+	    :: "r" (src - offset), "r" (tmp) : "memory");
+	memcpy(dst, tmp + offset, len);
+}
+#endif
+
+#ifdef CONFIG_AS_AVX2
+/*
+ * The AVX2 variant of __memcpy_ntdqu(): 32 byte streaming loads, so @src
+ * must be aligned to 32 bytes and @len a multiple of 32. Must be called
+ * between kernel_fpu_begin() and kernel_fpu_end().
+ */
+static void __memcpy_ntdqu_avx2(void *dst, const void *src, unsigned long len)
+{
+	len >>= 5;
+	while (len >= 4) {
+		asm("vmovntdqa   (%0), %%ymm0\n"
+		    "vmovntdqa 32(%0), %%ymm1\n"
+		    "vmovntdqa 64(%0), %%ymm2\n"
+		    "vmovntdqa 96(%0), %%ymm3\n"
+		    "vmovdqu %%ymm0,   (%1)\n"
+		    "vmovdqu %%ymm1, 32(%1)\n"
+		    "vmovdqu %%ymm2, 64(%1)\n"
+		    "vmovdqu %%ymm3, 96(%1)\n"
+		    :: "r" (src), "r" (dst) : "memory");
+		src += 128;
+		dst += 128;
+		len -= 4;
+	}
+	while (len--) {
+		asm("vmovntdqa (%0), %%ymm0\n"
+		    "vmovdqu %%ymm0, (%1)\n"
+		    :: "r" (src), "r" (dst) : "memory");
+		src += 32;
+		dst += 32;
+	}
+	asm volatile("vzeroupper");
+}
+#endif
+
+#ifdef CONFIG_AS_MOVNTDQA
+/*
+ * Copy the aligned body of a transfer: @src must be aligned to 16 bytes and
+ * @len a multiple of 16. Uses 32 byte loads where available, after a single
+ * 16 byte load if required to bring @src up to 32 byte alignment.
+ */
+static void __memcpy_from_wc_body(void *dst, const void *src, unsigned long len)
+{
+#ifdef CONFIG_AS_AVX2
+	if (static_branch_likely(&has_avx2_movntdqa) && len >= 64) {
+		if ((unsigned long)src & 16) {
+			__memcpy_ntdqu(dst, src, 16);
+			src += 16;
+			dst += 16;
+			len -= 16;
+		}
+
+		__memcpy_ntdqu_avx2(dst, src, round_down(len, 32));
+		src += round_down(len, 32);
+		dst += round_down(len, 32);
+		len &= 31;
+	}
+#endif
+
+	if (len)
+		__memcpy_ntdqu(dst, src, len);
+}
+
+static void __memcpy_from_wc(void *dst, const void *src, unsigned long len)
+{
+	unsigned long x;
+
+	kernel_fpu_begin();
+
+	x = (unsigned long)src & 15;
+	if (x) {
+		x = min(16 - x, len);
+		__memcpy_ntdqa_partial(dst, src, x);
+		src += x;
+		dst += x;
+		len -= x;
+	}
+
+	x = round_down(len, 16);
+	if (x) {
+		__memcpy_from_wc_body(dst, src, x);
+		src += x;
+		dst += x;
+		len -= x;
+	}
+
+	if (len)
+		__memcpy_ntdqa_partial(dst, src, len);
+
+	kernel_fpu_end();
+}
 #endif
 
 /**
@@ -84,6 +229,16 @@ bool i915_memcpy_from_wc(void *dst, const void *src, unsigned long len)
 		return false;
 
 #ifdef CONFIG_AS_MOVNTDQA
+#ifdef CONFIG_AS_AVX2
+	if (static_branch_likely(&has_avx2_movntdqa)) {
+		if (likely(len)) {
+			kernel_fpu_begin();
+			__memcpy_from_wc_body(dst, src, len);
+			kernel_fpu_end();
+		}
+		return true;
+	}
+#endif
 	if (static_branch_likely(&has_movntdqa)) {
 		if (likely(len))
 			__memcpy_ntdqa(dst, src, len);
@@ -94,8 +249,98 @@ bool i915_memcpy_from_wc(void *dst, const void *src, unsigned long len)
 	return false;
 }
 
+/**
+ * i915_unaligned_memcpy_from_wc: perform an accelerated read from WC
+ * @dst: destination pointer
+ * @src: source pointer
+ * @len: how many bytes to copy
+ *
+ * Like i915_memcpy_from_wc(), but without any restriction upon the
+ * alignment of @dst, @src or @len. The misaligned head and tail of the
+ * source are read using streaming loads of the aligned 16 byte blocks that
+ * contain them, so no memory outside of [@src, @src + @len) rounded out to
+ * 16 bytes is accessed, and exactly @len bytes are written to @dst.
+ *
+ * The caller must check i915_has_memcpy_from_wc() beforehand.
+ */
+void i915_unaligned_memcpy_from_wc(void *dst, const void *src,
+				   unsigned long len)
+{
+	GEM_BUG_ON(!i915_has_memcpy_from_wc());
+
+#ifdef CONFIG_AS_MOVNTDQA
+	if (likely(len))
+		__memcpy_from_wc(dst, src, len);
+#endif
+}
+
+/**
+ * i915_memcpy_to_user_from_wc: perform an accelerated read from WC to user
+ * @dst: destination user pointer
+ * @src: source pointer (to WC memory)
+ * @len: how many bytes to copy
+ *
+ * Copies from WC memory into userspace by streaming chunks of the source
+ * into a small cache-resident bounce buffer and then copying that out with
+ * the regular (cached) user copy, so that the uncached reads and the user
+ * writes are interleaved chunk by chunk rather than done byte by byte.
+ * Page faults are disabled for the duration of the copy, so it may be used
+ * from atomic context; any remainder should be retried by the caller with
+ * copy_to_user() (or similar) from outside of the atomic section.
+ *
+ * The caller must check i915_has_memcpy_from_wc() beforehand.
+ *
+ * Returns the number of bytes that could not be copied.
+ */
+unsigned long i915_memcpy_to_user_from_wc(void __user *dst, const void *src,
+					  unsigned long len)
+{
+#ifdef CONFIG_AS_MOVNTDQA
+	u8 tmp[256] __aligned(32);
+
+	GEM_BUG_ON(!i915_has_memcpy_from_wc());
+
+	pagefault_disable();
+	kernel_fpu_begin();
+	while (len) {
+		unsigned long x = min_t(unsigned long, len, sizeof(tmp));
+
+		/* Keep the bulk of the streaming loads aligned */
+		if ((unsigned long)src & 15)
+			x = min(x, 16 - ((unsigned long)src & 15));
+		else if (x >= 16)
+			x = round_down(x, 16);
+
+		if (x & 15)
+			__memcpy_ntdqa_partial(tmp, src, x);
+		else
+			__memcpy_from_wc_body(tmp, src, x);
+
+		if (__copy_to_user_inatomic(dst, tmp, x))
+			break;
+
+		src += x;
+		dst += x;
+		len -= x;
+	}
+	kernel_fpu_end();
+	pagefault_enable();
+#endif
+
+	return len;
+}
+
 void i915_memcpy_init_early(struct drm_i915_private *dev_priv)
 {
 	if (static_cpu_has(X86_FEATURE_XMM4_1))
 		static_branch_enable(&has_movntdqa);
+
+	if (static_cpu_has(X86_FEATURE_XMM4_1) &&
+	    static_cpu_has(X86_FEATURE_AVX2) &&
+	    cpu_has_xfeatures(XFEATURE_MASK_SSE | XFEATURE_MASK_YMM, NULL))
+		static_branch_enable(&has_avx2_movntdqa);
 }
+
+#if IS_ENABLED(CONFIG_DRM_I915_SELFTEST)
+#include "selftests/i915_memcpy.c"
+#endif
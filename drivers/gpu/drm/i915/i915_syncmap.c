@@ -43,6 +43,12 @@
  * effective lookup cache. If the new lookup is not on the same leaf, we
  * expect it to be on the neighbouring branch.
  *
+ * To avoid walking the tree when the lookups alternate between a pair of
+ * leaves (e.g. a client ping-ponging between two contexts that are far apart
+ * in the fence context space), each leaf also remembers the leaf that was
+ * the most recently used before it was, giving us a second cached entry.
+ * As the layers are only freed all at once, that hint is always valid.
+ *
  * A leaf holds an array of u32 seqno, and has height 0. The bitmap field
  * allows us to store whether a particular seqno is valid (i.e. allows us
  * to distinguish unset from 0).
@@ -75,6 +81,7 @@ struct i915_syncmap {
 	unsigned int height;
 	unsigned int bitmap;
 	struct i915_syncmap *parent;
+	struct i915_syncmap *hint; /* previously used leaf, leaves only */
 	/*
 	 * Following this header is an array of either seqno or child pointers:
 	 * union {
@@ -137,6 +144,17 @@ static inline bool seqno_later(u32 a, u32 b)
 	return (s32)(a - b) >= 0;
 }
 
+static inline void __sync_set_root(struct i915_syncmap **root,
+				   struct i915_syncmap *p)
+{
+	GEM_BUG_ON(p->height);
+
+	if (*root != p) {
+		p->hint = *root;
+		*root = p;
+	}
+}
+
 /**
  * i915_syncmap_is_later -- compare against the last know sync point
  * @root - pointer to the #i915_syncmap
@@ -163,6 +181,12 @@ bool i915_syncmap_is_later(struct i915_syncmap **root, u64 id, u32 seqno)
 	if (likely(__sync_leaf_prefix(p, id) == p->prefix))
 		goto found;
 
+	/* Then try the leaf we were using before this one */
+	if (p->hint && __sync_leaf_prefix(p->hint, id) == p->hint->prefix) {
+		p = p->hint;
+		goto hit;
+	}
+
 	/* First climb the tree back to a parent branch */
 	do {
 		p = p->parent;
@@ -186,7 +210,8 @@ bool i915_syncmap_is_later(struct i915_syncmap **root, u64 id, u32 seqno)
 			return false;
 	} while (1);
 
-	*root = p;
+hit:
+	__sync_set_root(root, p);
 found:
 	idx = __sync_leaf_idx(p, id);
 	if (!(p->bitmap & BIT(idx)))
@@ -205,6 +230,7 @@ __sync_alloc_leaf(struct i915_syncmap *parent, u64 id)
 		return NULL;
 
 	p->parent = parent;
+	p->hint = NULL;
 	p->height = 0;
 	p->bitmap = 0;
 	p->prefix = __sync_leaf_prefix(p, id);
@@ -243,6 +269,11 @@ static noinline int __sync_set(struct i915_syncmap **root, u64 id, u32 seqno)
 	/* Caller handled the likely cached case */
 	GEM_BUG_ON(__sync_leaf_prefix(p, id) == p->prefix);
 
+	if (p->hint && __sync_leaf_prefix(p->hint, id) == p->hint->prefix) {
+		p = p->hint;
+		goto found;
+	}
+
 	/* Climb back up the tree until we find a common prefix */
 	do {
 		if (!p->parent)
@@ -333,7 +364,7 @@ static noinline int __sync_set(struct i915_syncmap **root, u64 id, u32 seqno)
 found:
 	GEM_BUG_ON(p->prefix != __sync_leaf_prefix(p, id));
 	__sync_set_seqno(p, id, seqno);
-	*root = p;
+	__sync_set_root(root, p);
 	return 0;
 }
 
@@ -0,0 +1,268 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <linux/vmalloc.h>
+
+#include "../i915_selftest.h"
+#include "i915_random.h"
+
+#define MEMCPY_PAGES 16
+
+struct memcpy_buffers {
+	struct page *pages[MEMCPY_PAGES];
+	void *wc; /* source, mapped write-combined */
+	void *dst;
+};
+
+static void free_buffers(struct memcpy_buffers *b)
+{
+	unsigned int n;
+
+	vfree(b->dst);
+	if (b->wc)
+		vunmap(b->wc);
+	for (n = 0; n < ARRAY_SIZE(b->pages); n++)
+		if (b->pages[n])
+			__free_page(b->pages[n]);
+}
+
+static int alloc_buffers(struct memcpy_buffers *b, struct rnd_state *prng)
+{
+	unsigned int n;
+
+	memset(b, 0, sizeof(*b));
+
+	for (n = 0; n < ARRAY_SIZE(b->pages); n++) {
+		b->pages[n] = alloc_page(GFP_KERNEL);
+		if (!b->pages[n])
+			goto err;
+	}
+
+	b->wc = vmap(b->pages, ARRAY_SIZE(b->pages), VM_MAP,
+		     pgprot_writecombine(PAGE_KERNEL));
+	if (!b->wc)
+		goto err;
+
+	/* Leave a guard page either side of the copy for overrun checks */
+	b->dst = vmalloc((MEMCPY_PAGES + 2) * PAGE_SIZE);
+	if (!b->dst)
+		goto err;
+
+	prandom_bytes_state(prng, b->wc, MEMCPY_PAGES * PAGE_SIZE);
+	return 0;
+
+err:
+	free_buffers(b);
+	return -ENOMEM;
+}
+
+static int check_copy(const struct memcpy_buffers *b,
+		      unsigned long src, unsigned long dst, unsigned long len)
+{
+	const u8 *out = b->dst + PAGE_SIZE;
+	unsigned long i;
+
+	if (memcmp(out + dst, b->wc + src, len)) {
+		pr_err("copy of %lu bytes from offset %lu to %lu is corrupt\n",
+		       len, src, dst);
+		return -EINVAL;
+	}
+
+	for (i = 0; i < dst; i++) {
+		if (out[i] != POISON_INUSE) {
+			pr_err("copy of %lu bytes from offset %lu to %lu underran\n",
+			       len, src, dst);
+			return -EINVAL;
+		}
+	}
+
+	for (i = dst + len; i < dst + len + 64; i++) {
+		if (out[i] != POISON_INUSE) {
+			pr_err("copy of %lu bytes from offset %lu to %lu overran\n",
+			       len, src, dst);
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+static int igt_memcpy_unaligned(void *ignored)
+{
+	I915_RND_STATE(prng);
+	struct memcpy_buffers b;
+	unsigned long src, dst, len;
+	int err;
+
+	if (!i915_has_memcpy_from_wc())
+		return 0;
+
+	err = alloc_buffers(&b, &prng);
+	if (err)
+		return err;
+
+	/* Exhaustively check the heads and tails, then the bulk paths */
+	for (src = 0; src < 64; src++) {
+		for (dst = 0; dst < 64; dst += 7) {
+			for (len = 0; len < 320; len++) {
+				memset(b.dst, POISON_INUSE,
+				       (MEMCPY_PAGES + 2) * PAGE_SIZE);
+				i915_unaligned_memcpy_from_wc(b.dst + PAGE_SIZE + dst,
+							      b.wc + src, len);
+				err = check_copy(&b, src, dst, len);
+				if (err)
+					goto out;
+			}
+		}
+		cond_resched();
+	}
+
+	for (len = 4096; len < (MEMCPY_PAGES - 1) * PAGE_SIZE; len += 4093) {
+		src = prandom_u32_state(&prng) % PAGE_SIZE;
+		dst = prandom_u32_state(&prng) % PAGE_SIZE;
+
+		memset(b.dst, POISON_INUSE, (MEMCPY_PAGES + 2) * PAGE_SIZE);
+		i915_unaligned_memcpy_from_wc(b.dst + PAGE_SIZE + dst,
+					      b.wc + src, len);
+		err = check_copy(&b, src, dst, len);
+		if (err)
+			goto out;
+	}
+
+	for (len = 0; len <= (MEMCPY_PAGES - 1) * PAGE_SIZE; len += 16 * 67) {
+		memset(b.dst, POISON_INUSE, (MEMCPY_PAGES + 2) * PAGE_SIZE);
+		if (!i915_memcpy_from_wc(b.dst + PAGE_SIZE + 16,
+					 b.wc + 16, len)) {
+			pr_err("aligned copy of %lu bytes rejected\n", len);
+			err = -EINVAL;
+			goto out;
+		}
+		err = check_copy(&b, 16, 16, len);
+		if (err)
+			goto out;
+	}
+
+out:
+	free_buffers(&b);
+	return err;
+}
+
+static void bench_memcpy(void *dst, const void *src, unsigned long len)
+{
+	memcpy(dst, src, len);
+}
+
+#ifdef CONFIG_AS_MOVNTDQA
+static bool has_ntdqa(void)
+{
+	return static_branch_likely(&has_movntdqa);
+}
+
+static void bench_ntdqa(void *dst, const void *src, unsigned long len)
+{
+	__memcpy_ntdqa(dst, src, len);
+}
+
+static void bench_unaligned(void *dst, const void *src, unsigned long len)
+{
+	__memcpy_from_wc(dst, src + 1, len - 1);
+}
+#endif
+
+#ifdef CONFIG_AS_AVX2
+static bool has_avx2(void)
+{
+	return static_branch_likely(&has_avx2_movntdqa);
+}
+
+static void bench_avx2(void *dst, const void *src, unsigned long len)
+{
+	kernel_fpu_begin();
+	__memcpy_ntdqu_avx2(dst, src, len);
+	kernel_fpu_end();
+}
+#endif
+
+static int igt_memcpy_throughput(void *ignored)
+{
+	static const struct {
+		const char *name;
+		void (*copy)(void *dst, const void *src, unsigned long len);
+		bool (*available)(void);
+	} variants[] = {
+		{ "memcpy", bench_memcpy },
+#ifdef CONFIG_AS_MOVNTDQA
+		{ "movntdqa", bench_ntdqa, has_ntdqa },
+		{ "movntdqa-unaligned", bench_unaligned, has_ntdqa },
+#endif
+#ifdef CONFIG_AS_AVX2
+		{ "vmovntdqa", bench_avx2, has_avx2 },
+#endif
+		{ }
+	}, *v;
+	const unsigned long len = MEMCPY_PAGES * PAGE_SIZE;
+	I915_RND_STATE(prng);
+	struct memcpy_buffers b;
+	int err;
+
+	err = alloc_buffers(&b, &prng);
+	if (err)
+		return err;
+
+	for (v = variants; v->name; v++) {
+		unsigned long count = 0;
+		ktime_t start, dt;
+
+		if (v->available && !v->available())
+			continue;
+
+		start = ktime_get();
+		do {
+			v->copy(b.dst, b.wc, len);
+			count++;
+			dt = ktime_sub(ktime_get(), start);
+		} while (ktime_to_ms(dt) < 100);
+
+		pr_info("%s: %s copied %lu MiB from WC in %lluus, %llu MiB/s\n",
+			__func__, v->name, count * len >> 20,
+			ktime_to_us(dt),
+			div64_u64(mul_u64_u32_shr(count * len, NSEC_PER_SEC, 20),
+				  ktime_to_ns(dt)));
+	}
+
+	free_buffers(&b);
+	return 0;
+}
+
+int i915_memcpy_mock_selftests(void)
+{
+	static const struct i915_subtest tests[] = {
+		SUBTEST(igt_memcpy_unaligned),
+		SUBTEST(igt_memcpy_throughput),
+	};
+
+	i915_memcpy_init_early(NULL);
+
+	return i915_subtests(tests, NULL);
+}
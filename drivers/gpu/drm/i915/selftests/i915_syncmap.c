@@ -600,6 +600,98 @@ static int igt_syncmap_random(void *arg)
 	return dump_syncmap(sync, err);
 }
 
+static int bench_syncmap(const char *name, const u64 *contexts,
+			 unsigned long count)
+{
+	struct i915_syncmap *sync;
+	unsigned long ops, i;
+	ktime_t start, dt;
+	u32 seqno;
+	int err;
+
+	i915_syncmap_init(&sync);
+
+	for (i = 0; i < count; i++) {
+		err = i915_syncmap_set(&sync, contexts[i], 0);
+		if (err)
+			goto out;
+	}
+
+	ops = 0;
+	seqno = 0;
+	start = ktime_get();
+	do {
+		seqno++;
+		for (i = 0; i < count; i++) {
+			if (i915_syncmap_is_later(&sync, contexts[i], seqno)) {
+				pr_err("%s: context=%llu already later than %u\n",
+				       name, contexts[i], seqno);
+				err = -EINVAL;
+				goto out;
+			}
+
+			err = i915_syncmap_set(&sync, contexts[i], seqno);
+			if (err)
+				goto out;
+		}
+		ops += count;
+		dt = ktime_sub(ktime_get(), start);
+	} while (ktime_to_ms(dt) < 100);
+
+	pr_info("%s: %lu contexts, %lu await+set in %lluus, %lluns per op\n",
+		name, count, ops, ktime_to_us(dt),
+		div64_u64(ktime_to_ns(dt), ops));
+	err = 0;
+out:
+	return dump_syncmap(sync, err);
+}
+
+static int igt_syncmap_bench(void *arg)
+{
+	const unsigned long count = 1024;
+	I915_RND_STATE(prng);
+	u64 *contexts;
+	unsigned long i;
+	int err;
+
+	/*
+	 * Measure the cost of the lookups and updates performed for every
+	 * request await, for a few access patterns: all on one leaf,
+	 * alternating between two distant leaves, walking along adjacent
+	 * leaves and spread randomly across the tree.
+	 */
+
+	contexts = kmalloc_array(count, sizeof(*contexts), GFP_KERNEL);
+	if (!contexts)
+		return -ENOMEM;
+
+	for (i = 0; i < KSYNCMAP; i++)
+		contexts[i] = i;
+	err = bench_syncmap("leaf", contexts, KSYNCMAP);
+	if (err)
+		goto out;
+
+	for (i = 0; i < count; i++)
+		contexts[i] = (i & 1) << 40 | i >> 1;
+	err = bench_syncmap("ping-pong", contexts, count);
+	if (err)
+		goto out;
+
+	for (i = 0; i < count; i++)
+		contexts[i] = i * KSYNCMAP;
+	err = bench_syncmap("neighbours", contexts, count);
+	if (err)
+		goto out;
+
+	for (i = 0; i < count; i++)
+		contexts[i] = i915_prandom_u64_state(&prng);
+	err = bench_syncmap("random", contexts, count);
+
+out:
+	kfree(contexts);
+	return err;
+}
+
 int i915_syncmap_mock_selftests(void)
 {
 	static const struct i915_subtest tests[] = {
@@ -610,6 +702,7 @@ int i915_syncmap_mock_selftests(void)
 		SUBTEST(igt_syncmap_neighbours),
 		SUBTEST(igt_syncmap_compact),
 		SUBTEST(igt_syncmap_random),
+		SUBTEST(igt_syncmap_bench),
 	};
 
 	return i915_subtests(tests, NULL);
@@ -150,6 +150,15 @@ struct kioctx {
 		spinlock_t	completion_lock;
 	} ____cacheline_aligned_in_smp;
 
+	struct {
+		/*
+		 * In-flight IOCB_HIPRI requests whose file supports ->iopoll,
+		 * reaped by busy polling from io_getevents().
+		 */
+		spinlock_t	poll_lock;
+		struct list_head poll_submitted;
+	} ____cacheline_aligned_in_smp;
+
 	struct page		*internal_pages[AIO_RING_PAGES];
 	struct file		*aio_ring_file;
 
@@ -181,6 +190,14 @@ struct aio_kiocb {
 	struct list_head	ki_list;	/* the aio core uses this
 						 * for cancellation */
 
+	struct list_head	ki_poll_list;	/* on ctx->poll_submitted */
+
+	/*
+	 * One reference for submission and one for completion, plus a
+	 * temporary one held by io_getevents() while polling the request.
+	 */
+	refcount_t		ki_refcnt;
+
 	/*
 	 * If the aio_resfd field of the userspace iocb is not zero,
 	 * this is the underlying eventfd context to deliver events to.
@@ -748,6 +765,7 @@ static struct kioctx *ioctx_alloc(unsigned nr_events)
 
 	spin_lock_init(&ctx->ctx_lock);
 	spin_lock_init(&ctx->completion_lock);
+	spin_lock_init(&ctx->poll_lock);
 	mutex_init(&ctx->ring_lock);
 	/* Protect against page migration throughout kiotx setup by keeping
 	 * the ring_lock mutex held until setup is complete. */
@@ -755,6 +773,7 @@ static struct kioctx *ioctx_alloc(unsigned nr_events)
 	init_waitqueue_head(&ctx->wait);
 
 	INIT_LIST_HEAD(&ctx->active_reqs);
+	INIT_LIST_HEAD(&ctx->poll_submitted);
 
 	if (percpu_ref_init(&ctx->users, free_ioctx_users, 0, GFP_KERNEL))
 		goto err;
@@ -924,32 +943,40 @@ static void put_reqs_available(struct kioctx *ctx, unsigned nr)
 	local_irq_restore(flags);
 }
 
-static bool get_reqs_available(struct kioctx *ctx)
+/* get_reqs_available
+ *	Reserve up to nr slots in the completion ring, moving them from the
+ *	global counter to this cpu's in multiples of req_batch as needed.
+ *	Returns the number of slots reserved.
+ */
+static unsigned get_reqs_available(struct kioctx *ctx, unsigned nr)
 {
 	struct kioctx_cpu *kcpu;
-	bool ret = false;
+	unsigned ret;
 	unsigned long flags;
 
 	local_irq_save(flags);
 	kcpu = this_cpu_ptr(ctx->cpu);
-	if (!kcpu->reqs_available) {
-		int old, avail = atomic_read(&ctx->reqs_available);
+	if (kcpu->reqs_available < nr) {
+		unsigned want = roundup(nr - kcpu->reqs_available,
+					ctx->req_batch);
+		int old, take, avail = atomic_read(&ctx->reqs_available);
 
 		do {
-			if (avail < ctx->req_batch)
-				goto out;
+			take = min_t(int, want, rounddown(avail, ctx->req_batch));
+			if (take <= 0)
+				break;
 
 			old = avail;
 			avail = atomic_cmpxchg(&ctx->reqs_available,
-					       avail, avail - ctx->req_batch);
+					       avail, avail - take);
 		} while (avail != old);
 
-		kcpu->reqs_available += ctx->req_batch;
+		if (take > 0)
+			kcpu->reqs_available += take;
 	}
 
-	ret = true;
-	kcpu->reqs_available--;
-out:
+	ret = min(nr, kcpu->reqs_available);
+	kcpu->reqs_available -= ret;
 	local_irq_restore(flags);
 	return ret;
 }
@@ -1016,31 +1043,85 @@ static void user_refill_reqs_available(struct kioctx *ctx)
 	spin_unlock_irq(&ctx->completion_lock);
 }
 
+/*
+ * Per io_submit() call state: ring slots and kiocbs are reserved for the
+ * remaining iocbs in batches instead of one at a time, and a single plug
+ * covers the whole call.
+ */
+#define AIO_SUBMIT_BATCH	16
+
+struct aio_submit_state {
+	struct kioctx		*ctx;
+	unsigned		to_submit;	/* iocbs left, including this one */
+	unsigned		slots;		/* reserved ring slots */
+	unsigned		free_reqs;	/* preallocated kiocbs in reqs[] */
+	void			*reqs[AIO_SUBMIT_BATCH];
+	struct blk_plug		plug;
+};
+
+static void aio_submit_state_start(struct aio_submit_state *state,
+				   struct kioctx *ctx, long nr)
+{
+	state->ctx = ctx;
+	state->to_submit = min_t(long, nr, UINT_MAX);
+	state->slots = 0;
+	state->free_reqs = 0;
+	blk_start_plug_nr_ios(&state->plug, min_t(long, nr, USHRT_MAX));
+}
+
+static void aio_submit_state_end(struct aio_submit_state *state)
+{
+	blk_finish_plug(&state->plug);
+	if (state->slots)
+		put_reqs_available(state->ctx, state->slots);
+	if (state->free_reqs)
+		kmem_cache_free_bulk(kiocb_cachep, state->free_reqs,
+				     state->reqs);
+}
+
 /* aio_get_req
  *	Allocate a slot for an aio request.
  * Returns NULL if no requests are free.
  */
-static inline struct aio_kiocb *aio_get_req(struct kioctx *ctx)
+static inline struct aio_kiocb *aio_get_req(struct aio_submit_state *state)
 {
+	struct kioctx *ctx = state->ctx;
 	struct aio_kiocb *req;
 
-	if (!get_reqs_available(ctx)) {
-		user_refill_reqs_available(ctx);
-		if (!get_reqs_available(ctx))
-			return NULL;
+	if (!state->slots) {
+		state->slots = get_reqs_available(ctx, state->to_submit);
+		if (!state->slots) {
+			user_refill_reqs_available(ctx);
+			state->slots = get_reqs_available(ctx, state->to_submit);
+			if (!state->slots)
+				return NULL;
+		}
 	}
 
-	req = kmem_cache_alloc(kiocb_cachep, GFP_KERNEL|__GFP_ZERO);
-	if (unlikely(!req))
-		goto out_put;
+	if (!state->free_reqs) {
+		size_t sz = min_t(size_t, state->to_submit, AIO_SUBMIT_BATCH);
+
+		state->free_reqs = kmem_cache_alloc_bulk(kiocb_cachep,
+						GFP_KERNEL, sz, state->reqs);
+		if (unlikely(!state->free_reqs)) {
+			state->reqs[0] = kmem_cache_alloc(kiocb_cachep,
+							  GFP_KERNEL);
+			if (unlikely(!state->reqs[0]))
+				return NULL;
+			state->free_reqs = 1;
+		}
+	}
+
+	req = state->reqs[--state->free_reqs];
+	state->slots--;
+	memset(req, 0, sizeof(*req));
 
 	percpu_ref_get(&ctx->reqs);
 
 	req->ki_ctx = ctx;
+	INIT_LIST_HEAD(&req->ki_poll_list);
+	refcount_set(&req->ki_refcnt, 2);
 	return req;
-out_put:
-	put_reqs_available(ctx, 1);
-	return NULL;
 }
 
 static void kiocb_free(struct aio_kiocb *req)
@@ -1052,6 +1133,12 @@ static void kiocb_free(struct aio_kiocb *req)
 	kmem_cache_free(kiocb_cachep, req);
 }
 
+static inline void iocb_put(struct aio_kiocb *req)
+{
+	if (refcount_dec_and_test(&req->ki_refcnt))
+		kiocb_free(req);
+}
+
 static struct kioctx *lookup_ioctx(unsigned long ctx_id)
 {
 	struct aio_ring __user *ring  = (void __user *)ctx_id;
@@ -1120,6 +1207,12 @@ static void aio_complete(struct kiocb *kiocb, long res, long res2)
 		spin_unlock_irqrestore(&ctx->ctx_lock, flags);
 	}
 
+	if (!list_empty(&iocb->ki_poll_list)) {
+		spin_lock_irqsave(&ctx->poll_lock, flags);
+		list_del_init(&iocb->ki_poll_list);
+		spin_unlock_irqrestore(&ctx->poll_lock, flags);
+	}
+
 	/*
 	 * Add a completion event to the ring buffer. Must be done holding
 	 * ctx->completion_lock to prevent other code from messing with the tail
@@ -1177,7 +1270,7 @@ static void aio_complete(struct kiocb *kiocb, long res, long res2)
 		eventfd_signal(iocb->ki_eventfd, 1);
 
 	/* everything turned out well, dispose of the aiocb. */
-	kiocb_free(iocb);
+	iocb_put(iocb);
 
 	/*
 	 * We have to order our ring_info tail store above and test
@@ -1295,6 +1388,78 @@ static bool aio_read_events(struct kioctx *ctx, long min_nr, long nr,
 	return ret < 0 || *i >= min_nr;
 }
 
+/* aio_iopoll
+ *	Poll the device backing the oldest polled iocb of the context once,
+ *	completing it (and whatever else shares its queue) if it has
+ *	finished.  Returns false if there was nothing to poll, or if the
+ *	device could not be polled or found nothing, in which case the
+ *	caller should rather sleep until the completion interrupt.
+ */
+static bool aio_iopoll(struct kioctx *ctx)
+{
+	struct aio_kiocb *iocb;
+	bool polled;
+
+	spin_lock_irq(&ctx->poll_lock);
+	iocb = list_first_entry_or_null(&ctx->poll_submitted,
+					struct aio_kiocb, ki_poll_list);
+	if (!iocb) {
+		spin_unlock_irq(&ctx->poll_lock);
+		return false;
+	}
+	/*
+	 * Rotate the list so that a request that hasn't been given a cookie
+	 * yet doesn't keep us from polling the ones behind it, and pin the
+	 * iocb (and through it the file) while the lock is dropped.
+	 */
+	list_move_tail(&iocb->ki_poll_list, &ctx->poll_submitted);
+	refcount_inc(&iocb->ki_refcnt);
+	spin_unlock_irq(&ctx->poll_lock);
+
+	polled = iocb->common.ki_filp->f_op->iopoll(&iocb->common);
+
+	iocb_put(iocb);
+	return polled;
+}
+
+/* aio_poll_events
+ *	Busy poll for completions of polled iocbs, reaping them from the
+ *	ring as they arrive.  Returns true if read_events() is done, false
+ *	if it should go on to wait for interrupt driven completions for the
+ *	remainder of *until.
+ */
+static bool aio_poll_events(struct kioctx *ctx, long min_nr, long nr,
+			    struct io_event __user *event, long *i,
+			    ktime_t *until)
+{
+	ktime_t deadline = ktime_add_safe(ktime_get(), *until);
+	ktime_t now;
+
+	/*
+	 * min_nr == 0 is a non-blocking reap, which is also how users that
+	 * consume events straight from the mmapped ring drive completion
+	 * of their polled requests: give the device a single kick.
+	 */
+	if (!min_nr)
+		aio_iopoll(ctx);
+
+	while (!aio_read_events(ctx, min_nr, nr, event, i)) {
+		if (!aio_iopoll(ctx) || !*until)
+			return false;
+		if (signal_pending(current))
+			return true;
+		cond_resched();
+
+		if (*until == KTIME_MAX)
+			continue;
+		now = ktime_get();
+		if (ktime_after(now, deadline))
+			return true;
+		*until = ktime_sub(deadline, now);
+	}
+	return true;
+}
+
 static long read_events(struct kioctx *ctx, long min_nr, long nr,
 			struct io_event __user *event,
 			struct timespec __user *timeout)
@@ -1324,14 +1489,21 @@ static long read_events(struct kioctx *ctx, long min_nr, long nr,
 	 * will only happen if the mutex_lock() call blocks, and we then find
 	 * the ringbuffer empty. So in practice we should be ok, but it's
 	 * something to be aware of when touching this code.
+	 *
+	 * If there are polled requests in flight, we busy poll their devices
+	 * rather than wait for the completion interrupt.
 	 */
+	if (!list_empty_careful(&ctx->poll_submitted) &&
+	    aio_poll_events(ctx, min_nr, nr, event, &ret, &until))
+		goto out;
+
 	if (until == 0)
 		aio_read_events(ctx, min_nr, nr, event, &ret);
 	else
 		wait_event_interruptible_hrtimeout(ctx->wait,
 				aio_read_events(ctx, min_nr, nr, event, &ret),
 				until);
-
+out:
 	if (!ret && signal_pending(current))
 		ret = -EINTR;
 
@@ -1546,9 +1718,11 @@ static ssize_t aio_write(struct kiocb *req, struct iocb *iocb, bool vectored,
 	return ret;
 }
 
-static int io_submit_one(struct kioctx *ctx, struct iocb __user *user_iocb,
-			 struct iocb *iocb, bool compat)
+static int io_submit_one(struct aio_submit_state *state,
+			 struct iocb __user *user_iocb, struct iocb *iocb,
+			 bool compat)
 {
+	struct kioctx *ctx = state->ctx;
 	struct aio_kiocb *req;
 	struct file *file;
 	ssize_t ret;
@@ -1569,7 +1743,7 @@ static int io_submit_one(struct kioctx *ctx, struct iocb __user *user_iocb,
 		return -EINVAL;
 	}
 
-	req = aio_get_req(ctx);
+	req = aio_get_req(state);
 	if (unlikely(!req))
 		return -EAGAIN;
 
@@ -1615,6 +1789,19 @@ static int io_submit_one(struct kioctx *ctx, struct iocb __user *user_iocb,
 	req->ki_user_iocb = user_iocb;
 	req->ki_user_data = iocb->aio_data;
 
+	/*
+	 * Polled requests are put on the context's poll list before they
+	 * are issued, so that io_getevents() can find them as soon as the
+	 * driver has handed out a cookie.  Files that cannot be polled just
+	 * see IOCB_HIPRI as a hint, as they do for preadv2().
+	 */
+	if ((req->common.ki_flags & IOCB_HIPRI) && file->f_op->iopoll) {
+		req->common.ki_cookie = BLK_QC_T_NONE;
+		spin_lock_irq(&ctx->poll_lock);
+		list_add_tail(&req->ki_poll_list, &ctx->poll_submitted);
+		spin_unlock_irq(&ctx->poll_lock);
+	}
+
 	get_file(file);
 	switch (iocb->aio_lio_opcode) {
 	case IOCB_CMD_PREAD:
@@ -1637,12 +1824,21 @@ static int io_submit_one(struct kioctx *ctx, struct iocb __user *user_iocb,
 	fput(file);
 
 	if (ret && ret != -EIOCBQUEUED)
-		goto out_put_req;
+		goto out_del_poll;
+	iocb_put(req);
 	return 0;
+out_del_poll:
+	if (!list_empty(&req->ki_poll_list)) {
+		spin_lock_irq(&ctx->poll_lock);
+		list_del(&req->ki_poll_list);
+		spin_unlock_irq(&ctx->poll_lock);
+	}
 out_put_req:
 	put_reqs_available(ctx, 1);
 	percpu_ref_put(&ctx->reqs);
-	kiocb_free(req);
+	/* drop both the submission and the never-to-come completion refs */
+	if (refcount_sub_and_test(2, &req->ki_refcnt))
+		kiocb_free(req);
 	return ret;
 }
 
@@ -1652,7 +1848,7 @@ static long do_io_submit(aio_context_t ctx_id, long nr,
 	struct kioctx *ctx;
 	long ret = 0;
 	int i = 0;
-	struct blk_plug plug;
+	struct aio_submit_state state;
 
 	if (unlikely(nr < 0))
 		return -EINVAL;
@@ -1669,7 +1865,7 @@ static long do_io_submit(aio_context_t ctx_id, long nr,
 		return -EINVAL;
 	}
 
-	blk_start_plug(&plug);
+	aio_submit_state_start(&state, ctx, nr);
 
 	/*
 	 * AKPM: should this return a partial result if some of the IOs were
@@ -1689,11 +1885,12 @@ static long do_io_submit(aio_context_t ctx_id, long nr,
 			break;
 		}
 
-		ret = io_submit_one(ctx, user_iocb, &tmp, compat);
+		state.to_submit = min_t(long, nr - i, UINT_MAX);
+		ret = io_submit_one(&state, user_iocb, &tmp, compat);
 		if (ret)
 			break;
 	}
-	blk_finish_plug(&plug);
+	aio_submit_state_end(&state);
 
 	percpu_ref_put(&ctx->users);
 	return i ? i : ret;
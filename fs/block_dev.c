@@ -405,8 +405,16 @@ __blkdev_direct_IO(struct kiocb *iocb, struct iov_iter *iter, int nr_pages)
 	}
 	blk_finish_plug(&plug);
 
-	if (!is_sync)
+	if (!is_sync) {
+		/*
+		 * The aio core holds a reference to the iocb across submission,
+		 * so it is safe to publish the cookie even if the bio has
+		 * already completed.
+		 */
+		if (iocb->ki_flags & IOCB_HIPRI)
+			WRITE_ONCE(iocb->ki_cookie, qc);
 		return -EIOCBQUEUED;
+	}
 
 	for (;;) {
 		set_current_state(TASK_UNINTERRUPTIBLE);
@@ -1872,6 +1880,17 @@ static long block_ioctl(struct file *file, unsigned cmd, unsigned long arg)
 	return blkdev_ioctl(bdev, mode, cmd, arg);
 }
 
+/*
+ * Poll for completion of the last bio submitted for a high priority
+ * asynchronous direct I/O.  Used by the aio core to reap polled iocbs.
+ */
+static bool blkdev_iopoll(struct kiocb *kiocb)
+{
+	struct block_device *bdev = I_BDEV(bdev_file_inode(kiocb->ki_filp));
+
+	return blk_mq_poll(bdev_get_queue(bdev), READ_ONCE(kiocb->ki_cookie));
+}
+
 /*
  * Write data to the block device.  Only intended for the block device itself
  * and the raw driver which basically is a fake block device.
@@ -2038,6 +2057,7 @@ const struct file_operations def_blk_fops = {
 	.llseek		= block_llseek,
 	.read_iter	= blkdev_read_iter,
 	.write_iter	= blkdev_write_iter,
+	.iopoll		= blkdev_iopoll,
 	.mmap		= generic_file_mmap,
 	.fsync		= blkdev_fsync,
 	.unlocked_ioctl	= block_ioctl,
@@ -836,6 +836,8 @@ void nfsd_put_raparams(struct file *file, struct raparms *ra)
 
 	spin_lock(&rab->pb_lock);
 	ra->p_ra = file->f_ra;
+	/* freed along with @file, the next file starts without */
+	ra->p_ra.strides = NULL;
 	ra->p_set = 1;
 	ra->p_count--;
 	spin_unlock(&rab->pb_lock);
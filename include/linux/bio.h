@@ -295,6 +295,12 @@ static inline void bio_get_last_bvec(struct bio *bio, struct bio_vec *bv)
 		return;
 	}
 
+	/* blk_queue_split() already walked the vector for us */
+	if (bio_flagged(bio, BIO_SEG_LAST_VALID)) {
+		*bv = bio->bi_seg_last_bvec;
+		return;
+	}
+
 	bio_advance_iter(bio, &iter, iter.bi_size);
 
 	if (!iter.bi_bvec_done)
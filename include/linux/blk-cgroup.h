@@ -359,6 +359,19 @@ static inline void blkg_get(struct blkcg_gq *blkg)
 	atomic_inc(&blkg->refcnt);
 }
 
+/**
+ * blkg_tryget - try and get a blkg reference
+ * @blkg: blkg to get
+ *
+ * This is for use when doing an RCU lookup of the blkg.  We may be in the
+ * midst of freeing this blkg, so we can only use it if the refcnt is not
+ * zero.
+ */
+static inline bool blkg_tryget(struct blkcg_gq *blkg)
+{
+	return atomic_inc_not_zero(&blkg->refcnt);
+}
+
 void __blkg_release_rcu(struct rcu_head *rcu);
 
 /**
@@ -72,6 +72,13 @@ struct bio {
 	unsigned int		bi_seg_front_size;
 	unsigned int		bi_seg_back_size;
 
+	/*
+	 * Last bvec seen when counting segments, valid while
+	 * BIO_SEG_LAST_VALID is set. Saves walking the vector again to
+	 * check merges against the end of this bio.
+	 */
+	struct bio_vec		bi_seg_last_bvec;
+
 	struct bvec_iter	bi_iter;
 
 	atomic_t		__bi_remaining;
@@ -135,6 +142,7 @@ struct bio {
 				 * throttling rules. Don't do it again. */
 #define BIO_TRACE_COMPLETION 10	/* bio_endio() should trace the final completion
 				 * of this bio. */
+#define BIO_SEG_LAST_VALID 11	/* bi_seg_last_bvec valid */
 /* See BVEC_POOL_OFFSET below before adding new flags */
 
 /*
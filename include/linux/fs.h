@@ -299,6 +299,7 @@ struct kiocb {
 	void			*private;
 	int			ki_flags;
 	enum rw_hint		ki_hint;
+	unsigned int		ki_cookie;	/* for ->iopoll */
 } __randomize_layout;
 
 static inline bool is_sync_kiocb(struct kiocb *kiocb)
@@ -826,6 +827,32 @@ struct fown_struct {
 	int signum;		/* posix.1b rt signal to be delivered on IO */
 };
 
+/*
+ * A stream of same-sized reads a constant stride apart, detected among the
+ * random reads of a file.  Concurrent readers of the file update streams
+ * without locking, so users must cope with any of the fields changing.
+ */
+struct ra_stream {
+	pgoff_t start;			/* last read of the stream seen */
+	unsigned int stride;		/* pages between reads, 0: unused */
+	unsigned int size;		/* pages per read */
+	unsigned char ahead;		/* reads read ahead past start */
+};
+
+#define RA_NR_STREAMS	4		/* strided streams per file */
+#define RA_NR_HISTORY	8		/* random reads to detect them */
+
+/*
+ * Strided stream state of a file, allocated on its first small random read.
+ */
+struct ra_strides {
+	struct ra_stream streams[RA_NR_STREAMS]; /* most recently used first */
+	pgoff_t history[RA_NR_HISTORY];	/* recent random reads */
+	unsigned int history_next;
+	unsigned int hits;		/* reads served by stride readahead */
+	unsigned int misses;		/* reads on a stride that missed */
+};
+
 /*
  * Track a single file's readahead state
  */
@@ -838,6 +865,7 @@ struct file_ra_state {
 	unsigned int ra_pages;		/* Maximum readahead window */
 	unsigned int mmap_miss;		/* Cache miss stat for mmap accesses */
 	loff_t prev_pos;		/* Cache last read() position */
+	struct ra_strides *strides;	/* Strided streams, or NULL */
 };
 
 /*
@@ -1696,6 +1724,7 @@ struct file_operations {
 	ssize_t (*write) (struct file *, const char __user *, size_t, loff_t *);
 	ssize_t (*read_iter) (struct kiocb *, struct iov_iter *);
 	ssize_t (*write_iter) (struct kiocb *, struct iov_iter *);
+	bool (*iopoll) (struct kiocb *);
 	int (*iterate) (struct file *, struct dir_context *);
 	int (*iterate_shared) (struct file *, struct dir_context *);
 	unsigned int (*poll) (struct file *, struct poll_table_struct *);
@@ -2941,6 +2970,7 @@ extern long do_splice_direct(struct file *in, loff_t *ppos, struct file *out,
 
 extern void
 file_ra_state_init(struct file_ra_state *ra, struct address_space *mapping);
+extern void file_ra_state_free(struct file_ra_state *ra);
 extern loff_t noop_llseek(struct file *file, loff_t offset, int whence);
 extern loff_t no_llseek(struct file *file, loff_t offset, int whence);
 extern loff_t vfs_setpos(struct file *file, loff_t offset, loff_t maxsize);
@@ -181,6 +181,10 @@ struct mem_cgroup {
 	/* Range enforcement for interrupt charges */
 	struct work_struct high_work;
 
+	/* Deferred threshold and soft limit tree updates */
+	struct work_struct event_work;
+	nodemask_t softlimit_nodes;
+
 	unsigned long soft_limit;
 
 	/* vmpressure notifications */
@@ -55,6 +55,9 @@ struct mempolicy {
 		nodemask_t cpuset_mems_allowed;	/* relative to these nodes */
 		nodemask_t user_nodemask;	/* nodemask passed by user */
 	} w;
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	struct rcu_head rcu;	/* deferred free, see vma_mpol_put() */
+#endif
 };
 
 /*
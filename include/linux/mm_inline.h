@@ -3,6 +3,7 @@
 #define LINUX_MM_INLINE_H
 
 #include <linux/huge_mm.h>
+#include <linux/jump_label.h>
 #include <linux/swap.h>
 
 /**
@@ -44,9 +45,179 @@ static __always_inline void update_lru_size(struct lruvec *lruvec,
 #endif
 }
 
+#ifdef CONFIG_LRU_GEN
+
+DECLARE_STATIC_KEY_FALSE(lru_gen_key);
+
+static inline bool lru_gen_enabled(void)
+{
+	return static_branch_unlikely(&lru_gen_key);
+}
+
+static inline int lru_gen_from_seq(unsigned long seq)
+{
+	return seq % MAX_NR_GENS;
+}
+
+/* Returns the generation @page is on, or -1 if it is not on a gen list */
+static inline int page_lru_gen(struct page *page)
+{
+	return ((READ_ONCE(page->flags) & LRU_GEN_MASK) >> LRU_GEN_PGSHIFT) - 1;
+}
+
+static inline bool lru_gen_is_active(struct lruvec *lruvec, int gen)
+{
+	unsigned long max_seq = lruvec->lrugen.max_seq;
+
+	return gen == lru_gen_from_seq(max_seq) ||
+	       gen == lru_gen_from_seq(max_seq - 1);
+}
+
+/*
+ * Moves @page to generation @gen in page->flags, -1 meaning off the gen
+ * lists, and returns the generation it was on.  Other page flags can be
+ * changed concurrently, so this has to be a cmpxchg loop even though the
+ * generation itself is only ever changed under the lru_lock.
+ */
+static inline int page_set_lru_gen(struct page *page, int gen,
+				   unsigned long set_flags)
+{
+	unsigned long old_flags, new_flags;
+
+	do {
+		old_flags = READ_ONCE(page->flags);
+		new_flags = (old_flags & ~LRU_GEN_MASK) | set_flags |
+			    ((gen + 1UL) << LRU_GEN_PGSHIFT);
+	} while (cmpxchg(&page->flags, old_flags, new_flags) != old_flags);
+
+	return ((old_flags & LRU_GEN_MASK) >> LRU_GEN_PGSHIFT) - 1;
+}
+
+static inline void lru_gen_update_size(struct lruvec *lruvec, int type,
+				       int zone, int gen, int nr_pages)
+{
+	enum lru_list lru = type * LRU_FILE;
+
+	lruvec->lrugen.nr_pages[gen][type][zone] += nr_pages;
+	__update_lru_size(lruvec, lru + lru_gen_is_active(lruvec, gen) *
+			  LRU_ACTIVE, zone, nr_pages);
+#ifdef CONFIG_MEMCG
+	mem_cgroup_update_lru_size(lruvec, lru, zone, nr_pages);
+#endif
+}
+
+static inline bool lru_gen_add_page(struct lruvec *lruvec, struct page *page,
+				    bool reclaiming)
+{
+	struct lru_gen_struct *lrugen = &lruvec->lrugen;
+	int type = page_is_file_cache(page);
+	int zone = page_zonenum(page);
+	unsigned long seq;
+	int gen, old_gen;
+
+	if (!lru_gen_enabled() || PageUnevictable(page))
+		return false;
+
+	/*
+	 * Pages that were activated, i.e. found accessed by the aging, used
+	 * more than once or refaulting soon after eviction, go to the
+	 * youngest generation.  Pages rotated by reclaim go to the oldest
+	 * one so they are looked at again first, and everything else
+	 * starts out in the second oldest generation.
+	 */
+	if (PageActive(page))
+		seq = lrugen->max_seq;
+	else if (reclaiming)
+		seq = lrugen->min_seq[type];
+	else
+		seq = lrugen->min_seq[type] + 1;
+
+	gen = lru_gen_from_seq(seq);
+	old_gen = page_set_lru_gen(page, gen, 0);
+	VM_BUG_ON_PAGE(old_gen >= 0, page);
+	ClearPageActive(page);
+
+	lru_gen_update_size(lruvec, type, zone, gen, hpage_nr_pages(page));
+	if (reclaiming)
+		list_add_tail(&page->lru, &lrugen->lists[gen][type][zone]);
+	else
+		list_add(&page->lru, &lrugen->lists[gen][type][zone]);
+
+	return true;
+}
+
+static inline bool lru_gen_del_page(struct lruvec *lruvec, struct page *page,
+				    bool reclaiming)
+{
+	unsigned long set_flags = 0;
+	int gen = page_lru_gen(page);
+
+	if (gen < 0)
+		return false;
+
+	/*
+	 * Pages taken off the two youngest generations other than by reclaim,
+	 * e.g. for migration, keep being active until they are put back.
+	 */
+	if (!reclaiming && lru_gen_is_active(lruvec, gen))
+		set_flags = BIT(PG_active);
+	page_set_lru_gen(page, -1, set_flags);
+
+	lru_gen_update_size(lruvec, page_is_file_cache(page), page_zonenum(page),
+			    gen, -hpage_nr_pages(page));
+	list_del(&page->lru);
+
+	return true;
+}
+
+/*
+ * A THP on a generation list is being split and @page_tail is put next to
+ * @page, its head, on the same list, so it joins the head's generation.
+ * The generation and memcg lru sizes still count the whole THP against the
+ * head.  They stay right as they are, since each subpage now leaves the
+ * generation on its own and subtracts one page.
+ */
+static inline void lru_gen_add_page_tail(struct page *page,
+					 struct page *page_tail)
+{
+	int gen = page_lru_gen(page);
+
+	if (gen >= 0)
+		page_set_lru_gen(page_tail, gen, 0);
+}
+
+#else /* !CONFIG_LRU_GEN */
+
+static inline bool lru_gen_enabled(void)
+{
+	return false;
+}
+
+static inline bool lru_gen_add_page(struct lruvec *lruvec, struct page *page,
+				    bool reclaiming)
+{
+	return false;
+}
+
+static inline bool lru_gen_del_page(struct lruvec *lruvec, struct page *page,
+				    bool reclaiming)
+{
+	return false;
+}
+
+static inline void lru_gen_add_page_tail(struct page *page,
+					 struct page *page_tail)
+{
+}
+
+#endif /* CONFIG_LRU_GEN */
+
 static __always_inline void add_page_to_lru_list(struct page *page,
 				struct lruvec *lruvec, enum lru_list lru)
 {
+	if (lru_gen_add_page(lruvec, page, false))
+		return;
+
 	update_lru_size(lruvec, lru, page_zonenum(page), hpage_nr_pages(page));
 	list_add(&page->lru, &lruvec->lists[lru]);
 }
@@ -54,6 +225,9 @@ static __always_inline void add_page_to_lru_list(struct page *page,
 static __always_inline void add_page_to_lru_list_tail(struct page *page,
 				struct lruvec *lruvec, enum lru_list lru)
 {
+	if (lru_gen_add_page(lruvec, page, true))
+		return;
+
 	update_lru_size(lruvec, lru, page_zonenum(page), hpage_nr_pages(page));
 	list_add_tail(&page->lru, &lruvec->lists[lru]);
 }
@@ -61,6 +235,9 @@ static __always_inline void add_page_to_lru_list_tail(struct page *page,
 static __always_inline void del_page_from_lru_list(struct page *page,
 				struct lruvec *lruvec, enum lru_list lru)
 {
+	if (lru_gen_del_page(lruvec, page, false))
+		return;
+
 	list_del(&page->lru);
 	update_lru_size(lruvec, lru, page_zonenum(page), -hpage_nr_pages(page));
 }
@@ -232,6 +232,44 @@ struct zone_reclaim_stat {
 	unsigned long		recent_scanned[2];
 };
 
+#ifdef CONFIG_LRU_GEN
+/*
+ * The multi-generational LRU sorts evictable pages into generations by
+ * when they were last found accessed, instead of onto the active and
+ * inactive lists.  Generation numbers (seq) only ever grow: the aging
+ * creates a new youngest generation by incrementing max_seq, and the
+ * eviction retires the oldest one by incrementing min_seq once it has
+ * been emptied.  Anon and file pages are aged together but evicted
+ * separately, hence the per-type min_seq.
+ *
+ * A page on a generation list has gen = seq % MAX_NR_GENS, plus one, in
+ * its LRU_GEN_MASK bits of page->flags.  The two youngest generations are
+ * accounted as the active lists in the node and zone lru counters; memcg
+ * lru sizes only track the type and count everything as inactive.
+ */
+#define MIN_NR_GENS		2
+#define MAX_NR_GENS		4
+
+enum {
+	LRU_GEN_ANON,
+	LRU_GEN_FILE,
+	ANON_AND_FILE,
+};
+
+struct lru_gen_struct {
+	/* the aging increments the youngest generation number */
+	unsigned long max_seq;
+	/* the eviction increments the oldest generation numbers */
+	unsigned long min_seq[ANON_AND_FILE];
+	/* the generation lists, indexed by gen, type and zone */
+	struct list_head lists[MAX_NR_GENS][ANON_AND_FILE][MAX_NR_ZONES];
+	/* the sizes of the above lists */
+	unsigned long nr_pages[MAX_NR_GENS][ANON_AND_FILE][MAX_NR_ZONES];
+	/* set while a reclaimer walks page tables for this lruvec */
+	atomic_t walking;
+};
+#endif
+
 struct lruvec {
 	struct list_head		lists[NR_LRU_LISTS];
 	struct zone_reclaim_stat	reclaim_stat;
@@ -239,6 +277,9 @@ struct lruvec {
 	atomic_long_t			inactive_age;
 	/* Refaults at the time of last reclaim cycle */
 	unsigned long			refaults;
+#ifdef CONFIG_LRU_GEN
+	struct lru_gen_struct		lrugen;
+#endif
 #ifdef CONFIG_MEMCG
 	struct pglist_data *pgdat;
 #endif
@@ -270,13 +311,19 @@ enum zone_watermarks {
 #define low_wmark_pages(z) (z->watermark[WMARK_LOW])
 #define high_wmark_pages(z) (z->watermark[WMARK_HIGH])
 
+/*
+ * The pcp-lists hold pages of order 0 to PAGE_ALLOC_COSTLY_ORDER, one list
+ * per migrate type and order.
+ */
+#define NR_PCP_LISTS (MIGRATE_PCPTYPES * (PAGE_ALLOC_COSTLY_ORDER + 1))
+
 struct per_cpu_pages {
-	int count;		/* number of pages in the list */
+	int count;		/* number of base pages in the lists */
 	int high;		/* high watermark, emptying needed */
 	int batch;		/* chunk size for buddy add/remove */
 
-	/* Lists of pages, one per migrate type stored on the pcp-lists */
-	struct list_head lists[MIGRATE_PCPTYPES];
+	/* Lists of pages, one per migrate type and order */
+	struct list_head lists[NR_PCP_LISTS];
 };
 
 struct per_cpu_pageset {
@@ -344,6 +344,22 @@ void sbitmap_queue_resize(struct sbitmap_queue *sbq, unsigned int depth);
  */
 int __sbitmap_queue_get(struct sbitmap_queue *sbq);
 
+/**
+ * __sbitmap_queue_get_batch() - Try to allocate a batch of free bits from a
+ * single word of a &struct sbitmap_queue with preemption already disabled.
+ * @sbq: Bitmap queue to allocate from.
+ * @nr_tags: Number of bits wanted, must be less than BITS_PER_LONG.
+ * @offset: Output parameter; the bit number that bit 0 of the returned mask
+ *          corresponds to.
+ *
+ * Fewer than @nr_tags bits may be returned. Each bit must be freed
+ * with sbitmap_queue_clear() or sbitmap_queue_clear_batch().
+ *
+ * Return: Mask of the allocated bits relative to @offset, 0 if none.
+ */
+unsigned long __sbitmap_queue_get_batch(struct sbitmap_queue *sbq, int nr_tags,
+					unsigned int *offset);
+
 /**
  * __sbitmap_queue_get_shallow() - Try to allocate a free bit from a &struct
  * sbitmap_queue, limiting the depth used from each word, with preemption
@@ -410,6 +426,23 @@ static inline int sbitmap_queue_get_shallow(struct sbitmap_queue *sbq,
 void sbitmap_queue_clear(struct sbitmap_queue *sbq, unsigned int nr,
 			 unsigned int cpu);
 
+/**
+ * sbitmap_queue_clear_batch() - Free a batch of allocated bits and wake up
+ * waiters on a &struct sbitmap_queue.
+ * @sbq: Bitmap to free from.
+ * @nrs: Bit numbers to free. Bits in the same word should be adjacent in the
+ *       array, as each run of them is cleared with a single atomic operation.
+ * @nr_bits: Number of entries in @nrs.
+ * @cpu: CPU to record the allocation hint on.
+ *
+ * Waiters are woken up as if each bit had been freed with
+ * sbitmap_queue_clear(), but the wait queues are only scanned once when
+ * nobody is waiting.
+ */
+void sbitmap_queue_clear_batch(struct sbitmap_queue *sbq,
+			       const unsigned int *nrs, int nr_bits,
+			       unsigned int cpu);
+
 static inline int sbq_index_inc(int index)
 {
 	return (index + 1) & (SBQ_WAIT_QUEUES - 1);
@@ -101,6 +101,13 @@
 #define SLAB_KASAN		0x00000000UL
 #endif
 
+/* Keep a per cpu array of objects in front of the slabs */
+#ifdef CONFIG_SLUB
+# define SLAB_PCPU_ARRAY	0x10000000UL
+#else
+# define SLAB_PCPU_ARRAY	0x00000000UL
+#endif
+
 /* The following flags affect the page allocator grouping pages by mobility */
 #define SLAB_RECLAIM_ACCOUNT	0x00020000UL		/* Objects are reclaimable */
 #define SLAB_TEMPORARY		SLAB_RECLAIM_ACCOUNT	/* Objects are short-lived */
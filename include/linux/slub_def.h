@@ -36,6 +36,10 @@ enum stat_item {
 	CPU_PARTIAL_FREE,	/* Refill cpu partial on free */
 	CPU_PARTIAL_NODE,	/* Refill cpu partial from node partial */
 	CPU_PARTIAL_DRAIN,	/* Drain cpu partial to node partial */
+	ALLOC_PCPU_ARRAY,	/* Allocation from the per cpu array */
+	ALLOC_PCPU_ARRAY_REFILL,/* Bulk refill of an empty per cpu array */
+	FREE_PCPU_ARRAY,	/* Free to the per cpu array */
+	FREE_PCPU_ARRAY_FLUSH,	/* Bulk flush of a full per cpu array */
 	NR_SLUB_STAT_ITEMS };
 
 struct kmem_cache_cpu {
@@ -50,6 +54,15 @@ struct kmem_cache_cpu {
 #endif
 };
 
+/*
+ * Optional stack of objects in front of the cpu slab, for caches created
+ * with SLAB_PCPU_ARRAY. Only touched with interrupts disabled.
+ */
+struct slub_percpu_array {
+	unsigned int count;	/* Number of objects in the array */
+	void *objects[];
+};
+
 #ifdef CONFIG_SLUB_CPU_PARTIAL
 #define slub_percpu_partial(c)		((c)->partial)
 
@@ -90,6 +103,10 @@ struct kmem_cache {
 #ifdef CONFIG_SLUB_CPU_PARTIAL
 	int cpu_partial;	/* Number of per cpu partial objects to keep around */
 #endif
+	struct slub_percpu_array __percpu *cpu_array;
+	/* SLAB_PCPU_ARRAY: objects kept per cpu, and moved per refill/flush */
+	unsigned int cpu_array_size;
+	unsigned int cpu_array_batch;
 	struct kmem_cache_order_objects oo;
 
 	/* Allocation and freeing of slabs */
@@ -0,0 +1,65 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM readahead
+
+#if !defined(_TRACE_READAHEAD_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_READAHEAD_H
+
+#include <linux/types.h>
+#include <linux/tracepoint.h>
+#include <linux/fs.h>
+#include <linux/kdev_t.h>
+#include <linux/math64.h>
+
+TRACE_EVENT(mm_readahead_stride,
+
+	TP_PROTO(struct address_space *mapping, struct ra_strides *st,
+		 struct ra_stream *rs, bool hit_marker, unsigned long nr_pages),
+
+	TP_ARGS(mapping, st, rs, hit_marker, nr_pages),
+
+	TP_STRUCT__entry(
+		__field(unsigned long, i_ino)
+		__field(dev_t, s_dev)
+		__field(unsigned long, index)
+		__field(unsigned int, stride)
+		__field(unsigned int, size)
+		__field(unsigned int, ahead)
+		__field(bool, hit_marker)
+		__field(unsigned long, nr_pages)
+		__field(unsigned int, hits)
+		__field(unsigned int, misses)
+		__field(unsigned int, hit_ratio)
+	),
+
+	TP_fast_assign(
+		__entry->i_ino = mapping->host->i_ino;
+		if (mapping->host->i_sb)
+			__entry->s_dev = mapping->host->i_sb->s_dev;
+		else
+			__entry->s_dev = mapping->host->i_rdev;
+		__entry->index = rs->start;
+		__entry->stride = rs->stride;
+		__entry->size = rs->size;
+		__entry->ahead = rs->ahead;
+		__entry->hit_marker = hit_marker;
+		__entry->nr_pages = nr_pages;
+		__entry->hits = st->hits;
+		__entry->misses = st->misses;
+		__entry->hit_ratio = st->hits + st->misses ?
+			div_u64((u64)st->hits * 100, st->hits + st->misses) : 0;
+	),
+
+	TP_printk("dev=%d:%d ino=%lx index=%lu stride=%u size=%u ahead=%u %s nr_pages=%lu hits=%u misses=%u hit_ratio=%u%%",
+		MAJOR(__entry->s_dev), MINOR(__entry->s_dev),
+		__entry->i_ino, __entry->index, __entry->stride,
+		__entry->size, __entry->ahead,
+		__entry->hit_marker ? "async" : "sync",
+		__entry->nr_pages, __entry->hits, __entry->misses,
+		__entry->hit_ratio)
+);
+
+#endif /* _TRACE_READAHEAD_H */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
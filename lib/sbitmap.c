@@ -374,6 +374,59 @@ int __sbitmap_queue_get(struct sbitmap_queue *sbq)
 }
 EXPORT_SYMBOL_GPL(__sbitmap_queue_get);
 
+unsigned long __sbitmap_queue_get_batch(struct sbitmap_queue *sbq, int nr_tags,
+					unsigned int *offset)
+{
+	struct sbitmap *sb = &sbq->sb;
+	unsigned int hint, depth, index, i;
+
+	if (unlikely(sbq->round_robin))
+		return 0;
+
+	hint = this_cpu_read(*sbq->alloc_hint);
+	depth = READ_ONCE(sb->depth);
+	if (unlikely(hint >= depth)) {
+		hint = depth ? prandom_u32() % depth : 0;
+		this_cpu_write(*sbq->alloc_hint, hint);
+	}
+	index = SB_NR_TO_INDEX(sb, hint);
+
+	for (i = 0; i < sb->map_nr; i++) {
+		struct sbitmap_word *map = &sb->map[index];
+		unsigned long get_mask, val, old;
+		unsigned int nr;
+
+		nr = find_first_zero_bit(&map->word, map->depth);
+		if (nr + nr_tags <= map->depth) {
+			/*
+			 * Grab the whole run in one atomic operation. Bits that
+			 * raced with another allocator are simply not ours.
+			 */
+			get_mask = ((1UL << nr_tags) - 1) << nr;
+			val = READ_ONCE(map->word);
+			while ((old = cmpxchg(&map->word, val,
+					      val | get_mask)) != val)
+				val = old;
+			get_mask &= ~val;
+			if (get_mask) {
+				*offset = nr + (index << sb->shift);
+				hint = *offset + nr_tags;
+				if (hint >= depth - 1)
+					hint = 0;
+				this_cpu_write(*sbq->alloc_hint, hint);
+				return get_mask >> nr;
+			}
+		}
+
+		/* Jump to next index. */
+		if (++index >= sb->map_nr)
+			index = 0;
+	}
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(__sbitmap_queue_get_batch);
+
 int __sbitmap_queue_get_shallow(struct sbitmap_queue *sbq,
 				unsigned int shallow_depth)
 {
@@ -476,6 +529,71 @@ void sbitmap_queue_clear(struct sbitmap_queue *sbq, unsigned int nr,
 }
 EXPORT_SYMBOL_GPL(sbitmap_queue_clear);
 
+/*
+ * Like sbq_wake_up() for @nr freed bits at once. Bits left over after a wait
+ * queue's batch is used up are credited to the next one, as they would have
+ * been had the bits been freed one at a time.
+ */
+static void sbq_wake_up_nr(struct sbitmap_queue *sbq, unsigned int nr)
+{
+	struct sbq_wait_state *ws;
+	unsigned int wake_batch;
+	int wait_cnt, i;
+
+	/* See sbq_wake_up(). */
+	smp_mb__after_atomic();
+
+	for (i = 0; nr && i < SBQ_WAIT_QUEUES; i++) {
+		ws = sbq_wake_ptr(sbq);
+		if (!ws)
+			return;
+
+		wait_cnt = atomic_sub_return(nr, &ws->wait_cnt);
+		if (wait_cnt > 0)
+			return;
+
+		nr = min_t(unsigned int, nr, -wait_cnt);
+		wake_batch = READ_ONCE(sbq->wake_batch);
+		smp_mb__before_atomic();
+		atomic_cmpxchg(&ws->wait_cnt, wait_cnt, wake_batch);
+		sbq_index_atomic_inc(&sbq->wake_index);
+		wake_up(&ws->wait);
+	}
+}
+
+void sbitmap_queue_clear_batch(struct sbitmap_queue *sbq,
+			       const unsigned int *nrs, int nr_bits,
+			       unsigned int cpu)
+{
+	struct sbitmap *sb = &sbq->sb;
+	unsigned long *addr = NULL, *this_addr;
+	unsigned long mask = 0;
+	unsigned int last;
+	int i;
+
+	if (!nr_bits)
+		return;
+
+	smp_mb__before_atomic();
+	for (i = 0; i < nr_bits; i++) {
+		this_addr = __sbitmap_word(sb, nrs[i]);
+		if (addr && addr != this_addr) {
+			atomic_long_andnot(mask, (atomic_long_t *)addr);
+			mask = 0;
+		}
+		addr = this_addr;
+		mask |= 1UL << SB_NR_TO_BIT(sb, nrs[i]);
+	}
+	atomic_long_andnot(mask, (atomic_long_t *)addr);
+
+	sbq_wake_up_nr(sbq, nr_bits);
+
+	last = nrs[nr_bits - 1];
+	if (likely(!sbq->round_robin && last < sb->depth))
+		*per_cpu_ptr(sbq->alloc_hint, cpu) = last;
+}
+EXPORT_SYMBOL_GPL(sbitmap_queue_clear_batch);
+
 void sbitmap_queue_wake_all(struct sbitmap_queue *sbq)
 {
 	int i, wake_index;
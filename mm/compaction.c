@@ -1286,6 +1286,95 @@ static inline bool is_via_compact_memory(int order)
 	return order == -1;
 }
 
+/*
+ * Proactive compaction: every HPAGE_FRAG_CHECK_INTERVAL_MSEC, kcompactd
+ * compacts its node in the background once the node's fragmentation score
+ * is above the high watermark that vm.compaction_proactiveness sets, down
+ * to the low one.  A run may use at most vm.compaction_proactive_budget
+ * percent of a cpu over the interval.
+ */
+#if defined CONFIG_TRANSPARENT_HUGEPAGE
+#define COMPACTION_HPAGE_ORDER	HPAGE_PMD_ORDER
+#elif defined CONFIG_HUGETLBFS
+#define COMPACTION_HPAGE_ORDER	HUGETLB_PAGE_ORDER
+#else
+#define COMPACTION_HPAGE_ORDER	(PMD_SHIFT - PAGE_SHIFT)
+#endif
+
+#define HPAGE_FRAG_CHECK_INTERVAL_MSEC	500
+
+int sysctl_compaction_proactiveness __read_mostly = 20;
+int sysctl_compaction_proactive_budget __read_mostly = 10;
+
+/*
+ * A zone's fragmentation score is its external fragmentation for huge
+ * pages: the percentage of its free memory in blocks smaller than a huge
+ * page.  It is in the range [0, 100].
+ */
+static unsigned int fragmentation_score_zone(struct zone *zone)
+{
+	return extfrag_for_order(zone, COMPACTION_HPAGE_ORDER);
+}
+
+/*
+ * A node's fragmentation score is that of its zones, each weighted by its
+ * share of the node's pages.  It is in the range [0, 100].
+ */
+static unsigned int fragmentation_score_node(pg_data_t *pgdat)
+{
+	unsigned long score = 0;
+	int zoneid;
+
+	for (zoneid = 0; zoneid < MAX_NR_ZONES; zoneid++) {
+		struct zone *zone = &pgdat->node_zones[zoneid];
+
+		if (!populated_zone(zone))
+			continue;
+		score += zone->present_pages * fragmentation_score_zone(zone);
+	}
+	return div64_ul(score, pgdat->node_present_pages + 1);
+}
+
+/* The system's score, weighting each node the same way, for /proc/vmstat */
+unsigned int fragmentation_score(void)
+{
+	unsigned long score = 0, pages = 0;
+	pg_data_t *pgdat;
+
+	for_each_online_pgdat(pgdat) {
+		score += pgdat->node_present_pages *
+			 fragmentation_score_node(pgdat);
+		pages += pgdat->node_present_pages;
+	}
+	return div64_ul(score, pages + 1);
+}
+
+static unsigned int fragmentation_score_wmark(bool low)
+{
+	unsigned int wmark_low;
+
+	/*
+	 * Cap the low watermark to avoid excessive compaction activity in
+	 * case the proactiveness tunable is set close to 100 (maximum).
+	 */
+	wmark_low = max(100U - sysctl_compaction_proactiveness, 5U);
+	return low ? wmark_low : min(wmark_low + 10, 100U);
+}
+
+static bool kswapd_is_running(pg_data_t *pgdat)
+{
+	return pgdat->kswapd && (pgdat->kswapd->state == TASK_RUNNING);
+}
+
+static bool should_proactive_compact_node(pg_data_t *pgdat)
+{
+	if (!sysctl_compaction_proactiveness || kswapd_is_running(pgdat))
+		return false;
+
+	return fragmentation_score_node(pgdat) >
+		fragmentation_score_wmark(false);
+}
+
 static enum compact_result __compact_finished(struct zone *zone,
 						struct compact_control *cc)
 {
@@ -1315,6 +1404,18 @@ static enum compact_result __compact_finished(struct zone *zone,
 			return COMPACT_PARTIAL_SKIPPED;
 	}
 
+	if (cc->proactive_compaction) {
+		/* Leave the node to reclaim, or out of cpu budget */
+		if (kswapd_is_running(zone->zone_pgdat) ||
+		    current->se.sum_exec_runtime >= cc->runtime_limit)
+			return COMPACT_PARTIAL_SKIPPED;
+
+		if (fragmentation_score_zone(zone) >
+		    fragmentation_score_wmark(true))
+			return COMPACT_CONTINUE;
+		return COMPACT_SUCCESS;
+	}
+
 	if (is_via_compact_memory(cc->order))
 		return COMPACT_CONTINUE;
 
@@ -1992,6 +2093,57 @@ static void kcompactd_do_work(pg_data_t *pgdat)
 		pgdat->kcompactd_classzone_idx = pgdat->nr_zones - 1;
 }
 
+/*
+ * Compact all zones of the node, not for any particular order, until their
+ * fragmentation scores fall below the low watermark, kswapd starts running
+ * on the node or the run is out of cpu budget.
+ */
+static void proactive_compact_node(pg_data_t *pgdat)
+{
+	u64 budget = div_u64((u64)HPAGE_FRAG_CHECK_INTERVAL_MSEC *
+			     NSEC_PER_MSEC * sysctl_compaction_proactive_budget,
+			     100);
+	int zoneid;
+	struct zone *zone;
+	struct compact_control cc = {
+		.order = -1,
+		.mode = MIGRATE_SYNC_LIGHT,
+		.ignore_skip_hint = false,
+		.gfp_mask = GFP_KERNEL,
+		.classzone_idx = pgdat->nr_zones - 1,
+		.proactive_compaction = true,
+		.runtime_limit = current->se.sum_exec_runtime + budget,
+	};
+
+	count_compact_event(COMPACT_PROACTIVE_RUN);
+
+	for (zoneid = 0; zoneid < MAX_NR_ZONES; zoneid++) {
+		zone = &pgdat->node_zones[zoneid];
+		if (!populated_zone(zone))
+			continue;
+
+		cc.nr_freepages = 0;
+		cc.nr_migratepages = 0;
+		cc.total_migrate_scanned = 0;
+		cc.total_free_scanned = 0;
+		cc.zone = zone;
+		INIT_LIST_HEAD(&cc.freepages);
+		INIT_LIST_HEAD(&cc.migratepages);
+
+		if (kthread_should_stop())
+			return;
+		compact_zone(zone, &cc);
+
+		count_compact_events(COMPACT_PROACTIVE_MIGRATE_SCANNED,
+				     cc.total_migrate_scanned);
+		count_compact_events(COMPACT_PROACTIVE_FREE_SCANNED,
+				     cc.total_free_scanned);
+
+		VM_BUG_ON(!list_empty(&cc.freepages));
+		VM_BUG_ON(!list_empty(&cc.migratepages));
+	}
+}
+
 void wakeup_kcompactd(pg_data_t *pgdat, int order, int classzone_idx)
 {
 	if (!order)
@@ -2026,6 +2178,7 @@ static int kcompactd(void *p)
 {
 	pg_data_t *pgdat = (pg_data_t*)p;
 	struct task_struct *tsk = current;
+	unsigned int proactive_defer = 0;
 
 	const struct cpumask *cpumask = cpumask_of_node(pgdat->node_id);
 
@@ -2038,11 +2191,33 @@ static int kcompactd(void *p)
 	pgdat->kcompactd_classzone_idx = pgdat->nr_zones - 1;
 
 	while (!kthread_should_stop()) {
+		unsigned int prev_score, score;
+
 		trace_mm_compaction_kcompactd_sleep(pgdat->node_id);
-		wait_event_freezable(pgdat->kcompactd_wait,
-				kcompactd_work_requested(pgdat));
+		if (wait_event_freezable_timeout(pgdat->kcompactd_wait,
+			kcompactd_work_requested(pgdat),
+			msecs_to_jiffies(HPAGE_FRAG_CHECK_INTERVAL_MSEC))) {
+			kcompactd_do_work(pgdat);
+			continue;
+		}
 
-		kcompactd_do_work(pgdat);
+		/* Timed out: time to check for proactive compaction */
+		if (!should_proactive_compact_node(pgdat))
+			continue;
+		if (proactive_defer) {
+			proactive_defer--;
+			continue;
+		}
+
+		prev_score = fragmentation_score_node(pgdat);
+		proactive_compact_node(pgdat);
+		score = fragmentation_score_node(pgdat);
+		/*
+		 * Back off for a while if the run made no progress, as the
+		 * remaining fragmentation is likely not movable.
+		 */
+		proactive_defer = score < prev_score ?
+				  0 : 1 << COMPACT_MAX_DEFER_SHIFT;
 	}
 
 	return 0;
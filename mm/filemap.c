@@ -2574,7 +2574,8 @@ void filemap_map_pages(struct vm_fault *vmf,
 		put_page(page);
 next:
 		/* Huge page is mapped? No need to proceed. */
-		if (pmd_trans_huge(*vmf->pmd))
+		if (!(vmf->flags & FAULT_FLAG_SPECULATIVE) &&
+		    pmd_trans_huge(*vmf->pmd))
 			break;
 		if (iter.index == end_pgoff)
 			break;
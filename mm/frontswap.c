@@ -250,6 +250,7 @@ int __frontswap_store(struct page *page)
 	int type = swp_type(entry);
 	struct swap_info_struct *sis = swap_info[type];
 	pgoff_t offset = swp_offset(entry);
+	unsigned int i, nr = hpage_nr_pages(page);
 	struct frontswap_ops *ops;
 
 	VM_BUG_ON(!frontswap_ops);
@@ -262,20 +263,30 @@ int __frontswap_store(struct page *page)
 	 * and we can't rely on the new page replacing the old page as we may
 	 * not store to the same implementation that contains the old page.
 	 */
-	if (__frontswap_test(sis, offset)) {
-		__frontswap_clear(sis, offset);
-		for_each_frontswap_ops(ops)
-			ops->invalidate_page(type, offset);
+	for (i = 0; i < nr; i++) {
+		if (__frontswap_test(sis, offset + i)) {
+			__frontswap_clear(sis, offset + i);
+			for_each_frontswap_ops(ops)
+				ops->invalidate_page(type, offset + i);
+		}
 	}
 
-	/* Try to store in each implementation, until one succeeds. */
+	/*
+	 * Try to store in each implementation, until one succeeds.  A THP
+	 * is written out whole, so it can only go to an implementation that
+	 * takes all of its subpages at once.
+	 */
 	for_each_frontswap_ops(ops) {
-		ret = ops->store(type, offset, page);
+		if (nr == 1)
+			ret = ops->store(type, offset, page);
+		else if (ops->store_pages)
+			ret = ops->store_pages(type, offset, page, nr);
 		if (!ret) /* successful store */
 			break;
 	}
 	if (ret == 0) {
-		__frontswap_set(sis, offset);
+		for (i = 0; i < nr; i++)
+			__frontswap_set(sis, offset + i);
 		inc_frontswap_succ_stores();
 	} else {
 		inc_frontswap_failed_stores();
@@ -14,6 +14,7 @@
 #include <linux/fs.h>
 #include <linux/mm.h>
 #include <linux/pagemap.h>
+#include <linux/srcu.h>
 #include <linux/tracepoint-defs.h>
 
 /*
@@ -43,6 +44,11 @@ int do_swap_page(struct vm_fault *vmf);
 void free_pgtables(struct mmu_gather *tlb, struct vm_area_struct *start_vma,
 		unsigned long floor, unsigned long ceiling);
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+/* Unlinked vmas are freed only after a vma_srcu grace period */
+extern struct srcu_struct vma_srcu;
+#endif
+
 static inline bool can_madv_dontneed_vma(struct vm_area_struct *vma)
 {
 	return !(vma->vm_flags & (VM_LOCKED|VM_HUGETLB|VM_PFNMAP));
@@ -203,6 +209,8 @@ struct compact_control {
 	bool whole_zone;		/* Whole zone should/has been scanned */
 	bool contended;			/* Signal lock or sched contention */
 	bool finishing_block;		/* Finishing current pageblock */
+	bool proactive_compaction;	/* kcompactd proactive compaction */
+	u64 runtime_limit;		/* Proactive: stop at this runtime */
 };
 
 unsigned long
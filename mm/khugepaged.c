@@ -55,8 +55,6 @@ enum scan_result {
 
 /* default scan 8*512 pte (or vmas) every 30 second */
 static unsigned int khugepaged_pages_to_scan __read_mostly;
-static unsigned int khugepaged_pages_collapsed;
-static unsigned int khugepaged_full_scans;
 static unsigned int khugepaged_scan_sleep_millisecs __read_mostly = 10000;
 /* during fragmentation poll the hugepage allocator once every minute */
 static unsigned int khugepaged_alloc_sleep_millisecs __read_mostly = 60000;
@@ -79,13 +77,15 @@ static struct kmem_cache *mm_slot_cache __read_mostly;
 /**
  * struct mm_slot - hash lookup from mm to mm_slot
  * @hash: hash collision list
- * @mm_node: khugepaged scan list headed in khugepaged_scan.mm_head
+ * @mm_node: khugepaged scan list headed in the scan.mm_head of node @nid
  * @mm: the mm that this information is valid for
+ * @nid: the node whose khugepaged scans this mm
  */
 struct mm_slot {
 	struct hlist_node hash;
 	struct list_head mm_node;
 	struct mm_struct *mm;
+	int nid;
 };
 
 /**
@@ -94,7 +94,7 @@ struct mm_slot {
  * @mm_slot: the current mm_slot we are scanning
  * @address: the next address inside that to be scanned
  *
- * There is only the one khugepaged_scan instance of this cursor structure.
+ * There is one khugepaged_scan instance of this cursor structure per node.
  */
 struct khugepaged_scan {
 	struct list_head mm_head;
@@ -102,10 +102,42 @@ struct khugepaged_scan {
 	unsigned long address;
 };
 
-static struct khugepaged_scan khugepaged_scan = {
-	.mm_head = LIST_HEAD_INIT(khugepaged_scan.mm_head),
+/* Window over which the per node collapse rate is taken */
+#define KHUGEPAGED_RATE_WINDOW	(60 * HZ)
+
+/**
+ * struct khugepaged_node - per node khugepaged
+ * @scan: cursor over the mms homed on this node
+ * @thread: the khugepaged thread of this node
+ * @nid: this node
+ * @last_target_node: node the last huge page was allocated from
+ * @pages_collapsed: number of huge pages collapsed by @thread
+ * @full_scans: number of full scans of @scan.mm_head
+ * @window_start: jiffies when the current rate window was opened
+ * @window_collapsed: pages collapsed in the current rate window
+ * @collapse_rate: pages collapsed over the last complete rate window
+ * @node_load: pages found on each node in the range being scanned
+ * @mm_load: pages found on each node so far in the mm under the cursor
+ *
+ * Everything but @scan and the mm_slots on it, which are protected by
+ * khugepaged_mm_lock, is only written by @thread.
+ */
+struct khugepaged_node {
+	struct khugepaged_scan scan;
+	struct task_struct *thread;
+	int nid;
+	int last_target_node;
+	unsigned int pages_collapsed;
+	unsigned int full_scans;
+	unsigned long window_start;
+	unsigned int window_collapsed;
+	unsigned int collapse_rate;
+	int *node_load;
+	int *mm_load;
 };
 
+static struct khugepaged_node *khugepaged_nodes[MAX_NUMNODES] __read_mostly;
+
 #ifdef CONFIG_SYSFS
 static ssize_t scan_sleep_millisecs_show(struct kobject *kobj,
 					 struct kobj_attribute *attr,
@@ -192,7 +224,13 @@ static ssize_t pages_collapsed_show(struct kobject *kobj,
 				    struct kobj_attribute *attr,
 				    char *buf)
 {
-	return sprintf(buf, "%u\n", khugepaged_pages_collapsed);
+	unsigned int pages_collapsed = 0;
+	int nid;
+
+	for_each_node(nid)
+		pages_collapsed +=
+			READ_ONCE(khugepaged_nodes[nid]->pages_collapsed);
+	return sprintf(buf, "%u\n", pages_collapsed);
 }
 static struct kobj_attribute pages_collapsed_attr =
 	__ATTR_RO(pages_collapsed);
@@ -201,7 +239,12 @@ static ssize_t full_scans_show(struct kobject *kobj,
 			       struct kobj_attribute *attr,
 			       char *buf)
 {
-	return sprintf(buf, "%u\n", khugepaged_full_scans);
+	unsigned int full_scans = 0;
+	int nid;
+
+	for_each_node(nid)
+		full_scans += READ_ONCE(khugepaged_nodes[nid]->full_scans);
+	return sprintf(buf, "%u\n", full_scans);
 }
 static struct kobj_attribute full_scans_attr =
 	__ATTR_RO(full_scans);
@@ -342,13 +385,51 @@ int hugepage_madvise(struct vm_area_struct *vma,
 	return 0;
 }
 
+static void __init khugepaged_free_nodes(void)
+{
+	int nid;
+
+	for_each_node(nid) {
+		kfree(khugepaged_nodes[nid]);
+		khugepaged_nodes[nid] = NULL;
+	}
+}
+
+static int __init khugepaged_alloc_nodes(void)
+{
+	struct khugepaged_node *kn;
+	int nid;
+
+	for_each_node(nid) {
+		kn = kzalloc(sizeof(*kn) + 2 * nr_node_ids * sizeof(int),
+			     GFP_KERNEL);
+		if (!kn) {
+			khugepaged_free_nodes();
+			return -ENOMEM;
+		}
+		INIT_LIST_HEAD(&kn->scan.mm_head);
+		kn->nid = nid;
+		kn->last_target_node = NUMA_NO_NODE;
+		kn->window_start = jiffies;
+		kn->node_load = (int *)(kn + 1);
+		kn->mm_load = kn->node_load + nr_node_ids;
+		khugepaged_nodes[nid] = kn;
+	}
+	return 0;
+}
+
 int __init khugepaged_init(void)
 {
+	if (khugepaged_alloc_nodes())
+		return -ENOMEM;
+
 	mm_slot_cache = kmem_cache_create("khugepaged_mm_slot",
 					  sizeof(struct mm_slot),
 					  __alignof__(struct mm_slot), 0, NULL);
-	if (!mm_slot_cache)
+	if (!mm_slot_cache) {
+		khugepaged_free_nodes();
 		return -ENOMEM;
+	}
 
 	khugepaged_pages_to_scan = HPAGE_PMD_NR * 8;
 	khugepaged_max_ptes_none = HPAGE_PMD_NR - 1;
@@ -360,6 +441,8 @@ int __init khugepaged_init(void)
 void __init khugepaged_destroy(void)
 {
 	kmem_cache_destroy(mm_slot_cache);
+	mm_slot_cache = NULL;
+	khugepaged_free_nodes();
 }
 
 static inline struct mm_slot *alloc_mm_slot(void)
@@ -399,6 +482,7 @@ static inline int khugepaged_test_exit(struct mm_struct *mm)
 
 int __khugepaged_enter(struct mm_struct *mm)
 {
+	struct khugepaged_node *kn;
 	struct mm_slot *mm_slot;
 	int wakeup;
 
@@ -413,14 +497,21 @@ int __khugepaged_enter(struct mm_struct *mm)
 		return 0;
 	}
 
+	/*
+	 * Start off with the khugepaged of the node memory is allocated from
+	 * here: that is where the mm's pages most likely are.
+	 */
+	mm_slot->nid = numa_mem_id();
+	kn = khugepaged_nodes[mm_slot->nid];
+
 	spin_lock(&khugepaged_mm_lock);
 	insert_to_mm_slots_hash(mm, mm_slot);
 	/*
 	 * Insert just behind the scanning cursor, to let the area settle
 	 * down a little.
 	 */
-	wakeup = list_empty(&khugepaged_scan.mm_head);
-	list_add_tail(&mm_slot->mm_node, &khugepaged_scan.mm_head);
+	wakeup = list_empty(&kn->scan.mm_head);
+	list_add_tail(&mm_slot->mm_node, &kn->scan.mm_head);
 	spin_unlock(&khugepaged_mm_lock);
 
 	mmgrab(mm);
@@ -457,7 +548,8 @@ void __khugepaged_exit(struct mm_struct *mm)
 
 	spin_lock(&khugepaged_mm_lock);
 	mm_slot = get_mm_slot(mm);
-	if (mm_slot && khugepaged_scan.mm_slot != mm_slot) {
+	if (mm_slot &&
+	    khugepaged_nodes[mm_slot->nid]->scan.mm_slot != mm_slot) {
 		hash_del(&mm_slot->hash);
 		list_del(&mm_slot->mm_node);
 		free = 1;
@@ -607,53 +699,66 @@ static int __collapse_huge_page_isolate(struct vm_area_struct *vma,
 	return 0;
 }
 
+/*
+ * Fill the huge page first, then clear all the ptes under a single ptl
+ * acquisition, and only then release the small pages.
+ */
 static void __collapse_huge_page_copy(pte_t *pte, struct page *page,
 				      struct vm_area_struct *vma,
 				      unsigned long address,
 				      spinlock_t *ptl)
 {
+	struct page *src_page, *tmp;
+	unsigned long _address;
+	LIST_HEAD(pagelist);
+	int nr_none = 0;
 	pte_t *_pte;
-	for (_pte = pte; _pte < pte + HPAGE_PMD_NR;
-				_pte++, page++, address += PAGE_SIZE) {
+
+	for (_pte = pte, _address = address; _pte < pte + HPAGE_PMD_NR;
+				_pte++, page++, _address += PAGE_SIZE) {
 		pte_t pteval = *_pte;
-		struct page *src_page;
 
 		if (pte_none(pteval) || is_zero_pfn(pte_pfn(pteval))) {
-			clear_user_highpage(page, address);
-			add_mm_counter(vma->vm_mm, MM_ANONPAGES, 1);
-			if (is_zero_pfn(pte_pfn(pteval))) {
-				/*
-				 * ptl mostly unnecessary.
-				 */
-				spin_lock(ptl);
-				/*
-				 * paravirt calls inside pte_clear here are
-				 * superfluous.
-				 */
-				pte_clear(vma->vm_mm, address, _pte);
-				spin_unlock(ptl);
-			}
+			clear_user_highpage(page, _address);
+			nr_none++;
 		} else {
-			src_page = pte_page(pteval);
-			copy_user_highpage(page, src_page, address, vma);
-			VM_BUG_ON_PAGE(page_mapcount(src_page) != 1, src_page);
-			release_pte_page(src_page);
-			/*
-			 * ptl mostly unnecessary, but preempt has to
-			 * be disabled to update the per-cpu stats
-			 * inside page_remove_rmap().
-			 */
-			spin_lock(ptl);
-			/*
-			 * paravirt calls inside pte_clear here are
-			 * superfluous.
-			 */
-			pte_clear(vma->vm_mm, address, _pte);
-			page_remove_rmap(src_page, false);
-			spin_unlock(ptl);
-			free_page_and_swap_cache(src_page);
+			copy_user_highpage(page, pte_page(pteval), _address,
+					   vma);
 		}
 	}
+	add_mm_counter(vma->vm_mm, MM_ANONPAGES, nr_none);
+
+	/*
+	 * ptl mostly unnecessary, but preempt has to be disabled to update
+	 * the per-cpu stats inside page_remove_rmap().
+	 */
+	spin_lock(ptl);
+	for (_pte = pte, _address = address; _pte < pte + HPAGE_PMD_NR;
+				_pte++, _address += PAGE_SIZE) {
+		pte_t pteval = *_pte;
+
+		if (pte_none(pteval))
+			continue;
+		/*
+		 * paravirt calls inside pte_clear here are
+		 * superfluous.
+		 */
+		pte_clear(vma->vm_mm, _address, _pte);
+		if (is_zero_pfn(pte_pfn(pteval)))
+			continue;
+		src_page = pte_page(pteval);
+		VM_BUG_ON_PAGE(page_mapcount(src_page) != 1, src_page);
+		page_remove_rmap(src_page, false);
+		/* Isolated from the LRU, so page->lru is ours */
+		list_add_tail(&src_page->lru, &pagelist);
+	}
+	spin_unlock(ptl);
+
+	list_for_each_entry_safe(src_page, tmp, &pagelist, lru) {
+		list_del(&src_page->lru);
+		release_pte_page(src_page);
+		free_page_and_swap_cache(src_page);
+	}
 }
 
 static void khugepaged_alloc_sleep(void)
@@ -666,9 +771,7 @@ static void khugepaged_alloc_sleep(void)
 	remove_wait_queue(&khugepaged_wait, &wait);
 }
 
-static int khugepaged_node_load[MAX_NUMNODES];
-
-static bool khugepaged_scan_abort(int nid)
+static bool khugepaged_scan_abort(struct khugepaged_node *kn, int nid)
 {
 	int i;
 
@@ -680,11 +783,11 @@ static bool khugepaged_scan_abort(int nid)
 		return false;
 
 	/* If there is a count for this node already, it must be acceptable */
-	if (khugepaged_node_load[nid])
+	if (kn->node_load[nid])
 		return false;
 
-	for (i = 0; i < MAX_NUMNODES; i++) {
-		if (!khugepaged_node_load[i])
+	for (i = 0; i < nr_node_ids; i++) {
+		if (!kn->node_load[i])
 			continue;
 		if (node_distance(nid, i) > RECLAIM_DISTANCE)
 			return true;
@@ -699,28 +802,32 @@ static inline gfp_t alloc_hugepage_khugepaged_gfpmask(void)
 }
 
 #ifdef CONFIG_NUMA
-static int khugepaged_find_target_node(void)
+static int khugepaged_find_target_node(struct khugepaged_node *kn)
 {
-	static int last_khugepaged_target_node = NUMA_NO_NODE;
 	int nid, target_node = 0, max_value = 0;
 
 	/* find first node with max normal pages hit */
-	for (nid = 0; nid < MAX_NUMNODES; nid++)
-		if (khugepaged_node_load[nid] > max_value) {
-			max_value = khugepaged_node_load[nid];
+	for (nid = 0; nid < nr_node_ids; nid++)
+		if (kn->node_load[nid] > max_value) {
+			max_value = kn->node_load[nid];
 			target_node = nid;
 		}
 
+	/* our own node wins a tie: the copy is then all local */
+	if (kn->node_load[kn->nid] == max_value) {
+		target_node = kn->nid;
+		goto out;
+	}
+
 	/* do some balance if several nodes have the same hit record */
-	if (target_node <= last_khugepaged_target_node)
-		for (nid = last_khugepaged_target_node + 1; nid < MAX_NUMNODES;
-				nid++)
-			if (max_value == khugepaged_node_load[nid]) {
+	if (target_node <= kn->last_target_node)
+		for (nid = kn->last_target_node + 1; nid < nr_node_ids; nid++)
+			if (max_value == kn->node_load[nid]) {
 				target_node = nid;
 				break;
 			}
-
-	last_khugepaged_target_node = target_node;
+out:
+	kn->last_target_node = target_node;
 	return target_node;
 }
 
@@ -758,7 +865,7 @@ khugepaged_alloc_page(struct page **hpage, gfp_t gfp, int node)
 	return *hpage;
 }
 #else
-static int khugepaged_find_target_node(void)
+static int khugepaged_find_target_node(struct khugepaged_node *kn)
 {
 	return 0;
 }
@@ -925,7 +1032,23 @@ static bool __collapse_huge_page_swapin(struct mm_struct *mm,
 	return true;
 }
 
-static void collapse_huge_page(struct mm_struct *mm,
+static void khugepaged_update_rate(struct khugepaged_node *kn,
+				   unsigned int collapsed)
+{
+	unsigned long now = jiffies;
+
+	kn->window_collapsed += collapsed;
+	if (time_after_eq(now, kn->window_start + KHUGEPAGED_RATE_WINDOW)) {
+		kn->collapse_rate = (u64)kn->window_collapsed *
+				    KHUGEPAGED_RATE_WINDOW /
+				    (now - kn->window_start);
+		kn->window_start = now;
+		kn->window_collapsed = 0;
+	}
+}
+
+static void collapse_huge_page(struct khugepaged_node *kn,
+				   struct mm_struct *mm,
 				   unsigned long address,
 				   struct page **hpage,
 				   int node, int referenced)
@@ -1006,6 +1129,8 @@ static void collapse_huge_page(struct mm_struct *mm,
 	if (mm_find_pmd(mm, address) != pmd)
 		goto out;
 
+	/* Speculative faults must not install ptes while we collapse */
+	vm_write_begin(vma);
 	anon_vma_lock_write(vma->anon_vma);
 
 	pte = pte_offset_map(pmd, address);
@@ -1041,6 +1166,7 @@ static void collapse_huge_page(struct mm_struct *mm,
 		pmd_populate(mm, pmd, pmd_pgtable(_pmd));
 		spin_unlock(pmd_ptl);
 		anon_vma_unlock_write(vma->anon_vma);
+		vm_write_end(vma);
 		result = SCAN_FAIL;
 		goto out;
 	}
@@ -1075,10 +1201,12 @@ static void collapse_huge_page(struct mm_struct *mm,
 	set_pmd_at(mm, address, pmd, _pmd);
 	update_mmu_cache_pmd(vma, address, pmd);
 	spin_unlock(pmd_ptl);
+	vm_write_end(vma);
 
 	*hpage = NULL;
 
-	khugepaged_pages_collapsed++;
+	kn->pages_collapsed++;
+	khugepaged_update_rate(kn, 1);
 	result = SCAN_SUCCEED;
 out_up_write:
 	up_write(&mm->mmap_sem);
@@ -1090,7 +1218,8 @@ static void collapse_huge_page(struct mm_struct *mm,
 	goto out_up_write;
 }
 
-static int khugepaged_scan_pmd(struct mm_struct *mm,
+static int khugepaged_scan_pmd(struct khugepaged_node *kn,
+			       struct mm_struct *mm,
 			       struct vm_area_struct *vma,
 			       unsigned long address,
 			       struct page **hpage)
@@ -1112,7 +1241,7 @@ static int khugepaged_scan_pmd(struct mm_struct *mm,
 		goto out;
 	}
 
-	memset(khugepaged_node_load, 0, sizeof(khugepaged_node_load));
+	memset(kn->node_load, 0, nr_node_ids * sizeof(int));
 	pte = pte_offset_map_lock(mm, pmd, address, &ptl);
 	for (_address = address, _pte = pte; _pte < pte+HPAGE_PMD_NR;
 	     _pte++, _address += PAGE_SIZE) {
@@ -1155,16 +1284,17 @@ static int khugepaged_scan_pmd(struct mm_struct *mm,
 
 		/*
 		 * Record which node the original page is from and save this
-		 * information to khugepaged_node_load[].
+		 * information to kn->node_load[].
 		 * Khupaged will allocate hugepage from the node has the max
 		 * hit record.
 		 */
 		node = page_to_nid(page);
-		if (khugepaged_scan_abort(node)) {
+		if (khugepaged_scan_abort(kn, node)) {
 			result = SCAN_SCAN_ABORT;
 			goto out_unmap;
 		}
-		khugepaged_node_load[node]++;
+		kn->node_load[node]++;
+		kn->mm_load[node]++;
 		if (!PageLRU(page)) {
 			result = SCAN_PAGE_LRU;
 			goto out_unmap;
@@ -1205,9 +1335,9 @@ static int khugepaged_scan_pmd(struct mm_struct *mm,
 out_unmap:
 	pte_unmap_unlock(pte, ptl);
 	if (ret) {
-		node = khugepaged_find_target_node();
+		node = khugepaged_find_target_node(kn);
 		/* collapse_huge_page will return with the mmap_sem released */
-		collapse_huge_page(mm, address, hpage, node, referenced);
+		collapse_huge_page(kn, mm, address, hpage, node, referenced);
 	}
 out:
 	trace_mm_khugepaged_scan_pmd(mm, page, writable, referenced,
@@ -1560,7 +1690,8 @@ static void collapse_shmem(struct mm_struct *mm,
 	/* TODO: tracepoints */
 }
 
-static void khugepaged_scan_shmem(struct mm_struct *mm,
+static void khugepaged_scan_shmem(struct khugepaged_node *kn,
+		struct mm_struct *mm,
 		struct address_space *mapping,
 		pgoff_t start, struct page **hpage)
 {
@@ -1573,7 +1704,7 @@ static void khugepaged_scan_shmem(struct mm_struct *mm,
 
 	present = 0;
 	swap = 0;
-	memset(khugepaged_node_load, 0, sizeof(khugepaged_node_load));
+	memset(kn->node_load, 0, nr_node_ids * sizeof(int));
 	rcu_read_lock();
 	radix_tree_for_each_slot(slot, &mapping->page_tree, &iter, start) {
 		if (iter.index >= start + HPAGE_PMD_NR)
@@ -1599,11 +1730,12 @@ static void khugepaged_scan_shmem(struct mm_struct *mm,
 		}
 
 		node = page_to_nid(page);
-		if (khugepaged_scan_abort(node)) {
+		if (khugepaged_scan_abort(kn, node)) {
 			result = SCAN_SCAN_ABORT;
 			break;
 		}
-		khugepaged_node_load[node]++;
+		kn->node_load[node]++;
+		kn->mm_load[node]++;
 
 		if (!PageLRU(page)) {
 			result = SCAN_PAGE_LRU;
@@ -1634,7 +1766,7 @@ static void khugepaged_scan_shmem(struct mm_struct *mm,
 		if (present < HPAGE_PMD_NR - khugepaged_max_ptes_none) {
 			result = SCAN_EXCEED_NONE_PTE;
 		} else {
-			node = khugepaged_find_target_node();
+			node = khugepaged_find_target_node(kn);
 			collapse_shmem(mm, mapping, start, hpage, node);
 		}
 	}
@@ -1642,7 +1774,8 @@ static void khugepaged_scan_shmem(struct mm_struct *mm,
 	/* TODO: tracepoints */
 }
 #else
-static void khugepaged_scan_shmem(struct mm_struct *mm,
+static void khugepaged_scan_shmem(struct khugepaged_node *kn,
+		struct mm_struct *mm,
 		struct address_space *mapping,
 		pgoff_t start, struct page **hpage)
 {
@@ -1650,7 +1783,38 @@ static void khugepaged_scan_shmem(struct mm_struct *mm,
 }
 #endif
 
-static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
+/*
+ * Hand a fully scanned mm over to the khugepaged of the node most of its
+ * pages were found on, if that is not us.
+ */
+static void khugepaged_rehome_mm_slot(struct khugepaged_node *kn,
+				      struct mm_slot *mm_slot)
+{
+	int nid, home = kn->nid;
+	struct khugepaged_node *home_kn;
+	bool wakeup;
+
+	VM_BUG_ON(NR_CPUS != 1 && !spin_is_locked(&khugepaged_mm_lock));
+
+	for (nid = 0; nid < nr_node_ids; nid++)
+		if (kn->mm_load[nid] > kn->mm_load[home])
+			home = nid;
+	if (home == kn->nid)
+		return;
+
+	home_kn = khugepaged_nodes[home];
+	if (!home_kn->thread)
+		return;
+
+	wakeup = list_empty(&home_kn->scan.mm_head);
+	list_move_tail(&mm_slot->mm_node, &home_kn->scan.mm_head);
+	mm_slot->nid = home;
+	if (wakeup)
+		wake_up_interruptible(&khugepaged_wait);
+}
+
+static unsigned int khugepaged_scan_mm_slot(struct khugepaged_node *kn,
+					    unsigned int pages,
 					    struct page **hpage)
 	__releases(&khugepaged_mm_lock)
 	__acquires(&khugepaged_mm_lock)
@@ -1663,13 +1827,13 @@ static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
 	VM_BUG_ON(!pages);
 	VM_BUG_ON(NR_CPUS != 1 && !spin_is_locked(&khugepaged_mm_lock));
 
-	if (khugepaged_scan.mm_slot)
-		mm_slot = khugepaged_scan.mm_slot;
+	if (kn->scan.mm_slot)
+		mm_slot = kn->scan.mm_slot;
 	else {
-		mm_slot = list_entry(khugepaged_scan.mm_head.next,
+		mm_slot = list_entry(kn->scan.mm_head.next,
 				     struct mm_slot, mm_node);
-		khugepaged_scan.address = 0;
-		khugepaged_scan.mm_slot = mm_slot;
+		kn->scan.address = 0;
+		kn->scan.mm_slot = mm_slot;
 	}
 	spin_unlock(&khugepaged_mm_lock);
 
@@ -1678,7 +1842,7 @@ static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
 	if (unlikely(khugepaged_test_exit(mm)))
 		vma = NULL;
 	else
-		vma = find_vma(mm, khugepaged_scan.address);
+		vma = find_vma(mm, kn->scan.address);
 
 	progress++;
 	for (; vma; vma = vma->vm_next) {
@@ -1698,40 +1862,40 @@ static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
 		hend = vma->vm_end & HPAGE_PMD_MASK;
 		if (hstart >= hend)
 			goto skip;
-		if (khugepaged_scan.address > hend)
+		if (kn->scan.address > hend)
 			goto skip;
-		if (khugepaged_scan.address < hstart)
-			khugepaged_scan.address = hstart;
-		VM_BUG_ON(khugepaged_scan.address & ~HPAGE_PMD_MASK);
+		if (kn->scan.address < hstart)
+			kn->scan.address = hstart;
+		VM_BUG_ON(kn->scan.address & ~HPAGE_PMD_MASK);
 
-		while (khugepaged_scan.address < hend) {
+		while (kn->scan.address < hend) {
 			int ret;
 			cond_resched();
 			if (unlikely(khugepaged_test_exit(mm)))
 				goto breakouterloop;
 
-			VM_BUG_ON(khugepaged_scan.address < hstart ||
-				  khugepaged_scan.address + HPAGE_PMD_SIZE >
+			VM_BUG_ON(kn->scan.address < hstart ||
+				  kn->scan.address + HPAGE_PMD_SIZE >
 				  hend);
 			if (shmem_file(vma->vm_file)) {
 				struct file *file;
 				pgoff_t pgoff = linear_page_index(vma,
-						khugepaged_scan.address);
+						kn->scan.address);
 				if (!shmem_huge_enabled(vma))
 					goto skip;
 				file = get_file(vma->vm_file);
 				up_read(&mm->mmap_sem);
 				ret = 1;
-				khugepaged_scan_shmem(mm, file->f_mapping,
+				khugepaged_scan_shmem(kn, mm, file->f_mapping,
 						pgoff, hpage);
 				fput(file);
 			} else {
-				ret = khugepaged_scan_pmd(mm, vma,
-						khugepaged_scan.address,
+				ret = khugepaged_scan_pmd(kn, mm, vma,
+						kn->scan.address,
 						hpage);
 			}
 			/* move to next address */
-			khugepaged_scan.address += HPAGE_PMD_SIZE;
+			kn->scan.address += HPAGE_PMD_SIZE;
 			progress += HPAGE_PMD_NR;
 			if (ret)
 				/* we released mmap_sem so break loop */
@@ -1745,7 +1909,7 @@ static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
 breakouterloop_mmap_sem:
 
 	spin_lock(&khugepaged_mm_lock);
-	VM_BUG_ON(khugepaged_scan.mm_slot != mm_slot);
+	VM_BUG_ON(kn->scan.mm_slot != mm_slot);
 	/*
 	 * Release the current mm_slot if this mm is about to die, or
 	 * if we scanned all vmas of this mm.
@@ -1756,35 +1920,39 @@ static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
 		 * khugepaged runs here, khugepaged_exit will find
 		 * mm_slot not pointing to the exiting mm.
 		 */
-		if (mm_slot->mm_node.next != &khugepaged_scan.mm_head) {
-			khugepaged_scan.mm_slot = list_entry(
+		if (mm_slot->mm_node.next != &kn->scan.mm_head) {
+			kn->scan.mm_slot = list_entry(
 				mm_slot->mm_node.next,
 				struct mm_slot, mm_node);
-			khugepaged_scan.address = 0;
+			kn->scan.address = 0;
 		} else {
-			khugepaged_scan.mm_slot = NULL;
-			khugepaged_full_scans++;
+			kn->scan.mm_slot = NULL;
+			kn->full_scans++;
 		}
 
-		collect_mm_slot(mm_slot);
+		if (khugepaged_test_exit(mm))
+			collect_mm_slot(mm_slot);
+		else
+			khugepaged_rehome_mm_slot(kn, mm_slot);
+		memset(kn->mm_load, 0, nr_node_ids * sizeof(int));
 	}
 
 	return progress;
 }
 
-static int khugepaged_has_work(void)
+static int khugepaged_has_work(struct khugepaged_node *kn)
 {
-	return !list_empty(&khugepaged_scan.mm_head) &&
+	return !list_empty(&kn->scan.mm_head) &&
 		khugepaged_enabled();
 }
 
-static int khugepaged_wait_event(void)
+static int khugepaged_wait_event(struct khugepaged_node *kn)
 {
-	return !list_empty(&khugepaged_scan.mm_head) ||
+	return !list_empty(&kn->scan.mm_head) ||
 		kthread_should_stop();
 }
 
-static void khugepaged_do_scan(void)
+static void khugepaged_do_scan(struct khugepaged_node *kn)
 {
 	struct page *hpage = NULL;
 	unsigned int progress = 0, pass_through_head = 0;
@@ -1803,11 +1971,12 @@ static void khugepaged_do_scan(void)
 			break;
 
 		spin_lock(&khugepaged_mm_lock);
-		if (!khugepaged_scan.mm_slot)
+		if (!kn->scan.mm_slot)
 			pass_through_head++;
-		if (khugepaged_has_work() &&
+		if (khugepaged_has_work(kn) &&
 		    pass_through_head < 2)
-			progress += khugepaged_scan_mm_slot(pages - progress,
+			progress += khugepaged_scan_mm_slot(kn,
+							    pages - progress,
 							    &hpage);
 		else
 			progress = pages;
@@ -1816,6 +1985,9 @@ static void khugepaged_do_scan(void)
 
 	if (!IS_ERR_OR_NULL(hpage))
 		put_page(hpage);
+
+	/* Keep the rate window moving when nothing gets collapsed */
+	khugepaged_update_rate(kn, 0);
 }
 
 static bool khugepaged_should_wakeup(void)
@@ -1824,9 +1996,9 @@ static bool khugepaged_should_wakeup(void)
 	       time_after_eq(jiffies, khugepaged_sleep_expire);
 }
 
-static void khugepaged_wait_work(void)
+static void khugepaged_wait_work(struct khugepaged_node *kn)
 {
-	if (khugepaged_has_work()) {
+	if (khugepaged_has_work(kn)) {
 		const unsigned long scan_sleep_jiffies =
 			msecs_to_jiffies(khugepaged_scan_sleep_millisecs);
 
@@ -1841,27 +2013,33 @@ static void khugepaged_wait_work(void)
 	}
 
 	if (khugepaged_enabled())
-		wait_event_freezable(khugepaged_wait, khugepaged_wait_event());
+		wait_event_freezable(khugepaged_wait,
+				     khugepaged_wait_event(kn));
 }
 
-static int khugepaged(void *none)
+static int khugepaged(void *data)
 {
+	struct khugepaged_node *kn = data;
+	const struct cpumask *cpumask = cpumask_of_node(kn->nid);
 	struct mm_slot *mm_slot;
 
+	if (!cpumask_empty(cpumask))
+		set_cpus_allowed_ptr(current, cpumask);
 	set_freezable();
 	set_user_nice(current, MAX_NICE);
 
 	while (!kthread_should_stop()) {
-		khugepaged_do_scan();
-		khugepaged_wait_work();
+		khugepaged_do_scan(kn);
+		khugepaged_wait_work(kn);
 	}
 
 	spin_lock(&khugepaged_mm_lock);
-	mm_slot = khugepaged_scan.mm_slot;
-	khugepaged_scan.mm_slot = NULL;
+	mm_slot = kn->scan.mm_slot;
+	kn->scan.mm_slot = NULL;
 	if (mm_slot)
 		collect_mm_slot(mm_slot);
 	spin_unlock(&khugepaged_mm_lock);
+	memset(kn->mm_load, 0, nr_node_ids * sizeof(int));
 	return 0;
 }
 
@@ -1901,33 +2079,85 @@ static void set_recommended_min_free_kbytes(void)
 	setup_per_zone_wmarks();
 }
 
+static void khugepaged_stop_threads(void)
+{
+	struct khugepaged_node *kn;
+	int nid;
+
+	for_each_node(nid) {
+		kn = khugepaged_nodes[nid];
+		if (!kn->thread)
+			continue;
+		kthread_stop(kn->thread);
+		kn->thread = NULL;
+	}
+}
+
 int start_stop_khugepaged(void)
 {
-	static struct task_struct *khugepaged_thread __read_mostly;
 	static DEFINE_MUTEX(khugepaged_mutex);
-	int err = 0;
+	struct khugepaged_node *kn;
+	struct task_struct *thread;
+	bool wakeup = false;
+	int nid, err = 0;
+
+	if (!mm_slot_cache)	/* initialization failed */
+		return 0;
 
 	mutex_lock(&khugepaged_mutex);
 	if (khugepaged_enabled()) {
-		if (!khugepaged_thread)
-			khugepaged_thread = kthread_run(khugepaged, NULL,
-							"khugepaged");
-		if (IS_ERR(khugepaged_thread)) {
-			pr_err("khugepaged: kthread_run(khugepaged) failed\n");
-			err = PTR_ERR(khugepaged_thread);
-			khugepaged_thread = NULL;
-			goto fail;
+		/* Also called when memory is onlined, to cover new nodes */
+		for_each_node_state(nid, N_MEMORY) {
+			kn = khugepaged_nodes[nid];
+			if (kn->thread)
+				continue;
+			thread = kthread_create_on_node(khugepaged, kn, nid,
+							"khugepaged%d", nid);
+			if (IS_ERR(thread)) {
+				pr_err("khugepaged: kthread_run(khugepaged) failed\n");
+				err = PTR_ERR(thread);
+				khugepaged_stop_threads();
+				goto fail;
+			}
+			kn->thread = thread;
+			wake_up_process(thread);
 		}
 
-		if (!list_empty(&khugepaged_scan.mm_head))
+		for_each_node(nid)
+			if (!list_empty(&khugepaged_nodes[nid]->scan.mm_head))
+				wakeup = true;
+		if (wakeup)
 			wake_up_interruptible(&khugepaged_wait);
 
 		set_recommended_min_free_kbytes();
-	} else if (khugepaged_thread) {
-		kthread_stop(khugepaged_thread);
-		khugepaged_thread = NULL;
+	} else {
+		khugepaged_stop_threads();
 	}
 fail:
 	mutex_unlock(&khugepaged_mutex);
 	return err;
 }
+
+ssize_t khugepaged_report_node(int nid, char *buf)
+{
+	struct khugepaged_node *kn = khugepaged_nodes[nid];
+	unsigned int collapse_rate;
+
+	if (!kn)
+		return 0;
+
+	collapse_rate = READ_ONCE(kn->collapse_rate);
+
+	/* The thread has been idle for a while: nothing collapsed lately */
+	if (time_after(jiffies, READ_ONCE(kn->window_start) +
+			       2 * KHUGEPAGED_RATE_WINDOW))
+		collapse_rate = 0;
+
+	return sprintf(buf,
+		       "pages_collapsed %u\n"
+		       "full_scans %u\n"
+		       "pages_collapsed_per_minute %u\n",
+		       READ_ONCE(kn->pages_collapsed),
+		       READ_ONCE(kn->full_scans),
+		       collapse_rate);
+}
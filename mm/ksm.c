@@ -25,9 +25,10 @@
 #include <linux/pagemap.h>
 #include <linux/rmap.h>
 #include <linux/spinlock.h>
-#include <linux/jhash.h>
+#include <linux/xxhash.h>
 #include <linux/delay.h>
 #include <linux/kthread.h>
+#include <linux/workqueue.h>
 #include <linux/wait.h>
 #include <linux/slab.h>
 #include <linux/rbtree.h>
@@ -124,6 +125,46 @@ struct ksm_scan {
 	unsigned long seqnr;
 };
 
+/**
+ * struct ksm_scan_item - a page taken from the cursor, waiting to be merged
+ * @rmap_item: the reverse mapping of the page
+ * @page: the page itself, with a reference held
+ * @sample: checksum of the sampled lines of the page
+ * @checksum: checksum of the whole page, valid if @full
+ * @hashed: @sample has been calculated
+ * @full: @checksum has been calculated
+ */
+struct ksm_scan_item {
+	struct rmap_item *rmap_item;
+	struct page *page;
+	u32 sample;
+	u32 checksum;
+	bool hashed;
+	bool full;
+};
+
+/**
+ * struct ksm_worker - helper hashing its share of a batch for ksmd
+ * @work: queued on ksm_wq for each batch this worker takes part in
+ * @first: index of the first batch entry to hash
+ * @last: index past the last batch entry to hash
+ * @pages_scanned: number of pages hashed by this worker
+ * @window_start: jiffies when the current rate window was opened
+ * @window_pages: number of pages hashed in the current rate window
+ * @rate: pages per second hashed over the last complete window
+ *
+ * Worker 0 is ksmd itself, which always hashes the first share.
+ */
+struct ksm_worker {
+	struct work_struct work;
+	unsigned int first;
+	unsigned int last;
+	unsigned long pages_scanned;
+	unsigned long window_start;
+	unsigned long window_pages;
+	unsigned long rate;
+};
+
 /**
  * struct stable_node - node of the stable rbtree
  * @node: rb node of this ksm page in the stable tree
@@ -172,6 +213,7 @@ struct stable_node {
  * @mm: the memory structure this rmap_item is pointing into
  * @address: the virtual address this rmap_item tracks (+ flags in low bits)
  * @oldchecksum: previous checksum of the page at that virtual address
+ * @oldsample: previous checksum of the sampled lines of that page
  * @node: rb node of this rmap_item in the unstable tree
  * @head: pointer to stable_node heading this list in the stable tree
  * @hlist: link into hlist of rmap_items hanging off that stable_node
@@ -187,6 +229,7 @@ struct rmap_item {
 	struct mm_struct *mm;
 	unsigned long address;		/* + low bits used for flags below */
 	unsigned int oldchecksum;	/* when unstable */
+	unsigned int oldsample;		/* when unstable */
 	union {
 		struct rb_node node;	/* when node of unstable tree */
 		struct {		/* when listed from stable tree */
@@ -254,6 +297,17 @@ static unsigned int ksm_thread_pages_to_scan = 100;
 /* Milliseconds ksmd should sleep between batches */
 static unsigned int ksm_thread_sleep_millisecs = 20;
 
+/* Number of workers, ksmd included, hashing the pages of a batch */
+static unsigned int ksm_nr_workers = 1;
+
+#define KSM_MAX_WORKERS		16
+#define KSM_BATCH_PAGES		64
+#define KSM_WORKER_MIN_PAGES	8	/* don't split a batch finer than this */
+
+static struct ksm_scan_item ksm_batch[KSM_BATCH_PAGES];
+static struct ksm_worker ksm_workers[KSM_MAX_WORKERS];
+static struct workqueue_struct *ksm_wq;
+
 /* Checksum of an empty (zeroed) page */
 static unsigned int zero_checksum __read_mostly;
 
@@ -982,28 +1036,89 @@ static int unmerge_and_remove_all_rmap_items(void)
 }
 #endif /* CONFIG_SYSFS */
 
+static u32 calc_checksum_addr(void *addr)
+{
+#ifdef CONFIG_64BIT
+	return xxh64(addr, PAGE_SIZE, 0);
+#else
+	return xxh32(addr, PAGE_SIZE, 0);
+#endif
+}
+
 static u32 calc_checksum(struct page *page)
 {
 	u32 checksum;
 	void *addr = kmap_atomic(page);
-	checksum = jhash2(addr, PAGE_SIZE / 4, 17);
+	checksum = calc_checksum_addr(addr);
 	kunmap_atomic(addr);
 	return checksum;
 }
 
+#define KSM_SAMPLE_LINES	8
+#define KSM_SAMPLE_BYTES	64
+
+/*
+ * Checksum a few lines spread over the page, each one at a different
+ * offset within its stride, so a single hot field is likely to be caught.
+ */
+static u32 calc_sample_addr(void *addr)
+{
+	const unsigned int stride = PAGE_SIZE / KSM_SAMPLE_LINES;
+	unsigned int i, offset;
+	u32 sample = 0;
+
+	for (i = 0; i < KSM_SAMPLE_LINES; i++) {
+		offset = i * stride + (i * KSM_SAMPLE_BYTES) % stride;
+		sample = xxh32(addr + offset, KSM_SAMPLE_BYTES, sample);
+	}
+	return sample;
+}
+
+/*
+ * The generic memcmp() goes a byte at a time: compare a few words per
+ * iteration instead, and only order the first mismatch with memcmp().
+ */
 static int memcmp_pages(struct page *page1, struct page *page2)
 {
-	char *addr1, *addr2;
-	int ret;
+	unsigned long *addr1, *addr2;
+	unsigned int i;
+	int ret = 0;
 
 	addr1 = kmap_atomic(page1);
 	addr2 = kmap_atomic(page2);
-	ret = memcmp(addr1, addr2, PAGE_SIZE);
+	for (i = 0; i < PAGE_SIZE / sizeof(long); i += 4) {
+		if ((addr1[i] ^ addr2[i]) | (addr1[i + 1] ^ addr2[i + 1]) |
+		    (addr1[i + 2] ^ addr2[i + 2]) |
+		    (addr1[i + 3] ^ addr2[i + 3])) {
+			ret = memcmp(addr1 + i, addr2 + i, 4 * sizeof(long));
+			break;
+		}
+	}
 	kunmap_atomic(addr2);
 	kunmap_atomic(addr1);
 	return ret;
 }
 
+/*
+ * Checksum a page taken from the cursor.  The sampled lines go first: a page
+ * being written to usually shows it there, and is then passed over without
+ * checksumming all of it.  Nothing is known yet of a new rmap_item, so that
+ * gets both.
+ */
+static void ksm_hash_item(struct ksm_scan_item *item)
+{
+	struct rmap_item *rmap_item = item->rmap_item;
+	void *addr = kmap_atomic(item->page);
+
+	item->sample = calc_sample_addr(addr);
+	item->full = item->sample == rmap_item->oldsample ||
+		     (!rmap_item->oldsample && !rmap_item->oldchecksum);
+	if (item->full)
+		item->checksum = calc_checksum_addr(addr);
+	kunmap_atomic(addr);
+	item->hashed = true;
+}
+
 static inline int pages_identical(struct page *page1, struct page *page2)
 {
 	return !memcmp_pages(page1, page2);
@@ -1985,11 +2100,13 @@ static void stable_tree_append(struct rmap_item *rmap_item,
  * be inserted into the unstable tree, or merged with a page already there and
  * both transferred to the stable tree.
  *
- * @page: the page that we are searching identical page to.
- * @rmap_item: the reverse mapping into the virtual address of this page
+ * @item: the page that we are searching identical page to, and the reverse
+ * mapping into its virtual address
  */
-static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
+static void cmp_and_merge_page(struct ksm_scan_item *item)
 {
+	struct page *page = item->page;
+	struct rmap_item *rmap_item = item->rmap_item;
 	struct mm_struct *mm = rmap_item->mm;
 	struct rmap_item *tree_rmap_item;
 	struct page *tree_page = NULL;
@@ -2049,12 +2166,18 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 	 * we calculated it, this page is changing frequently: therefore we
 	 * don't want to insert it in the unstable tree, and we don't want
 	 * to waste our time searching for something identical to it there.
+	 * If only the sampled lines were checksummed, they have changed.
 	 */
-	checksum = calc_checksum(page);
-	if (rmap_item->oldchecksum != checksum) {
-		rmap_item->oldchecksum = checksum;
+	if (!item->hashed)
+		ksm_hash_item(item);
+	if (!item->full || rmap_item->oldsample != item->sample ||
+	    rmap_item->oldchecksum != item->checksum) {
+		rmap_item->oldsample = item->sample;
+		if (item->full)
+			rmap_item->oldchecksum = item->checksum;
 		return;
 	}
+	checksum = item->checksum;
 
 	/*
 	 * Same checksum as an empty page. We attempt to merge it with the
@@ -2138,7 +2261,14 @@ static struct rmap_item *get_next_rmap_item(struct mm_slot *mm_slot,
 	return rmap_item;
 }
 
-static struct rmap_item *scan_get_next_rmap_item(struct page **page)
+/*
+ * Returns the next rmap_item to scan and its page, or NULL.  *@scan_done is
+ * set when NULL is returned because a full scan has just been completed: it
+ * is then up to the caller to increment ksm_scan.seqnr, once it has merged
+ * the pages it took during that scan.
+ */
+static struct rmap_item *scan_get_next_rmap_item(struct page **page,
+						 bool *scan_done)
 {
 	struct mm_struct *mm;
 	struct mm_slot *slot;
@@ -2292,27 +2422,123 @@ static struct rmap_item *scan_get_next_rmap_item(struct page **page)
 	if (slot != &ksm_mm_head)
 		goto next_mm;
 
-	ksm_scan.seqnr++;
+	*scan_done = true;
 	return NULL;
 }
 
+static void ksm_worker_account(struct ksm_worker *worker, unsigned int nr)
+{
+	unsigned long now = jiffies;
+
+	worker->pages_scanned += nr;
+	worker->window_pages += nr;
+	if (time_after_eq(now, worker->window_start + HZ)) {
+		worker->rate = worker->window_pages * HZ /
+			       (now - worker->window_start);
+		worker->window_start = now;
+		worker->window_pages = 0;
+	}
+}
+
+static void ksm_hash_share(struct ksm_worker *worker)
+{
+	unsigned int i;
+
+	/* Pages already merged are found in the stable tree without it */
+	for (i = worker->first; i < worker->last; i++)
+		if (!PageKsm(ksm_batch[i].page))
+			ksm_hash_item(&ksm_batch[i]);
+	ksm_worker_account(worker, worker->last - worker->first);
+}
+
+static void ksm_worker_func(struct work_struct *work)
+{
+	ksm_hash_share(container_of(work, struct ksm_worker, work));
+}
+
+/*
+ * Checksumming is what a scan spends most of its time on, and it needs no
+ * more than the page itself: so share it out among the workers.  Searching
+ * and updating the stable and unstable trees is left to ksmd alone, under
+ * ksm_thread_mutex as before.
+ */
+static void ksm_hash_batch(unsigned int nr)
+{
+	unsigned int nr_workers, i;
+
+	if (!nr)
+		return;
+
+	nr_workers = min(ksm_nr_workers, DIV_ROUND_UP(nr, KSM_WORKER_MIN_PAGES));
+	for (i = 0; i < nr_workers; i++) {
+		ksm_workers[i].first = i * nr / nr_workers;
+		ksm_workers[i].last = (i + 1) * nr / nr_workers;
+		if (i)
+			queue_work(ksm_wq, &ksm_workers[i].work);
+	}
+	ksm_hash_share(&ksm_workers[0]);
+	for (i = 1; i < nr_workers; i++)
+		flush_work(&ksm_workers[i].work);
+}
+
 /**
  * ksm_do_scan  - the ksm scanner main worker function.
  * @scan_npages - number of pages we want to scan before we return.
  */
 static void ksm_do_scan(unsigned int scan_npages)
 {
-	struct rmap_item *rmap_item;
-	struct page *uninitialized_var(page);
+	struct ksm_scan_item *item;
+	struct mm_struct *mm;
+	unsigned int nr, i;
+	bool scan_done = false;
+	bool done = false;
 
-	while (scan_npages-- && likely(!freezing(current))) {
-		cond_resched();
-		rmap_item = scan_get_next_rmap_item(&page);
-		if (!rmap_item)
-			return;
-		cmp_and_merge_page(page, rmap_item);
-		put_page(page);
+	while (scan_npages && !done && likely(!freezing(current))) {
+		/*
+		 * Take a batch of pages from the mm under the cursor.  Holding
+		 * mm_users stops the cursor from freeing the rmap_items already
+		 * taken, should the mm exit meanwhile; the batch ends when the
+		 * cursor moves on to another mm, or to the next full scan.
+		 */
+		mm = NULL;
+		nr = 0;
+		while (nr < min_t(unsigned int, scan_npages, KSM_BATCH_PAGES)) {
+			cond_resched();
+			item = &ksm_batch[nr];
+			item->rmap_item = scan_get_next_rmap_item(&item->page,
+								  &scan_done);
+			if (!item->rmap_item) {
+				done = true;
+				break;
+			}
+			item->hashed = false;
+			nr++;
+			if (!mm) {
+				if (!mmget_not_zero(item->rmap_item->mm))
+					break;
+				mm = item->rmap_item->mm;
+			} else if (item->rmap_item->mm != mm)
+				break;
+		}
+		scan_npages -= nr;
+
+		ksm_hash_batch(nr);
+		for (i = 0; i < nr; i++) {
+			cond_resched();
+			cmp_and_merge_page(&ksm_batch[i]);
+			put_page(ksm_batch[i].page);
+		}
+		if (mm)
+			mmput_async(mm);
 	}
+
+	/*
+	 * Only now that the last pages of the full scan have gone into its
+	 * unstable tree may the next scan, which starts with a new tree,
+	 * age them.
+	 */
+	if (scan_done)
+		ksm_scan.seqnr++;
 }
 
 static int ksmd_should_run(void)
@@ -3019,6 +3245,66 @@ stable_node_chains_prune_millisecs_store(struct kobject *kobj,
 }
 KSM_ATTR(stable_node_chains_prune_millisecs);
 
+static ssize_t nr_workers_show(struct kobject *kobj,
+			       struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_nr_workers);
+}
+
+static ssize_t nr_workers_store(struct kobject *kobj,
+				struct kobj_attribute *attr,
+				const char *buf, size_t count)
+{
+	unsigned long nr_workers;
+	int err;
+
+	err = kstrtoul(buf, 10, &nr_workers);
+	if (err || !nr_workers || nr_workers > KSM_MAX_WORKERS)
+		return -EINVAL;
+
+	mutex_lock(&ksm_thread_mutex);
+	ksm_nr_workers = nr_workers;
+	mutex_unlock(&ksm_thread_mutex);
+
+	return count;
+}
+KSM_ATTR(nr_workers);
+
+static ssize_t worker_pages_scanned_show(struct kobject *kobj,
+					 struct kobj_attribute *attr, char *buf)
+{
+	ssize_t len = 0;
+	unsigned int i;
+
+	for (i = 0; i < ksm_nr_workers; i++)
+		len += sprintf(buf + len, "%s%lu", i ? " " : "",
+			       READ_ONCE(ksm_workers[i].pages_scanned));
+	len += sprintf(buf + len, "\n");
+	return len;
+}
+KSM_ATTR_RO(worker_pages_scanned);
+
+static ssize_t worker_scan_rate_show(struct kobject *kobj,
+				     struct kobj_attribute *attr, char *buf)
+{
+	struct ksm_worker *worker;
+	unsigned long rate;
+	ssize_t len = 0;
+	unsigned int i;
+
+	for (i = 0; i < ksm_nr_workers; i++) {
+		worker = &ksm_workers[i];
+		rate = READ_ONCE(worker->rate);
+		/* The last window closed long ago: the worker has been idle */
+		if (time_after(jiffies, READ_ONCE(worker->window_start) + 2 * HZ))
+			rate = 0;
+		len += sprintf(buf + len, "%s%lu", i ? " " : "", rate);
+	}
+	len += sprintf(buf + len, "\n");
+	return len;
+}
+KSM_ATTR_RO(worker_scan_rate);
+
 static ssize_t full_scans_show(struct kobject *kobj,
 			       struct kobj_attribute *attr, char *buf)
 {
@@ -3043,6 +3329,9 @@ static struct attribute *ksm_attrs[] = {
 	&stable_node_dups_attr.attr,
 	&stable_node_chains_prune_millisecs_attr.attr,
 	&use_zero_pages_attr.attr,
+	&nr_workers_attr.attr,
+	&worker_pages_scanned_attr.attr,
+	&worker_scan_rate_attr.attr,
 	NULL,
 };
 
@@ -3055,7 +3344,7 @@ static const struct attribute_group ksm_attr_group = {
 static int __init ksm_init(void)
 {
 	struct task_struct *ksm_thread;
-	int err;
+	int err, i;
 
 	/* The correct value depends on page size and endianness */
 	zero_checksum = calc_checksum(ZERO_PAGE(0));
@@ -3066,11 +3355,20 @@ static int __init ksm_init(void)
 	if (err)
 		goto out;
 
+	for (i = 0; i < KSM_MAX_WORKERS; i++)
+		INIT_WORK(&ksm_workers[i].work, ksm_worker_func);
+	ksm_wq = alloc_workqueue("ksmd", WQ_UNBOUND, 0);
+	if (!ksm_wq) {
+		pr_err("ksm: creating workqueue failed\n");
+		err = -ENOMEM;
+		goto out_free;
+	}
+
 	ksm_thread = kthread_run(ksm_scan_thread, NULL, "ksmd");
 	if (IS_ERR(ksm_thread)) {
 		pr_err("ksm: creating kthread failed\n");
 		err = PTR_ERR(ksm_thread);
-		goto out_free;
+		goto out_free_wq;
 	}
 
 #ifdef CONFIG_SYSFS
@@ -3078,7 +3376,7 @@ static int __init ksm_init(void)
 	if (err) {
 		pr_err("ksm: register sysfs failed\n");
 		kthread_stop(ksm_thread);
-		goto out_free;
+		goto out_free_wq;
 	}
 #else
 	ksm_run = KSM_RUN_MERGE;	/* no way for user to start it */
@@ -3091,6 +3389,8 @@ static int __init ksm_init(void)
 #endif
 	return 0;
 
+out_free_wq:
+	destroy_workqueue(ksm_wq);
 out_free:
 	ksm_slab_free();
 out:
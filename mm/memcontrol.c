@@ -372,14 +372,6 @@ soft_limit_tree_node(int nid)
 	return soft_limit_tree.rb_tree_per_node[nid];
 }
 
-static struct mem_cgroup_tree_per_node *
-soft_limit_tree_from_page(struct page *page)
-{
-	int nid = page_to_nid(page);
-
-	return soft_limit_tree.rb_tree_per_node[nid];
-}
-
 static void __mem_cgroup_insert_exceeded(struct mem_cgroup_per_node *mz,
 					 struct mem_cgroup_tree_per_node *mctz,
 					 unsigned long new_usage_in_excess)
@@ -455,13 +447,13 @@ static unsigned long soft_limit_excess(struct mem_cgroup *memcg)
 	return excess;
 }
 
-static void mem_cgroup_update_tree(struct mem_cgroup *memcg, struct page *page)
+static void mem_cgroup_update_tree(struct mem_cgroup *memcg, int nid)
 {
 	unsigned long excess;
 	struct mem_cgroup_per_node *mz;
 	struct mem_cgroup_tree_per_node *mctz;
 
-	mctz = soft_limit_tree_from_page(page);
+	mctz = soft_limit_tree_node(nid);
 	if (!mctz)
 		return;
 	/*
@@ -469,7 +461,7 @@ static void mem_cgroup_update_tree(struct mem_cgroup *memcg, struct page *page)
 	 * because their event counter is not touched.
 	 */
 	for (; memcg; memcg = parent_mem_cgroup(memcg)) {
-		mz = mem_cgroup_page_nodeinfo(memcg, page);
+		mz = mem_cgroup_nodeinfo(memcg, nid);
 		excess = soft_limit_excess(memcg);
 		/*
 		 * We have to update the tree if mz is on RB-tree or
@@ -665,9 +657,26 @@ static bool mem_cgroup_event_ratelimit(struct mem_cgroup *memcg,
 	return false;
 }
 
+static void memcg_event_work_func(struct work_struct *work)
+{
+	struct mem_cgroup *memcg;
+	int nid;
+
+	memcg = container_of(work, struct mem_cgroup, event_work);
+	mem_cgroup_threshold(memcg);
+	for_each_node(nid) {
+		if (test_and_clear_bit(nid, nodes_addr(memcg->softlimit_nodes)))
+			mem_cgroup_update_tree(memcg, nid);
+	}
+}
+
 /*
  * Check events in order.
  *
+ * Thresholds and the soft limit tree are checked against the usage of
+ * every ancestor, whose counters are written by all cpus charging below
+ * them.  Rather than reading them from the charge path, leave it to
+ * event_work, which also folds the events of many cpus into one update.
  */
 static void memcg_check_events(struct mem_cgroup *memcg, struct page *page)
 {
@@ -683,9 +692,9 @@ static void memcg_check_events(struct mem_cgroup *memcg, struct page *page)
 		do_numainfo = mem_cgroup_event_ratelimit(memcg,
 						MEM_CGROUP_TARGET_NUMAINFO);
 #endif
-		mem_cgroup_threshold(memcg);
 		if (unlikely(do_softlimit))
-			mem_cgroup_update_tree(memcg, page);
+			node_set(page_to_nid(page), memcg->softlimit_nodes);
+		schedule_work(&memcg->event_work);
 #if MAX_NUMNODES > 1
 		if (unlikely(do_numainfo))
 			atomic_inc(&memcg->numainfo_events);
@@ -1709,12 +1718,27 @@ EXPORT_SYMBOL(unlock_page_memcg);
 
 /*
  * size of first charge trial. "32" comes from vmscan.c's magic value.
- * TODO: maybe necessary to use big numbers in big irons.
+ * A cpu that keeps missing its stock for a memcg charges ahead in bigger
+ * batches, up to MAX_CHARGE_BATCH, and goes back down once it misses
+ * rarely again.  That keeps charges from hammering the page counters of
+ * the whole hierarchy without holding much slack on idle cpus.
  */
-#define CHARGE_BATCH	32U
-struct memcg_stock_pcp {
+#define CHARGE_BATCH		32U
+#define MAX_CHARGE_BATCH	(CHARGE_BATCH * 8)
+#define STOCK_GROW_INTERVAL	(HZ / 100)
+#define STOCK_SHRINK_INTERVAL	HZ
+/* memcgs stocked per cpu, for tasks of several memcgs sharing a cpu */
+#define NR_MEMCG_STOCK		4
+
+struct memcg_stock_slot {
 	struct mem_cgroup *cached; /* this never be root cgroup */
 	unsigned int nr_pages;
+	unsigned int batch;
+	unsigned long last_miss;
+};
+
+struct memcg_stock_pcp {
+	struct memcg_stock_slot slots[NR_MEMCG_STOCK];
 	struct work_struct work;
 	unsigned long flags;
 #define FLUSHING_CACHED_CHARGE	0
@@ -1722,31 +1746,43 @@ struct memcg_stock_pcp {
 static DEFINE_PER_CPU(struct memcg_stock_pcp, memcg_stock);
 static DEFINE_MUTEX(percpu_charge_mutex);
 
+static struct memcg_stock_slot *stock_slot(struct memcg_stock_pcp *stock,
+					   struct mem_cgroup *memcg)
+{
+	int i;
+
+	for (i = 0; i < NR_MEMCG_STOCK; i++) {
+		if (stock->slots[i].cached == memcg)
+			return &stock->slots[i];
+	}
+	return NULL;
+}
+
 /**
  * consume_stock: Try to consume stocked charge on this cpu.
  * @memcg: memcg to consume from.
  * @nr_pages: how many pages to charge.
  *
- * The charges will only happen if @memcg matches the current cpu's memcg
- * stock, and at least @nr_pages are available in that stock.  Failure to
+ * The charges will only happen if @memcg is stocked on the current cpu,
+ * and at least @nr_pages are available in that stock.  Failure to
  * service an allocation will refill the stock.
  *
  * returns true if successful, false otherwise.
  */
 static bool consume_stock(struct mem_cgroup *memcg, unsigned int nr_pages)
 {
-	struct memcg_stock_pcp *stock;
+	struct memcg_stock_slot *slot;
 	unsigned long flags;
 	bool ret = false;
 
-	if (nr_pages > CHARGE_BATCH)
+	if (nr_pages > MAX_CHARGE_BATCH)
 		return ret;
 
 	local_irq_save(flags);
 
-	stock = this_cpu_ptr(&memcg_stock);
-	if (memcg == stock->cached && stock->nr_pages >= nr_pages) {
-		stock->nr_pages -= nr_pages;
+	slot = stock_slot(this_cpu_ptr(&memcg_stock), memcg);
+	if (slot && slot->nr_pages >= nr_pages) {
+		slot->nr_pages -= nr_pages;
 		ret = true;
 	}
 
@@ -1755,21 +1791,35 @@ static bool consume_stock(struct mem_cgroup *memcg, unsigned int nr_pages)
 	return ret;
 }
 
+/*
+ * Returns @nr_pages of the charges cached in @slot.
+ */
+static void uncharge_stock(struct memcg_stock_slot *slot, unsigned int nr_pages)
+{
+	struct mem_cgroup *old = slot->cached;
+
+	if (nr_pages) {
+		page_counter_uncharge(&old->memory, nr_pages);
+		if (do_memsw_account())
+			page_counter_uncharge(&old->memsw, nr_pages);
+		css_put_many(&old->css, nr_pages);
+		slot->nr_pages -= nr_pages;
+	}
+}
+
 /*
  * Returns stocks cached in percpu and reset cached information.
  */
 static void drain_stock(struct memcg_stock_pcp *stock)
 {
-	struct mem_cgroup *old = stock->cached;
+	int i;
 
-	if (stock->nr_pages) {
-		page_counter_uncharge(&old->memory, stock->nr_pages);
-		if (do_memsw_account())
-			page_counter_uncharge(&old->memsw, stock->nr_pages);
-		css_put_many(&old->css, stock->nr_pages);
-		stock->nr_pages = 0;
+	for (i = 0; i < NR_MEMCG_STOCK; i++) {
+		struct memcg_stock_slot *slot = &stock->slots[i];
+
+		uncharge_stock(slot, slot->nr_pages);
+		slot->cached = NULL;
 	}
-	stock->cached = NULL;
 }
 
 static void drain_local_stock(struct work_struct *dummy)
@@ -1790,6 +1840,34 @@ static void drain_local_stock(struct work_struct *dummy)
 	local_irq_restore(flags);
 }
 
+/*
+ * Returns how many pages to charge ahead for @memcg on this cpu after its
+ * stock ran dry.  Misses in quick succession mean a high charge rate.
+ */
+static unsigned int stock_charge_batch(struct mem_cgroup *memcg)
+{
+	struct memcg_stock_slot *slot;
+	unsigned int batch = CHARGE_BATCH;
+	unsigned long flags;
+
+	local_irq_save(flags);
+
+	slot = stock_slot(this_cpu_ptr(&memcg_stock), memcg);
+	if (slot) {
+		if (time_before(jiffies, slot->last_miss + STOCK_GROW_INTERVAL))
+			slot->batch = min(slot->batch * 2, MAX_CHARGE_BATCH);
+		else if (time_after(jiffies,
+				    slot->last_miss + STOCK_SHRINK_INTERVAL))
+			slot->batch = max(slot->batch / 2, CHARGE_BATCH);
+		slot->last_miss = jiffies;
+		batch = slot->batch;
+	}
+
+	local_irq_restore(flags);
+
+	return batch;
+}
+
 /*
  * Cache charges(val) to local per_cpu area.
  * This will be consumed by consume_stock() function, later.
@@ -1797,19 +1875,36 @@ static void drain_local_stock(struct work_struct *dummy)
 static void refill_stock(struct mem_cgroup *memcg, unsigned int nr_pages)
 {
 	struct memcg_stock_pcp *stock;
+	struct memcg_stock_slot *slot;
 	unsigned long flags;
+	int i;
 
 	local_irq_save(flags);
 
 	stock = this_cpu_ptr(&memcg_stock);
-	if (stock->cached != memcg) { /* reset if necessary */
-		drain_stock(stock);
-		stock->cached = memcg;
+	slot = stock_slot(stock, memcg);
+	if (!slot) {
+		/* reuse an empty slot, or the one that missed longest ago */
+		slot = &stock->slots[0];
+		for (i = 0; i < NR_MEMCG_STOCK; i++) {
+			struct memcg_stock_slot *s = &stock->slots[i];
+
+			if (!s->cached || !s->nr_pages) {
+				slot = s;
+				break;
+			}
+			if (time_before(s->last_miss, slot->last_miss))
+				slot = s;
+		}
+		uncharge_stock(slot, slot->nr_pages);
+		slot->cached = memcg;
+		slot->batch = CHARGE_BATCH;
+		slot->last_miss = jiffies;
 	}
-	stock->nr_pages += nr_pages;
+	slot->nr_pages += nr_pages;
 
-	if (stock->nr_pages > CHARGE_BATCH)
-		drain_stock(stock);
+	if (slot->nr_pages > slot->batch)
+		uncharge_stock(slot, slot->nr_pages - slot->batch);
 
 	local_irq_restore(flags);
 }
@@ -1834,22 +1929,27 @@ static void drain_all_stock(struct mem_cgroup *root_memcg)
 	curcpu = get_cpu();
 	for_each_online_cpu(cpu) {
 		struct memcg_stock_pcp *stock = &per_cpu(memcg_stock, cpu);
-		struct mem_cgroup *memcg;
+		bool flush = false;
+		int i;
 
-		memcg = stock->cached;
-		if (!memcg || !stock->nr_pages || !css_tryget(&memcg->css))
-			continue;
-		if (!mem_cgroup_is_descendant(memcg, root_memcg)) {
+		for (i = 0; i < NR_MEMCG_STOCK && !flush; i++) {
+			struct memcg_stock_slot *slot = &stock->slots[i];
+			struct mem_cgroup *memcg;
+
+			memcg = slot->cached;
+			if (!memcg || !slot->nr_pages || !css_tryget(&memcg->css))
+				continue;
+			flush = mem_cgroup_is_descendant(memcg, root_memcg);
 			css_put(&memcg->css);
-			continue;
 		}
+		if (!flush)
+			continue;
 		if (!test_and_set_bit(FLUSHING_CACHED_CHARGE, &stock->flags)) {
 			if (cpu == curcpu)
 				drain_local_stock(&stock->work);
 			else
 				schedule_work_on(cpu, &stock->work);
 		}
-		css_put(&memcg->css);
 	}
 	put_cpu();
 	mutex_unlock(&percpu_charge_mutex);
@@ -1905,7 +2005,7 @@ void mem_cgroup_handle_over_high(void)
 static int try_charge(struct mem_cgroup *memcg, gfp_t gfp_mask,
 		      unsigned int nr_pages)
 {
-	unsigned int batch = max(CHARGE_BATCH, nr_pages);
+	unsigned int batch = 0;
 	int nr_retries = MEM_CGROUP_RECLAIM_RETRIES;
 	struct mem_cgroup *mem_over_limit;
 	struct page_counter *counter;
@@ -1919,6 +2019,9 @@ static int try_charge(struct mem_cgroup *memcg, gfp_t gfp_mask,
 	if (consume_stock(memcg, nr_pages))
 		return 0;
 
+	if (!batch)
+		batch = max(stock_charge_batch(memcg), nr_pages);
+
 	if (!do_memsw_account() ||
 	    page_counter_try_charge(&memcg->memsw, batch, &counter)) {
 		if (page_counter_try_charge(&memcg->memory, batch, &counter))
@@ -4238,6 +4341,7 @@ static struct mem_cgroup *mem_cgroup_alloc(void)
 		goto fail;
 
 	INIT_WORK(&memcg->high_work, high_work_func);
+	INIT_WORK(&memcg->event_work, memcg_event_work_func);
 	memcg->last_scanned_node = MAX_NUMNODES;
 	INIT_LIST_HEAD(&memcg->oom_notify);
 	mutex_init(&memcg->thresholds_lock);
@@ -4373,6 +4477,7 @@ static void mem_cgroup_css_free(struct cgroup_subsys_state *css)
 
 	vmpressure_cleanup(&memcg->vmpressure);
 	cancel_work_sync(&memcg->high_work);
+	cancel_work_sync(&memcg->event_work);
 	mem_cgroup_remove_from_trees(memcg);
 	memcg_free_kmem(memcg);
 	mem_cgroup_free(memcg);
@@ -3043,10 +3043,81 @@ int do_swap_page(struct vm_fault *vmf)
 	return ret;
 }
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+static inline bool vma_has_changed(struct vm_fault *vmf)
+{
+	return read_seqcount_retry(&vmf->vma->vm_sequence, vmf->sequence);
+}
+
+/*
+ * Map and lock the pte at vmf->address.  A speculative fault holds
+ * neither mmap_sem nor any reference on the page tables, so it works
+ * from the pmd value sampled by handle_speculative_fault() and fails
+ * if either that pmd or the vma changed since.
+ *
+ * Interrupts are disabled while the pmd is checked, which holds off the
+ * TLB flush that precedes freeing the pte page; once the ptl is held,
+ * anyone wanting to free the page must first unmap the vma, bumping
+ * vm_sequence, and then take the ptl to zap it.  The ptl is only
+ * trylocked, as its holder may be waiting for us to take that IPI.
+ */
+static bool pte_map_lock(struct vm_fault *vmf)
+{
+	bool ret = false;
+	spinlock_t *ptl;
+	pmd_t pmdval;
+	pte_t *pte;
+
+	if (!(vmf->flags & FAULT_FLAG_SPECULATIVE)) {
+		vmf->pte = pte_offset_map_lock(vmf->vma->vm_mm, vmf->pmd,
+					       vmf->address, &vmf->ptl);
+		return true;
+	}
+
+again:
+	local_irq_disable();
+	if (vma_has_changed(vmf))
+		goto out;
+	pmdval = READ_ONCE(*vmf->pmd);
+	if (!pmd_same(pmdval, vmf->orig_pmd))
+		goto out;
+
+	ptl = pte_lockptr(vmf->vma->vm_mm, &pmdval);
+	pte = pte_offset_map(&pmdval, vmf->address);
+	if (unlikely(!spin_trylock(ptl))) {
+		pte_unmap(pte);
+		local_irq_enable();
+		cpu_relax();
+		goto again;
+	}
+	if (vma_has_changed(vmf)) {
+		pte_unmap_unlock(pte, ptl);
+		goto out;
+	}
+
+	vmf->pte = pte;
+	vmf->ptl = ptl;
+	ret = true;
+out:
+	local_irq_enable();
+	return ret;
+}
+#else
+static inline bool pte_map_lock(struct vm_fault *vmf)
+{
+	vmf->pte = pte_offset_map_lock(vmf->vma->vm_mm, vmf->pmd,
+				       vmf->address, &vmf->ptl);
+	return true;
+}
+#endif /* CONFIG_SPECULATIVE_PAGE_FAULT */
+
 /*
  * We enter with non-exclusive mmap_sem (to exclude vma changes,
  * but allow concurrent faults), and pte mapped but not yet locked.
  * We return with mmap_sem still held, but pte unmapped and unlocked.
+ *
+ * A speculative fault enters without mmap_sem, with the pte table known
+ * to be present, and returns VM_FAULT_RETRY if the vma changed under it.
  */
 static int do_anonymous_page(struct vm_fault *vmf)
 {
@@ -3070,20 +3141,22 @@ static int do_anonymous_page(struct vm_fault *vmf)
 	 *
 	 * Here we only have down_read(mmap_sem).
 	 */
-	if (pte_alloc(vma->vm_mm, vmf->pmd, vmf->address))
-		return VM_FAULT_OOM;
+	if (!(vmf->flags & FAULT_FLAG_SPECULATIVE)) {
+		if (pte_alloc(vma->vm_mm, vmf->pmd, vmf->address))
+			return VM_FAULT_OOM;
 
-	/* See the comment in pte_alloc_one_map() */
-	if (unlikely(pmd_trans_unstable(vmf->pmd)))
-		return 0;
+		/* See the comment in pte_alloc_one_map() */
+		if (unlikely(pmd_trans_unstable(vmf->pmd)))
+			return 0;
+	}
 
 	/* Use the zero-page for reads */
 	if (!(vmf->flags & FAULT_FLAG_WRITE) &&
 			!mm_forbids_zeropage(vma->vm_mm)) {
 		entry = pte_mkspecial(pfn_pte(my_zero_pfn(vmf->address),
 						vma->vm_page_prot));
-		vmf->pte = pte_offset_map_lock(vma->vm_mm, vmf->pmd,
-				vmf->address, &vmf->ptl);
+		if (!pte_map_lock(vmf))
+			return VM_FAULT_RETRY;
 		if (!pte_none(*vmf->pte))
 			goto unlock;
 		ret = check_stable_address_space(vma->vm_mm);
@@ -3118,8 +3191,11 @@ static int do_anonymous_page(struct vm_fault *vmf)
 	if (vma->vm_flags & VM_WRITE)
 		entry = pte_mkwrite(pte_mkdirty(entry));
 
-	vmf->pte = pte_offset_map_lock(vma->vm_mm, vmf->pmd, vmf->address,
-			&vmf->ptl);
+	if (!pte_map_lock(vmf)) {
+		mem_cgroup_cancel_charge(page, memcg, false);
+		put_page(page);
+		return VM_FAULT_RETRY;
+	}
 	if (!pte_none(*vmf->pte))
 		goto release;
 
@@ -3203,6 +3279,10 @@ static int pte_alloc_one_map(struct vm_fault *vmf)
 {
 	struct vm_area_struct *vma = vmf->vma;
 
+	/* The pte table was there when the speculative fault started */
+	if (vmf->flags & FAULT_FLAG_SPECULATIVE)
+		return pte_map_lock(vmf) ? 0 : VM_FAULT_RETRY;
+
 	if (!pmd_none(*vmf->pmd))
 		goto map_pte;
 	if (vmf->prealloc_pte) {
@@ -3360,7 +3440,8 @@ int alloc_set_pte(struct vm_fault *vmf, struct mem_cgroup *memcg,
 	pte_t entry;
 	int ret;
 
-	if (pmd_none(*vmf->pmd) && PageTransCompound(page) &&
+	if (!(vmf->flags & FAULT_FLAG_SPECULATIVE) &&
+			pmd_none(*vmf->pmd) && PageTransCompound(page) &&
 			IS_ENABLED(CONFIG_TRANSPARENT_HUGE_PAGECACHE)) {
 		/* THP on COW? */
 		VM_BUG_ON_PAGE(memcg, page);
@@ -3530,7 +3611,11 @@ static int do_fault_around(struct vm_fault *vmf)
 	end_pgoff = min3(end_pgoff, vma_pages(vmf->vma) + vmf->vma->vm_pgoff - 1,
 			start_pgoff + nr_pages - 1);
 
-	if (pmd_none(*vmf->pmd)) {
+	/*
+	 * A speculative fault must not look at *vmf->pmd without the ptl,
+	 * but it only gets here when there is a pte table to map into.
+	 */
+	if (!(vmf->flags & FAULT_FLAG_SPECULATIVE) && pmd_none(*vmf->pmd)) {
 		vmf->prealloc_pte = pte_alloc_one(vmf->vma->vm_mm,
 						  vmf->address);
 		if (!vmf->prealloc_pte)
@@ -3541,7 +3626,8 @@ static int do_fault_around(struct vm_fault *vmf)
 	vmf->vma->vm_ops->map_pages(vmf, start_pgoff, end_pgoff);
 
 	/* Huge page is mapped? Page fault is solved */
-	if (pmd_trans_huge(*vmf->pmd)) {
+	if (!(vmf->flags & FAULT_FLAG_SPECULATIVE) &&
+	    pmd_trans_huge(*vmf->pmd)) {
 		ret = VM_FAULT_NOPAGE;
 		goto out;
 	}
@@ -4086,6 +4172,180 @@ int handle_mm_fault(struct vm_area_struct *vma, unsigned long address,
 }
 EXPORT_SYMBOL_GPL(handle_mm_fault);
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+/* Same as the rbtree walk in find_vma(), without mmap_sem */
+static struct vm_area_struct *find_vma_speculative(struct mm_struct *mm,
+						   unsigned long addr)
+{
+	struct vm_area_struct *vma = NULL;
+	struct rb_node *rb_node;
+
+	read_lock(&mm->mm_rb_lock);
+	rb_node = mm->mm_rb.rb_node;
+	while (rb_node) {
+		struct vm_area_struct *tmp;
+
+		tmp = rb_entry(rb_node, struct vm_area_struct, vm_rb);
+		if (tmp->vm_end > addr) {
+			vma = tmp;
+			if (tmp->vm_start <= addr)
+				break;
+			rb_node = rb_node->rb_left;
+		} else
+			rb_node = rb_node->rb_right;
+	}
+	read_unlock(&mm->mm_rb_lock);
+
+	return vma;
+}
+
+/*
+ * handle_speculative_fault - try to handle a fault without mmap_sem
+ * @mm: the faulting mm, current->mm
+ * @address: faulting address
+ * @flags: FAULT_FLAG_xxx flags, as for handle_mm_fault()
+ *
+ * Handles the common cases of a fault on a pte_none() entry under an
+ * existing pte table: anonymous memory, and read faults on file mappings
+ * that ->map_pages() can serve from the page cache.  The vma is found
+ * without mmap_sem and its vm_sequence sampled; the pte is installed only
+ * if vm_sequence is unchanged once the page table lock is held.
+ *
+ * Returns VM_FAULT_RETRY if the fault was not handled, in which case the
+ * caller must take mmap_sem and go through handle_mm_fault().
+ */
+int handle_speculative_fault(struct mm_struct *mm, unsigned long address,
+			     unsigned int flags)
+{
+	struct vm_fault vmf = {
+		.address = address & PAGE_MASK,
+		/* Nothing here may drop an mmap_sem we do not hold */
+		.flags = (flags & ~(FAULT_FLAG_ALLOW_RETRY |
+				    FAULT_FLAG_RETRY_NOWAIT)) |
+			 FAULT_FLAG_SPECULATIVE,
+	};
+	bool write = flags & FAULT_FLAG_WRITE;
+	struct vm_area_struct *vma;
+	pgd_t *pgd, pgdval;
+	p4d_t *p4d, p4dval;
+	pud_t pudval;
+	pte_t *pte;
+	int idx, ret;
+
+	idx = srcu_read_lock(&vma_srcu);
+	vma = find_vma_speculative(mm, address);
+	if (!vma)
+		goto out_unlock;
+
+	/* raw_read_seqcount() orders the vma reads below after the sample */
+	vmf.sequence = raw_read_seqcount(&vma->vm_sequence);
+	if (vmf.sequence & 1)
+		goto out_abort;
+	if (address < vma->vm_start || vma->vm_end <= address)
+		goto out_abort;
+
+	/* Stack expansion, hugetlb and userfaults need mmap_sem */
+	if (vma->vm_flags & (VM_GROWSDOWN | VM_GROWSUP | VM_HUGETLB))
+		goto out_abort;
+	if (userfaultfd_armed(vma))
+		goto out_abort;
+
+	/* Let the locked path report access errors */
+	if (write ? !(vma->vm_flags & VM_WRITE) :
+		    !(vma->vm_flags & (VM_READ | VM_EXEC | VM_WRITE)))
+		goto out_abort;
+	if ((flags & FAULT_FLAG_INSTRUCTION) && !(vma->vm_flags & VM_EXEC))
+		goto out_abort;
+	if (!arch_vma_access_permitted(vma, write,
+				       flags & FAULT_FLAG_INSTRUCTION,
+				       flags & FAULT_FLAG_REMOTE))
+		goto out_abort;
+
+	if (vma_is_anonymous(vma)) {
+		/* anon_vma_prepare() relies on mmap_sem */
+		if (write && !vma->anon_vma)
+			goto out_abort;
+	} else {
+		/*
+		 * Only read faults that ->map_pages() resolves from the page
+		 * cache: ->fault() and ->page_mkwrite() may expect mmap_sem.
+		 * shmem is left out as khugepaged retracts its page tables
+		 * without taking their ptl.
+		 */
+		if (write || !vma->vm_ops->map_pages || vma_is_shmem(vma))
+			goto out_abort;
+	}
+
+	vmf.vma = vma;
+	vmf.pgoff = linear_page_index(vma, address);
+	vmf.gfp_mask = __get_fault_gfp_mask(vma);
+
+	/*
+	 * Walk the page tables with interrupts disabled, like gup_fast():
+	 * no page table can be freed under us until they are enabled again.
+	 * Populating a pmd or handling a fault on a present pte (COW, swap,
+	 * NUMA hinting) is left to the locked path.
+	 */
+	local_irq_disable();
+	pgd = pgd_offset(mm, address);
+	pgdval = READ_ONCE(*pgd);
+	if (pgd_none(pgdval) || unlikely(pgd_bad(pgdval)))
+		goto out_walk;
+
+	p4d = p4d_offset(pgd, address);
+	p4dval = READ_ONCE(*p4d);
+	if (p4d_none(p4dval) || unlikely(p4d_bad(p4dval)))
+		goto out_walk;
+
+	vmf.pud = pud_offset(p4d, address);
+	pudval = READ_ONCE(*vmf.pud);
+	if (pud_none(pudval) || unlikely(pud_bad(pudval)))
+		goto out_walk;
+
+	vmf.pmd = pmd_offset(vmf.pud, address);
+	vmf.orig_pmd = READ_ONCE(*vmf.pmd);
+	if (pmd_none(vmf.orig_pmd) || pmd_trans_huge(vmf.orig_pmd) ||
+	    pmd_devmap(vmf.orig_pmd) || unlikely(pmd_bad(vmf.orig_pmd)))
+		goto out_walk;
+
+	pte = pte_offset_map(&vmf.orig_pmd, address);
+	vmf.orig_pte = READ_ONCE(*pte);
+	pte_unmap(pte);
+	local_irq_enable();
+
+	if (!pte_none(vmf.orig_pte))
+		goto out_abort;
+
+	__set_current_state(TASK_RUNNING);
+	check_sync_rss_stat(current);
+
+	if (vma_is_anonymous(vma)) {
+		ret = do_anonymous_page(&vmf);
+	} else {
+		/* Nothing mapped at address: not cached, or not uptodate */
+		ret = do_fault_around(&vmf);
+		if (!(ret & VM_FAULT_NOPAGE))
+			ret = VM_FAULT_RETRY;
+	}
+	if (ret & (VM_FAULT_RETRY | VM_FAULT_ERROR))
+		goto out_abort;
+	srcu_read_unlock(&vma_srcu, idx);
+
+	count_vm_event(PGFAULT);
+	count_vm_event(SPECULATIVE_PGFAULT);
+	count_memcg_event_mm(mm, PGFAULT);
+	return ret & ~VM_FAULT_NOPAGE;
+
+out_walk:
+	local_irq_enable();
+out_abort:
+	count_vm_event(SPECULATIVE_PGFAULT_ABORT);
+out_unlock:
+	srcu_read_unlock(&vma_srcu, idx);
+	return VM_FAULT_RETRY;
+}
+#endif /* CONFIG_SPECULATIVE_PAGE_FAULT */
+
 #ifndef __PAGETABLE_P4D_FOLDED
 /*
  * Allocate p4d page table.
@@ -35,6 +35,7 @@
 #include <linux/memblock.h>
 #include <linux/bootmem.h>
 #include <linux/compaction.h>
+#include <linux/khugepaged.h>
 
 #include <asm/tlbflush.h>
 
@@ -965,6 +966,7 @@ int __ref online_pages(unsigned long pfn, unsigned long nr_pages, int online_typ
 	if (onlined_pages) {
 		kswapd_run(nid);
 		kcompactd_run(nid);
+		start_stop_khugepaged();
 	}
 
 	vm_total_pages = nr_free_pagecache_pages();
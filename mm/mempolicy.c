@@ -290,6 +290,31 @@ void __mpol_put(struct mempolicy *p)
 	kmem_cache_free(policy_cache, p);
 }
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+static void mpol_free_rcu(struct rcu_head *head)
+{
+	struct mempolicy *p = container_of(head, struct mempolicy, rcu);
+
+	kmem_cache_free(policy_cache, p);
+}
+
+/*
+ * Drop a policy that was just detached from a vma.  A speculative fault
+ * may still be allocating with it, so free it after a vma_srcu grace
+ * period instead of waiting for one.
+ */
+static void vma_mpol_put(struct mempolicy *p)
+{
+	if (p && atomic_dec_and_test(&p->refcnt))
+		call_srcu(&vma_srcu, &p->rcu, mpol_free_rcu);
+}
+#else
+static inline void vma_mpol_put(struct mempolicy *p)
+{
+	mpol_put(p);
+}
+#endif
+
 static void mpol_rebind_default(struct mempolicy *pol, const nodemask_t *nodes)
 {
 }
@@ -687,9 +712,11 @@ static int vma_replace_policy(struct vm_area_struct *vma,
 			goto err_out;
 	}
 
+	vm_write_begin(vma);
 	old = vma->vm_policy;
 	vma->vm_policy = new; /* protected by mmap_sem */
-	mpol_put(old);
+	vm_write_end(vma);
+	vma_mpol_put(old);
 
 	return 0;
  err_out:
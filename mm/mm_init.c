@@ -71,12 +71,14 @@ void __init mminit_verify_pageflags_layout(void)
 	unsigned long or_mask, add_mask;
 
 	shift = 8 * sizeof(unsigned long);
-	width = shift - SECTIONS_WIDTH - NODES_WIDTH - ZONES_WIDTH - LAST_CPUPID_SHIFT;
+	width = shift - SECTIONS_WIDTH - NODES_WIDTH - ZONES_WIDTH -
+		LRU_GEN_WIDTH - LAST_CPUPID_SHIFT;
 	mminit_dprintk(MMINIT_TRACE, "pageflags_layout_widths",
-		"Section %d Node %d Zone %d Lastcpupid %d Flags %d\n",
+		"Section %d Node %d Zone %d Gen %d Lastcpupid %d Flags %d\n",
 		SECTIONS_WIDTH,
 		NODES_WIDTH,
 		ZONES_WIDTH,
+		LRU_GEN_WIDTH,
 		LAST_CPUPID_WIDTH,
 		NR_PAGEFLAGS);
 	mminit_dprintk(MMINIT_TRACE, "pageflags_layout_shifts",
@@ -119,14 +121,20 @@ void __init mminit_verify_pageflags_layout(void)
 		shift -= ZONES_WIDTH;
 		BUG_ON(shift != ZONES_PGSHIFT);
 	}
+	if (LRU_GEN_WIDTH) {
+		shift -= LRU_GEN_WIDTH;
+		BUG_ON(shift != LRU_GEN_PGSHIFT);
+	}
 
 	/* Check for bitmask overlaps */
 	or_mask = (ZONES_MASK << ZONES_PGSHIFT) |
 			(NODES_MASK << NODES_PGSHIFT) |
-			(SECTIONS_MASK << SECTIONS_PGSHIFT);
+			(SECTIONS_MASK << SECTIONS_PGSHIFT) |
+			LRU_GEN_MASK;
 	add_mask = (ZONES_MASK << ZONES_PGSHIFT) +
 			(NODES_MASK << NODES_PGSHIFT) +
-			(SECTIONS_MASK << SECTIONS_PGSHIFT);
+			(SECTIONS_MASK << SECTIONS_PGSHIFT) +
+			LRU_GEN_MASK;
 	BUG_ON(or_mask != add_mask);
 }
 
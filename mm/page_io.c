@@ -24,15 +24,16 @@
 #include <linux/blkdev.h>
 #include <linux/uio.h>
 #include <linux/sched/task.h>
+#include <linux/workqueue.h>
 #include <asm/pgtable.h>
 
-static struct bio *get_swap_bio(gfp_t gfp_flags,
-				struct page *page, bio_end_io_t end_io)
+static struct bio *__get_swap_bio(gfp_t gfp_flags, struct page *page,
+				  bio_end_io_t end_io, int nr_vecs)
 {
 	int i, nr = hpage_nr_pages(page);
 	struct bio *bio;
 
-	bio = bio_alloc(gfp_flags, nr);
+	bio = bio_alloc(gfp_flags, max(nr, nr_vecs));
 	if (bio) {
 		struct block_device *bdev;
 
@@ -48,27 +49,44 @@ static struct bio *get_swap_bio(gfp_t gfp_flags,
 	return bio;
 }
 
+static struct bio *get_swap_bio(gfp_t gfp_flags,
+				struct page *page, bio_end_io_t end_io)
+{
+	return __get_swap_bio(gfp_flags, page, end_io, 1);
+}
+
 void end_swap_bio_write(struct bio *bio)
 {
-	struct page *page = bio->bi_io_vec[0].bv_page;
+	struct bio_vec *bvec;
+	int i;
 
-	if (bio->bi_status) {
-		SetPageError(page);
-		/*
-		 * We failed to write the page out to swap-space.
-		 * Re-dirty the page in order to avoid it being reclaimed.
-		 * Also print a dire warning that things will go BAD (tm)
-		 * very quickly.
-		 *
-		 * Also clear PG_reclaim to avoid rotate_reclaimable_page()
-		 */
-		set_page_dirty(page);
+	bio_for_each_segment_all(bvec, bio, i) {
+		struct page *page = bvec->bv_page;
+
+		/* a THP is written out whole, and ends with its head page */
+		if (PageTail(page))
+			continue;
+
+		if (bio->bi_status) {
+			SetPageError(page);
+			/*
+			 * We failed to write the page out to swap-space.
+			 * Re-dirty the page in order to avoid it being
+			 * reclaimed.  Also print a dire warning that things
+			 * will go BAD (tm) very quickly.
+			 *
+			 * Also clear PG_reclaim to avoid
+			 * rotate_reclaimable_page()
+			 */
+			set_page_dirty(page);
+			ClearPageReclaim(page);
+		}
+		end_page_writeback(page);
+	}
+	if (bio->bi_status)
 		pr_alert("Write-error on swap-device (%u:%u:%llu)\n",
 			 MAJOR(bio_dev(bio)), MINOR(bio_dev(bio)),
 			 (unsigned long long)bio->bi_iter.bi_sector);
-		ClearPageReclaim(page);
-	}
-	end_page_writeback(page);
 	bio_put(bio);
 }
 
@@ -122,26 +140,136 @@ static void swap_slot_free_notify(struct page *page)
 
 static void end_swap_bio_read(struct bio *bio)
 {
-	struct page *page = bio->bi_io_vec[0].bv_page;
 	struct task_struct *waiter = bio->bi_private;
+	struct bio_vec *bvec;
+	int i;
 
-	if (bio->bi_status) {
-		SetPageError(page);
-		ClearPageUptodate(page);
+	bio_for_each_segment_all(bvec, bio, i) {
+		struct page *page = bvec->bv_page;
+
+		if (bio->bi_status) {
+			SetPageError(page);
+			ClearPageUptodate(page);
+		} else {
+			SetPageUptodate(page);
+			swap_slot_free_notify(page);
+		}
+		unlock_page(page);
+	}
+	if (bio->bi_status)
 		pr_alert("Read-error on swap-device (%u:%u:%llu)\n",
 			 MAJOR(bio_dev(bio)), MINOR(bio_dev(bio)),
 			 (unsigned long long)bio->bi_iter.bi_sector);
-		goto out;
-	}
 
-	SetPageUptodate(page);
-	swap_slot_free_notify(page);
-out:
-	unlock_page(page);
 	WRITE_ONCE(bio->bi_private, NULL);
 	bio_put(bio);
-	wake_up_process(waiter);
-	put_task_struct(waiter);
+	/* reads gathered under a plug have nobody waiting on the bio */
+	if (waiter) {
+		wake_up_process(waiter);
+		put_task_struct(waiter);
+	}
+}
+
+/*
+ * Swap I/O issued under a block plug to adjacent slots of a swap device is
+ * gathered into one bio per device, which is submitted when the plug is
+ * flushed, or when the next page does not fit.  This is what pages that
+ * shrink_page_list() reclaims together get, as they are allocated in a run
+ * from the per-cpu swap cluster, and what a swapin_readahead() window gets.
+ */
+#define SWAP_PLUG_PAGES		32
+
+struct swap_plug_cb {
+	struct blk_plug_cb cb;
+	struct bio *bio;
+	struct work_struct work;
+};
+
+/*
+ * Submits the bios of plugs flushed on the way into schedule().  That is
+ * reclaim waiting for writeback or a page lock, so it needs a rescuer: the
+ * I/O may be what frees the memory a new kworker would need.
+ */
+static struct workqueue_struct *swap_plug_wq;
+
+static int __init swap_plug_init(void)
+{
+	swap_plug_wq = alloc_workqueue("swap_plug", WQ_MEM_RECLAIM, 0);
+	if (!swap_plug_wq)
+		pr_warn("Failed to create swap_plug workqueue, swap I/O will not be gathered\n");
+	return 0;
+}
+subsys_initcall(swap_plug_init);
+
+static void swap_plug_work(struct work_struct *work)
+{
+	struct swap_plug_cb *plug = container_of(work, struct swap_plug_cb,
+						 work);
+
+	submit_bio(plug->bio);
+	kfree(plug);
+}
+
+static void swap_unplug(struct blk_plug_cb *cb, bool from_schedule)
+{
+	struct swap_plug_cb *plug = container_of(cb, struct swap_plug_cb, cb);
+
+	if (!plug->bio) {
+		kfree(plug);
+		return;
+	}
+
+	/* On the way into schedule(): submitting the bio may block */
+	if (from_schedule) {
+		INIT_WORK(&plug->work, swap_plug_work);
+		queue_work(swap_plug_wq, &plug->work);
+		return;
+	}
+
+	submit_bio(plug->bio);
+	kfree(plug);
+}
+
+/*
+ * Add the locked order-0 @page to the plugged swap bio of its device, or
+ * start a new one.  Returns false when there is no plug to gather under,
+ * or no bio, and the caller should submit the page on its own.
+ */
+static bool swap_bio_plugged(struct swap_info_struct *sis, struct page *page,
+			     unsigned int opf, bio_end_io_t end_io)
+{
+	struct swap_plug_cb *plug;
+	struct blk_plug_cb *cb;
+	struct block_device *bdev;
+	struct bio *bio;
+	sector_t sector;
+
+	if (!swap_plug_wq)
+		return false;
+
+	cb = blk_check_plugged(swap_unplug, sis, sizeof(*plug));
+	if (!cb)
+		return false;
+	plug = container_of(cb, struct swap_plug_cb, cb);
+
+	bio = plug->bio;
+	if (bio) {
+		sector = map_swap_page(page, &bdev) << (PAGE_SHIFT - 9);
+		if (bio->bi_opf == opf && bio->bi_end_io == end_io &&
+		    bio_end_sector(bio) == sector &&
+		    bio_add_page(bio, page, PAGE_SIZE, 0) == PAGE_SIZE)
+			return true;
+		/* not adjacent, or full: the page starts the next bio */
+		submit_bio(bio);
+		plug->bio = NULL;
+	}
+
+	bio = __get_swap_bio(GFP_NOIO, page, end_io, SWAP_PLUG_PAGES);
+	if (!bio)
+		return false;
+	bio->bi_opf = opf;
+	plug->bio = bio;
+	return true;
 }
 
 int generic_swapfile_activate(struct swap_info_struct *sis,
@@ -331,6 +459,15 @@ int __swap_writepage(struct page *page, struct writeback_control *wbc,
 	}
 
 	ret = 0;
+	if (!PageTransHuge(page) &&
+	    swap_bio_plugged(sis, page, REQ_OP_WRITE | wbc_to_write_flags(wbc),
+			     end_write_func)) {
+		count_swpout_vm_event(page);
+		set_page_writeback(page);
+		unlock_page(page);
+		return 0;
+	}
+
 	bio = get_swap_bio(GFP_NOIO, page, end_write_func);
 	if (bio == NULL) {
 		set_page_dirty(page);
@@ -386,6 +523,12 @@ int swap_readpage(struct page *page, bool do_poll)
 	}
 
 	ret = 0;
+	if (!do_poll && swap_bio_plugged(sis, page, REQ_OP_READ,
+					 end_swap_bio_read)) {
+		count_vm_event(PSWPIN);
+		goto out;
+	}
+
 	bio = get_swap_bio(GFP_KERNEL, page, end_swap_bio_read);
 	if (bio == NULL) {
 		unlock_page(page);
@@ -19,9 +19,13 @@
 #include <linux/syscalls.h>
 #include <linux/file.h>
 #include <linux/mm_inline.h>
+#include <linux/slab.h>
 
 #include "internal.h"
 
+#define CREATE_TRACE_POINTS
+#include <trace/events/readahead.h>
+
 /*
  * Initialise a struct file's readahead state.  Assumes that the caller has
  * memset *ra to zero.
@@ -34,6 +38,15 @@ file_ra_state_init(struct file_ra_state *ra, struct address_space *mapping)
 }
 EXPORT_SYMBOL_GPL(file_ra_state_init);
 
+/*
+ * Free the readahead state that reads of a struct file allocated.
+ */
+void file_ra_state_free(struct file_ra_state *ra)
+{
+	kfree(ra->strides);
+	ra->strides = NULL;
+}
+
 /*
  * see if a page needs releasing upon read_cache_pages() failure
  * - the caller of read_cache_pages() may have set PG_private or PG_fscache
@@ -369,6 +382,168 @@ static int try_context_readahead(struct address_space *mapping,
 	return 1;
 }
 
+/*
+ * Strided readahead.
+ *
+ * The last few random reads of a file are kept in its ra_strides.  When three
+ * of them are the same distance apart, more than the size of the read, they
+ * start a strided stream, and the next reads of the stream are read ahead:
+ * as many as a readahead window's worth of pages.  A readahead marker in
+ * the middle of them lets page_cache_async_readahead() push the stream on
+ * as it is read, much like a sequential window.
+ */
+#define RA_STREAM_MAX_AHEAD	32
+
+/* move a stream to the front of st->streams, for LRU replacement */
+static struct ra_stream *ra_stream_touch(struct ra_strides *st, int i)
+{
+	struct ra_stream rs = st->streams[i];
+
+	memmove(&st->streams[1], &st->streams[0], i * sizeof(rs));
+	st->streams[0] = rs;
+	return &st->streams[0];
+}
+
+/*
+ * Find the stream @offset is a read of, at most one past what was read
+ * ahead, and return the number of strides it is past the stream's start.
+ */
+static struct ra_stream *ra_stream_lookup(struct ra_strides *st,
+					  pgoff_t offset, unsigned long *nr)
+{
+	int i;
+
+	for (i = 0; i < RA_NR_STREAMS; i++) {
+		struct ra_stream *rs = &st->streams[i];
+		unsigned int stride = READ_ONCE(rs->stride);
+		pgoff_t start = READ_ONCE(rs->start);
+
+		if (!stride || offset <= start || (offset - start) % stride)
+			continue;
+		*nr = (offset - start) / stride;
+		if (*nr > rs->ahead + 1)
+			continue;
+		return ra_stream_touch(st, i);
+	}
+	return NULL;
+}
+
+/* look for a stride ending at @offset among the recent random reads */
+static unsigned int ra_stride_detect(struct ra_strides *st,
+				     pgoff_t offset, unsigned long req_size)
+{
+	int i, j;
+
+	for (i = 0; i < RA_NR_HISTORY; i++) {
+		pgoff_t prev = st->history[i];
+		pgoff_t stride = offset - prev;
+
+		if (prev <= stride || stride <= req_size || stride > UINT_MAX)
+			continue;
+		for (j = 0; j < RA_NR_HISTORY; j++) {
+			if (st->history[j] == prev - stride)
+				return stride;
+		}
+	}
+	return 0;
+}
+
+/* the strided stream state of @filp, allocated on first use */
+static struct ra_strides *ra_strides_get(struct address_space *mapping,
+					 struct file_ra_state *ra,
+					 struct file *filp)
+{
+	struct ra_strides *st = READ_ONCE(ra->strides);
+
+	/* only a struct file frees it, see file_ra_state_free() */
+	if (st || !filp || ra != &filp->f_ra)
+		return st;
+
+	st = kzalloc(sizeof(*st), mapping_gfp_constraint(mapping,
+			GFP_KERNEL) | __GFP_NORETRY | __GFP_NOWARN);
+	if (!st)
+		return NULL;
+
+	/* readers of the same file race for it */
+	if (cmpxchg(&ra->strides, NULL, st)) {
+		kfree(st);
+		st = READ_ONCE(ra->strides);
+	}
+	return st;
+}
+
+/* move the stream on to @offset and read its next reads ahead */
+static unsigned long
+ra_stream_submit(struct address_space *mapping, struct ra_strides *st,
+		 struct file *filp, struct ra_stream *rs, pgoff_t offset,
+		 unsigned long nr, bool hit_readahead_marker,
+		 unsigned long max_pages)
+{
+	unsigned int stride = READ_ONCE(rs->stride);
+	unsigned int size = READ_ONCE(rs->size);
+	unsigned int ahead, mark, i;
+	unsigned long nr_pages = 0;
+
+	/* another reader of the file may be reusing the stream */
+	if (!stride || !size)
+		return 0;
+
+	rs->ahead = rs->ahead > nr ? rs->ahead - nr : 0;
+	rs->start = offset;
+
+	ahead = clamp_t(unsigned long, max_pages / size, 1,
+			RA_STREAM_MAX_AHEAD);
+	mark = (rs->ahead + 1 + ahead) / 2;
+	for (i = rs->ahead + 1; i <= ahead; i++)
+		nr_pages += __do_page_cache_readahead(mapping, filp,
+				offset + (pgoff_t)i * stride, size,
+				i == mark ? size : 0);
+	rs->ahead = max_t(unsigned int, rs->ahead, ahead);
+
+	trace_mm_readahead_stride(mapping, st, rs, hit_readahead_marker,
+				  nr_pages);
+	return nr_pages;
+}
+
+/*
+ * A random read which is either on a known stream, having missed what was
+ * read ahead or got past it, or which may start a new one.
+ */
+static unsigned long
+stride_readahead(struct address_space *mapping, struct file_ra_state *ra,
+		 struct file *filp, pgoff_t offset, unsigned long req_size,
+		 unsigned long max_pages)
+{
+	struct ra_strides *st;
+	struct ra_stream *rs;
+	unsigned int stride;
+	unsigned long nr;
+
+	st = ra_strides_get(mapping, ra, filp);
+	if (!st)
+		return 0;
+
+	rs = ra_stream_lookup(st, offset, &nr);
+	if (rs) {
+		st->hits += nr - 1;
+		st->misses++;
+		return ra_stream_submit(mapping, st, filp, rs, offset, nr,
+					false, max_pages);
+	}
+
+	st->history[st->history_next++ % RA_NR_HISTORY] = offset;
+	stride = ra_stride_detect(st, offset, req_size);
+	if (!stride)
+		return 0;
+
+	rs = ra_stream_touch(st, RA_NR_STREAMS - 1);
+	rs->stride = stride;
+	rs->size = req_size;
+	rs->ahead = 0;
+	return ra_stream_submit(mapping, st, filp, rs, offset, 0, false,
+				max_pages);
+}
+
 /*
  * A minimal readahead algorithm for trivial sequential/random reads.
  */
@@ -395,6 +570,23 @@ ondemand_readahead(struct address_space *mapping,
 	if (!offset)
 		goto initial_readahead;
 
+	/*
+	 * Hit the readahead marker of a strided stream: the reads before it
+	 * were all served from the page cache.
+	 */
+	if (hit_readahead_marker && ra->strides) {
+		struct ra_strides *st = ra->strides;
+		struct ra_stream *rs;
+		unsigned long nr;
+
+		rs = ra_stream_lookup(st, offset, &nr);
+		if (rs) {
+			st->hits += nr;
+			return ra_stream_submit(mapping, st, filp, rs, offset,
+						nr, true, max_pages);
+		}
+	}
+
 	/*
 	 * It's the expected callback offset, assume sequential access.
 	 * Ramp up sizes, and push forward the readahead window.
@@ -455,9 +647,12 @@ ondemand_readahead(struct address_space *mapping,
 
 	/*
 	 * standalone, small random read
-	 * Read as is, and do not pollute the readahead state.
+	 * Read as is, and do not pollute the readahead state, other than
+	 * to look for strided streams.
 	 */
-	return __do_page_cache_readahead(mapping, filp, offset, req_size, 0);
+	return __do_page_cache_readahead(mapping, filp, offset, req_size, 0) +
+	       stride_readahead(mapping, ra, filp, offset, req_size,
+				max_pages);
 
 initial_readahead:
 	ra->start = offset;
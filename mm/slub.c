@@ -170,6 +170,11 @@ static inline bool kmem_cache_has_cpu_partial(struct kmem_cache *s)
  */
 #define MAX_PARTIAL 10
 
+/*
+ * Maximum number of objects in a per cpu array (SLAB_PCPU_ARRAY).
+ */
+#define SLUB_PCPU_ARRAY_MAX 64
+
 #define DEBUG_DEFAULT_FLAGS (SLAB_CONSISTENCY_CHECKS | SLAB_RED_ZONE | \
 				SLAB_POISON | SLAB_STORE_USER)
 
@@ -2308,6 +2313,57 @@ static inline void flush_slab(struct kmem_cache *s, struct kmem_cache_cpu *c)
 	c->tid = next_tid(c->tid);
 }
 
+/*
+ * Per cpu object arrays (SLAB_PCPU_ARRAY).
+ *
+ * A cache can keep a small stack of objects on each cpu in front of the
+ * cpu slab. Allocating and freeing then only pops and pushes a pointer with
+ * interrupts disabled, without touching slab pages, which matters most when
+ * objects are freed on another cpu than the one they were allocated on.
+ * An empty array is refilled and a full one flushed a batch at a time, the
+ * way kmem_cache_alloc_bulk() and kmem_cache_free_bulk() move objects, so a
+ * single freelist update covers many objects.
+ *
+ * The arrays sit below the alloc and free hooks: an object in an array is
+ * free as far as memcg, kasan and kmemleak are concerned.
+ */
+static void __slab_free_bulk(struct kmem_cache *s, size_t size, void **p);
+
+/* Hand the nr oldest objects in the array back to their slabs */
+static void pcpu_array_flush(struct kmem_cache *s,
+			     struct slub_percpu_array *pca, unsigned int nr)
+{
+	__slab_free_bulk(s, nr, pca->objects);
+	pca->count -= nr;
+	memmove(pca->objects, pca->objects + nr, pca->count * sizeof(void *));
+}
+
+static __always_inline bool pcpu_array_free(struct kmem_cache *s, void *object)
+{
+	struct slub_percpu_array *pca;
+	unsigned long flags;
+	unsigned int size;
+
+	local_irq_save(flags);
+	size = READ_ONCE(s->cpu_array_size);
+	if (unlikely(!size)) {
+		local_irq_restore(flags);
+		return false;
+	}
+
+	pca = this_cpu_ptr(s->cpu_array);
+	if (unlikely(pca->count >= size)) {
+		pcpu_array_flush(s, pca, min_t(unsigned int, pca->count,
+					       s->cpu_array_batch));
+		stat(s, FREE_PCPU_ARRAY_FLUSH);
+	}
+	pca->objects[pca->count++] = object;
+	stat(s, FREE_PCPU_ARRAY);
+	local_irq_restore(flags);
+
+	return true;
+}
+
 /*
  * Flush cpu slab.
  *
@@ -2317,6 +2373,14 @@ static inline void __flush_cpu_slab(struct kmem_cache *s, int cpu)
 {
 	struct kmem_cache_cpu *c = per_cpu_ptr(s->cpu_slab, cpu);
 
+	if (s->cpu_array) {
+		struct slub_percpu_array *pca = per_cpu_ptr(s->cpu_array, cpu);
+
+		/* Before the cpu slab, which may take some of the objects */
+		if (pca->count)
+			pcpu_array_flush(s, pca, pca->count);
+	}
+
 	if (likely(c)) {
 		if (c->page)
 			flush_slab(s, c);
@@ -2337,6 +2401,9 @@ static bool has_cpu_slab(int cpu, void *info)
 	struct kmem_cache *s = info;
 	struct kmem_cache_cpu *c = per_cpu_ptr(s->cpu_slab, cpu);
 
+	if (s->cpu_array && per_cpu_ptr(s->cpu_array, cpu)->count)
+		return true;
+
 	return c->page || slub_percpu_partial(c);
 }
 
@@ -2651,6 +2718,97 @@ static void *__slab_alloc(struct kmem_cache *s, gfp_t gfpflags, int node,
 	return p;
 }
 
+/*
+ * Take up to size objects off the cpu slab, going to the slowpath for more
+ * slabs as needed. The core of kmem_cache_alloc_bulk(), without the hooks.
+ *
+ * Called with interrupts disabled. They are enabled again while allocating
+ * a new slab if the gfp flags allow blocking, so we may return on another
+ * cpu.
+ */
+static int __slab_alloc_bulk(struct kmem_cache *s, gfp_t flags, size_t size,
+			     void **p)
+{
+	struct kmem_cache_cpu *c = this_cpu_ptr(s->cpu_slab);
+	int i;
+
+	for (i = 0; i < size; i++) {
+		void *object = c->freelist;
+
+		if (unlikely(!object)) {
+			/*
+			 * Invoking slow path likely have side-effect
+			 * of re-populating per CPU c->freelist
+			 */
+			p[i] = ___slab_alloc(s, flags, NUMA_NO_NODE,
+					    _RET_IP_, c);
+			c = this_cpu_ptr(s->cpu_slab);
+			if (unlikely(!p[i]))
+				break;
+
+			continue; /* goto for-loop */
+		}
+		c->freelist = get_freepointer(s, object);
+		p[i] = object;
+	}
+	c->tid = next_tid(c->tid);
+
+	return i;
+}
+
+/*
+ * Refill an empty per cpu array with a batch of objects. Called with
+ * interrupts disabled, see __slab_alloc_bulk() for why the objects may end
+ * up in the array of another cpu, which need not have room for all of them.
+ */
+static noinline void pcpu_array_refill(struct kmem_cache *s, gfp_t gfpflags)
+{
+	void *objects[SLUB_PCPU_ARRAY_MAX / 2];
+	struct slub_percpu_array *pca;
+	unsigned int size;
+	int nr, i;
+
+	nr = __slab_alloc_bulk(s, gfpflags & ~__GFP_ZERO, s->cpu_array_batch,
+			       objects);
+	if (!nr)
+		return;
+	stat(s, ALLOC_PCPU_ARRAY_REFILL);
+
+	size = READ_ONCE(s->cpu_array_size);
+	pca = this_cpu_ptr(s->cpu_array);
+	for (i = 0; i < nr && pca->count < size; i++)
+		pca->objects[pca->count++] = objects[i];
+
+	if (unlikely(i < nr))
+		__slab_free_bulk(s, nr - i, objects + i);
+}
+
+static __always_inline void *pcpu_array_alloc(struct kmem_cache *s,
+					      gfp_t gfpflags)
+{
+	struct slub_percpu_array *pca;
+	unsigned long flags;
+	void *object = NULL;
+
+	local_irq_save(flags);
+	if (unlikely(!READ_ONCE(s->cpu_array_size)))
+		goto out;
+
+	pca = this_cpu_ptr(s->cpu_array);
+	if (unlikely(!pca->count)) {
+		pcpu_array_refill(s, gfpflags);
+		pca = this_cpu_ptr(s->cpu_array);
+	}
+	if (likely(pca->count)) {
+		object = pca->objects[--pca->count];
+		stat(s, ALLOC_PCPU_ARRAY);
+	}
+out:
+	local_irq_restore(flags);
+
+	return object;
+}
+
 /*
  * Inlined fastpath so that allocation functions (kmalloc, kmem_cache_alloc)
  * have the fastpath folded into their functions. So no function call
@@ -2672,6 +2830,12 @@ static __always_inline void *slab_alloc_node(struct kmem_cache *s,
 	s = slab_pre_alloc_hook(s, gfpflags);
 	if (!s)
 		return NULL;
+
+	if (s->cpu_array && node == NUMA_NO_NODE) {
+		object = pcpu_array_alloc(s, gfpflags);
+		if (likely(object))
+			goto out;
+	}
 redo:
 	/*
 	 * Must read kmem_cache cpu data via this cpu ptr. Preemption is
@@ -2739,7 +2903,7 @@ static __always_inline void *slab_alloc_node(struct kmem_cache *s,
 		prefetch_freepointer(s, next_object);
 		stat(s, ALLOC_FASTPATH);
 	}
-
+out:
 	if (unlikely(gfpflags & __GFP_ZERO) && object)
 		memset(object, 0, s->object_size);
 
@@ -2993,6 +3157,8 @@ static __always_inline void slab_free(struct kmem_cache *s, struct page *page,
 	 */
 	if (s->flags & SLAB_KASAN && !(s->flags & SLAB_TYPESAFE_BY_RCU))
 		return;
+	if (s->cpu_array && !tail && pcpu_array_free(s, head))
+		return;
 	do_slab_free(s, page, head, tail, cnt, addr);
 }
 
@@ -3104,6 +3270,24 @@ int build_detached_freelist(struct kmem_cache *s, size_t size,
 	return first_skipped_index;
 }
 
+/*
+ * The core of kmem_cache_free_bulk(), without the hooks, for objects that
+ * already went through them. May be called with interrupts disabled.
+ */
+static void __slab_free_bulk(struct kmem_cache *s, size_t size, void **p)
+{
+	do {
+		struct detached_freelist df;
+
+		size = build_detached_freelist(s, size, p, &df);
+		if (!df.page)
+			continue;
+
+		do_slab_free(df.s, df.page, df.freelist, df.tail, df.cnt,
+			     _RET_IP_);
+	} while (likely(size));
+}
+
 /* Note that interrupts must be enabled when calling this function. */
 void kmem_cache_free_bulk(struct kmem_cache *s, size_t size, void **p)
 {
@@ -3126,7 +3310,6 @@ EXPORT_SYMBOL(kmem_cache_free_bulk);
 int kmem_cache_alloc_bulk(struct kmem_cache *s, gfp_t flags, size_t size,
 			  void **p)
 {
-	struct kmem_cache_cpu *c;
 	int i;
 
 	/* memcg and kmem_cache debug support */
@@ -3139,29 +3322,10 @@ int kmem_cache_alloc_bulk(struct kmem_cache *s, gfp_t flags, size_t size,
 	 * handlers invoking normal fastpath.
 	 */
 	local_irq_disable();
-	c = this_cpu_ptr(s->cpu_slab);
-
-	for (i = 0; i < size; i++) {
-		void *object = c->freelist;
-
-		if (unlikely(!object)) {
-			/*
-			 * Invoking slow path likely have side-effect
-			 * of re-populating per CPU c->freelist
-			 */
-			p[i] = ___slab_alloc(s, flags, NUMA_NO_NODE,
-					    _RET_IP_, c);
-			if (unlikely(!p[i]))
-				goto error;
-
-			c = this_cpu_ptr(s->cpu_slab);
-			continue; /* goto for-loop */
-		}
-		c->freelist = get_freepointer(s, object);
-		p[i] = object;
-	}
-	c->tid = next_tid(c->tid);
+	i = __slab_alloc_bulk(s, flags, size, p);
 	local_irq_enable();
+	if (unlikely(i < size))
+		goto error;
 
 	/* Clear memory outside IRQ disabled fastpath loop */
 	if (unlikely(flags & __GFP_ZERO)) {
@@ -3175,7 +3339,6 @@ int kmem_cache_alloc_bulk(struct kmem_cache *s, gfp_t flags, size_t size,
 	slab_post_alloc_hook(s, flags, size, p);
 	return i;
 error:
-	local_irq_enable();
 	slab_post_alloc_hook(s, flags, i, p);
 	__kmem_cache_free_bulk(s, i, p);
 	return 0;
@@ -3333,6 +3496,17 @@ static inline int alloc_kmem_cache_cpus(struct kmem_cache *s)
 	if (!s->cpu_slab)
 		return 0;
 
+	if (s->cpu_array_size) {
+		s->cpu_array = __alloc_percpu(sizeof(struct slub_percpu_array) +
+				s->cpu_array_size * sizeof(void *),
+				sizeof(void *));
+		if (!s->cpu_array) {
+			free_percpu(s->cpu_slab);
+			s->cpu_slab = NULL;
+			return 0;
+		}
+	}
+
 	init_kmem_cache_cpus(s);
 
 	return 1;
@@ -3400,6 +3574,7 @@ static void free_kmem_cache_nodes(struct kmem_cache *s)
 void __kmem_cache_release(struct kmem_cache *s)
 {
 	cache_random_seq_destroy(s);
+	free_percpu(s->cpu_array);
 	free_percpu(s->cpu_slab);
 	free_kmem_cache_nodes(s);
 }
@@ -3471,6 +3646,34 @@ static void set_cpu_partial(struct kmem_cache *s)
 #endif
 }
 
+/*
+ * Number of objects the per cpu arrays of a cache have room for. Debug
+ * caches get none: objects parked in an array would skip the checks done
+ * on the slowpaths.
+ */
+static unsigned int pcpu_array_capacity(struct kmem_cache *s)
+{
+	if (!(s->flags & SLAB_PCPU_ARRAY) || kmem_cache_debug(s))
+		return 0;
+	if (s->size >= PAGE_SIZE)
+		return 8;
+	if (s->size >= 1024)
+		return 16;
+	if (s->size >= 256)
+		return 32;
+	return SLUB_PCPU_ARRAY_MAX;
+}
+
+/*
+ * Half of the array is refilled or flushed at a time, leaving room for
+ * both allocations and frees afterwards.
+ */
+static void set_cpu_array(struct kmem_cache *s, unsigned int objects)
+{
+	s->cpu_array_batch = max(objects / 2, 1U);
+	WRITE_ONCE(s->cpu_array_size, objects);
+}
+
 /*
  * calculate_sizes() determines the order and the distribution of data within
  * a slab object.
@@ -3633,6 +3836,7 @@ static int kmem_cache_open(struct kmem_cache *s, unsigned long flags)
 	set_min_partial(s, ilog2(s->size) / 2);
 
 	set_cpu_partial(s);
+	set_cpu_array(s, pcpu_array_capacity(s));
 
 #ifdef CONFIG_NUMA
 	s->remote_node_defrag_ratio = 1000;
@@ -4021,10 +4225,12 @@ void __kmemcg_cache_deactivate(struct kmem_cache *s)
 	 */
 	slub_set_cpu_partial(s, 0);
 	s->min_partial = 0;
+	set_cpu_array(s, 0);
 
 	/*
-	 * s->cpu_partial is checked locklessly (see put_cpu_partial), so
-	 * we have to make sure the change is visible before shrinking.
+	 * s->cpu_partial and s->cpu_array_size are checked locklessly (see
+	 * put_cpu_partial and pcpu_array_free), so we have to make sure the
+	 * change is visible before shrinking.
 	 */
 	slab_deactivate_memcg_cache_rcu_sched(s, kmemcg_cache_deact_after_rcu);
 }
@@ -4980,6 +5186,29 @@ static ssize_t cpu_partial_store(struct kmem_cache *s, const char *buf,
 }
 SLAB_ATTR(cpu_partial);
 
+static ssize_t cpu_array_show(struct kmem_cache *s, char *buf)
+{
+	return sprintf(buf, "%u\n", READ_ONCE(s->cpu_array_size));
+}
+
+static ssize_t cpu_array_store(struct kmem_cache *s, const char *buf,
+			       size_t length)
+{
+	unsigned long objects;
+	int err;
+
+	err = kstrtoul(buf, 10, &objects);
+	if (err)
+		return err;
+	if (objects && (!s->cpu_array || objects > pcpu_array_capacity(s)))
+		return -EINVAL;
+
+	set_cpu_array(s, objects);
+	flush_all(s);
+	return length;
+}
+SLAB_ATTR(cpu_array);
+
 static ssize_t ctor_show(struct kmem_cache *s, char *buf)
 {
 	if (!s->ctor)
@@ -5385,6 +5614,10 @@ STAT_ATTR(CPU_PARTIAL_ALLOC, cpu_partial_alloc);
 STAT_ATTR(CPU_PARTIAL_FREE, cpu_partial_free);
 STAT_ATTR(CPU_PARTIAL_NODE, cpu_partial_node);
 STAT_ATTR(CPU_PARTIAL_DRAIN, cpu_partial_drain);
+STAT_ATTR(ALLOC_PCPU_ARRAY, alloc_cpu_array);
+STAT_ATTR(ALLOC_PCPU_ARRAY_REFILL, alloc_cpu_array_refill);
+STAT_ATTR(FREE_PCPU_ARRAY, free_cpu_array);
+STAT_ATTR(FREE_PCPU_ARRAY_FLUSH, free_cpu_array_flush);
 #endif
 
 static struct attribute *slab_attrs[] = {
@@ -5394,6 +5627,7 @@ static struct attribute *slab_attrs[] = {
 	&order_attr.attr,
 	&min_partial_attr.attr,
 	&cpu_partial_attr.attr,
+	&cpu_array_attr.attr,
 	&objects_attr.attr,
 	&objects_partial_attr.attr,
 	&partial_attr.attr,
@@ -5452,6 +5686,10 @@ static struct attribute *slab_attrs[] = {
 	&cpu_partial_free_attr.attr,
 	&cpu_partial_node_attr.attr,
 	&cpu_partial_drain_attr.attr,
+	&alloc_cpu_array_attr.attr,
+	&alloc_cpu_array_refill_attr.attr,
+	&free_cpu_array_attr.attr,
+	&free_cpu_array_flush_attr.attr,
 #endif
 #ifdef CONFIG_FAILSLAB
 	&failslab_attr.attr,
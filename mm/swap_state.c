@@ -567,9 +567,13 @@ struct page *swapin_readahead(swp_entry_t entry, gfp_t gfp_mask,
 		goto skip;
 
 	do_poll = false;
-	/* Read a page_cluster sized and aligned cluster around offset. */
+	/*
+	 * Read a page_cluster sized and aligned cluster around offset,
+	 * within the swap cluster it was written out with.
+	 */
 	start_offset = offset & ~mask;
 	end_offset = offset | mask;
+	swap_cluster_clamp(entry, &start_offset, &end_offset);
 	if (!start_offset)	/* First page is swap header. */
 		start_offset++;
 
@@ -3458,6 +3458,23 @@ struct swap_info_struct *page_swap_info(struct page *page)
 	return swap_info[swp_type(swap)];
 }
 
+/*
+ * Clamp the swapin readahead window [*start, *end] around @entry to the
+ * swap cluster @entry is in, and to the swap area.  The slots of a cluster
+ * are handed out in a run, to one cpu on an SSD, so the rest of the cluster
+ * is what was swapped out along with @entry; beyond it is unrelated.
+ */
+void swap_cluster_clamp(swp_entry_t entry, unsigned long *start,
+			unsigned long *end)
+{
+	struct swap_info_struct *si = swap_info[swp_type(entry)];
+	unsigned long first = round_down(swp_offset(entry), SWAPFILE_CLUSTER);
+	unsigned long last = first + SWAPFILE_CLUSTER - 1;
+
+	*start = max(*start, first);
+	*end = min_t(unsigned long, min(*end, last), si->max - 1);
+}
+
 /*
  * out-of-line __page_file_ methods to avoid include hell.
  */
@@ -49,6 +49,8 @@
 #include <linux/prefetch.h>
 #include <linux/printk.h>
 #include <linux/dax.h>
+#include <linux/mmu_notifier.h>
+#include <linux/pid_namespace.h>
 
 #include <asm/tlbflush.h>
 #include <asm/div64.h>
@@ -1483,6 +1485,102 @@ static __always_inline void update_lru_sizes(struct lruvec *lruvec,
 
 }
 
+#ifdef CONFIG_LRU_GEN
+/*
+ * Retire the oldest generations of @type once reclaim has emptied them,
+ * always keeping at least MIN_NR_GENS.
+ */
+static void lru_gen_inc_min_seq(struct lruvec *lruvec, int type)
+{
+	struct lru_gen_struct *lrugen = &lruvec->lrugen;
+	int zone;
+
+	lockdep_assert_held(&lruvec_pgdat(lruvec)->lru_lock);
+
+	while (lrugen->max_seq - lrugen->min_seq[type] + 1 > MIN_NR_GENS) {
+		int gen = lru_gen_from_seq(lrugen->min_seq[type]);
+
+		for (zone = 0; zone < MAX_NR_ZONES; zone++) {
+			if (!list_empty(&lrugen->lists[gen][type][zone]))
+				return;
+		}
+		WRITE_ONCE(lrugen->min_seq[type], lrugen->min_seq[type] + 1);
+	}
+}
+
+/*
+ * The multi-gen counterpart of isolate_lru_pages(): pages of @type are
+ * taken from the tails of the inactive generations, oldest first, and
+ * from the highest eligible zone down.
+ */
+static unsigned long lru_gen_isolate_pages(unsigned long nr_to_scan,
+		struct lruvec *lruvec, struct list_head *dst,
+		unsigned long *nr_scanned, struct scan_control *sc,
+		isolate_mode_t mode, int type)
+{
+	struct lru_gen_struct *lrugen = &lruvec->lrugen;
+	unsigned long nr_taken = 0;
+	unsigned long scan = 0;
+	unsigned long seq;
+	int zone;
+
+	lru_gen_inc_min_seq(lruvec, type);
+
+	for (seq = lrugen->min_seq[type]; seq + MIN_NR_GENS <= lrugen->max_seq;
+	     seq++) {
+		int gen = lru_gen_from_seq(seq);
+
+		for (zone = sc->reclaim_idx; zone >= 0; zone--) {
+			struct list_head *src = &lrugen->lists[gen][type][zone];
+
+			while (scan < nr_to_scan && !list_empty(src)) {
+				struct page *page = lru_to_page(src);
+
+				VM_BUG_ON_PAGE(!PageLRU(page), page);
+
+				scan++;
+				/* Mistagged, deleting it corrupts the lists */
+				if (WARN_ON_ONCE(page_lru_gen(page) != gen)) {
+					list_move(&page->lru, src);
+					continue;
+				}
+
+				switch (__isolate_lru_page(page, mode)) {
+				case 0:
+					nr_taken += hpage_nr_pages(page);
+					lru_gen_del_page(lruvec, page, true);
+					list_add(&page->lru, dst);
+					break;
+
+				case -EBUSY:
+					/* else it is being freed elsewhere */
+					list_move(&page->lru, src);
+					break;
+
+				default:
+					BUG();
+				}
+			}
+			if (scan >= nr_to_scan)
+				goto out;
+		}
+	}
+out:
+	*nr_scanned = scan;
+	trace_mm_vmscan_lru_isolate(sc->reclaim_idx, sc->order, nr_to_scan,
+				    scan, 0, nr_taken, mode, type * LRU_FILE);
+	return nr_taken;
+}
+#else
+static unsigned long lru_gen_isolate_pages(unsigned long nr_to_scan,
+		struct lruvec *lruvec, struct list_head *dst,
+		unsigned long *nr_scanned, struct scan_control *sc,
+		isolate_mode_t mode, int type)
+{
+	return 0;
+}
+#endif /* CONFIG_LRU_GEN */
+
 /*
  * zone_lru_lock is heavily contended.  Some of the functions that
  * shrink the lists perform better by taking out a batch of pages
@@ -1516,6 +1614,10 @@ static unsigned long isolate_lru_pages(unsigned long nr_to_scan,
 	unsigned long scan, total_scan, nr_pages;
 	LIST_HEAD(pages_skipped);
 
+	if (lru_gen_enabled())
+		return lru_gen_isolate_pages(nr_to_scan, lruvec, dst, nr_scanned,
+					     sc, mode, is_file_lru(lru));
+
 	scan = 0;
 	for (total_scan = 0;
 	     scan < nr_to_scan && nr_taken < nr_to_scan && !list_empty(src);
@@ -1707,8 +1809,8 @@ putback_inactive_pages(struct lruvec *lruvec, struct list_head *page_list)
 		}
 		if (put_page_testzero(page)) {
 			__ClearPageLRU(page);
-			__ClearPageActive(page);
 			del_page_from_lru_list(page, lruvec, lru);
+			__ClearPageActive(page);
 
 			if (unlikely(PageCompound(page))) {
 				spin_unlock_irq(&pgdat->lru_lock);
@@ -1944,8 +2046,8 @@ static unsigned move_active_pages_to_lru(struct lruvec *lruvec,
 
 		if (put_page_testzero(page)) {
 			__ClearPageLRU(page);
-			__ClearPageActive(page);
 			del_page_from_lru_list(page, lruvec, lru);
+			__ClearPageActive(page);
 
 			if (unlikely(PageCompound(page))) {
 				spin_unlock_irq(&pgdat->lru_lock);
@@ -2375,6 +2477,385 @@ static void get_scan_count(struct lruvec *lruvec, struct mem_cgroup *memcg,
 	}
 }
 
+#ifdef CONFIG_LRU_GEN
+DEFINE_STATIC_KEY_FALSE(lru_gen_key);
+
+static bool lru_gen_boot_enabled __initdata = IS_ENABLED(CONFIG_LRU_GEN_ENABLED);
+
+static int __init setup_lru_gen(char *str)
+{
+	return !strtobool(str, &lru_gen_boot_enabled);
+}
+__setup("lru_gen=", setup_lru_gen);
+
+/*
+ * The key is flipped before anything is put on an lru list and never
+ * changes afterwards, so the two kinds of lists never have to be
+ * converted into each other.
+ */
+static int __init init_lru_gen(void)
+{
+	BUILD_BUG_ON(MAX_NR_GENS + 1 > 1U << LRU_GEN_WIDTH);
+	BUILD_BUG_ON(MIN_NR_GENS + 1 > MAX_NR_GENS);
+
+	if (lru_gen_boot_enabled)
+		static_branch_enable(&lru_gen_key);
+	return 0;
+}
+early_initcall(init_lru_gen);
+
+struct lru_gen_walk {
+	/* the youngest generation when the walk started */
+	int youngest;
+};
+
+static void lru_gen_promote_page(struct page *page, struct lru_gen_walk *args)
+{
+	page = compound_head(page);
+
+	/* Already where activate_page() would put it */
+	if (page_lru_gen(page) == args->youngest)
+		return;
+
+	activate_page(page);
+}
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+static void lru_gen_walk_pmd_huge(pmd_t *pmd, unsigned long addr,
+				  struct mm_walk *walk)
+{
+	struct vm_area_struct *vma = walk->vma;
+
+	if (pmd_young(*pmd) && !is_huge_zero_pmd(*pmd) &&
+	    pmdp_clear_young_notify(vma, addr, pmd))
+		lru_gen_promote_page(pmd_page(*pmd), walk->private);
+}
+#else
+static void lru_gen_walk_pmd_huge(pmd_t *pmd, unsigned long addr,
+				  struct mm_walk *walk)
+{
+}
+#endif
+
+static int lru_gen_walk_pmd(pmd_t *pmd, unsigned long addr, unsigned long end,
+			    struct mm_walk *walk)
+{
+	struct vm_area_struct *vma = walk->vma;
+	pte_t *pte, *orig_pte;
+	spinlock_t *ptl;
+
+	ptl = pmd_trans_huge_lock(pmd, vma);
+	if (ptl) {
+		if (pmd_present(*pmd))
+			lru_gen_walk_pmd_huge(pmd, addr, walk);
+		spin_unlock(ptl);
+		return 0;
+	}
+
+	if (pmd_trans_unstable(pmd))
+		return 0;
+
+	orig_pte = pte = pte_offset_map_lock(vma->vm_mm, pmd, addr, &ptl);
+	for (; addr != end; pte++, addr += PAGE_SIZE) {
+		struct page *page;
+
+		if (!pte_present(*pte) || !pte_young(*pte))
+			continue;
+
+		page = vm_normal_page(vma, addr, *pte);
+		if (page && ptep_clear_young_notify(vma, addr, pte))
+			lru_gen_promote_page(page, walk->private);
+	}
+	pte_unmap_unlock(orig_pte, ptl);
+	cond_resched();
+
+	return 0;
+}
+
+static int lru_gen_walk_test(unsigned long start, unsigned long end,
+			     struct mm_walk *walk)
+{
+	/*
+	 * Mlocked pages are not on the evictable lists, and page_referenced()
+	 * ignores references through special and sequential-read mappings.
+	 */
+	if (walk->vma->vm_flags &
+	    (VM_LOCKED | VM_SPECIAL | VM_HUGETLB | VM_SEQ_READ))
+		return 1;
+
+	return 0;
+}
+
+/*
+ * Instead of checking the rmap of every page on the way out, the aging
+ * walks the page tables of the processes charged to @memcg and moves
+ * every page it finds young to the youngest generation.  Page tables are
+ * dense in accessed pages compared to the rmap, and this clears the young
+ * bits of a whole process in one pass.
+ */
+static void lru_gen_walk_mms(struct lruvec *lruvec, struct mem_cgroup *memcg)
+{
+	struct lru_gen_walk args = {
+		.youngest = lru_gen_from_seq(READ_ONCE(lruvec->lrugen.max_seq)),
+	};
+	struct mm_walk walk = {
+		.pmd_entry = lru_gen_walk_pmd,
+		.test_walk = lru_gen_walk_test,
+		.private = &args,
+	};
+	int nr = 1;
+
+	for (;;) {
+		struct mm_struct *mm = NULL;
+		struct task_struct *task;
+		struct pid *pid;
+
+		rcu_read_lock();
+		pid = find_ge_pid(nr, &init_pid_ns);
+		if (pid) {
+			nr = pid_nr(pid) + 1;
+			task = pid_task(pid, PIDTYPE_PID);
+			if (task && thread_group_leader(task))
+				mm = get_task_mm(task);
+		}
+		rcu_read_unlock();
+
+		if (!pid)
+			break;
+		if (!mm)
+			continue;
+
+		/* Reclaim must not wait for mmap_sem, skip busy mms */
+		if ((!memcg || mm_match_cgroup(mm, memcg)) &&
+		    down_read_trylock(&mm->mmap_sem)) {
+			walk.mm = mm;
+			walk_page_range(0, mm->highest_vm_end, &walk);
+			up_read(&mm->mmap_sem);
+		}
+		mmput_async(mm);
+		cond_resched();
+	}
+
+	/* Flush the activations batched up on this cpu */
+	lru_add_drain();
+}
+
+/*
+ * The oldest generation of @type is full but cannot be evicted, e.g. anon
+ * without swap: merge it into the next one to make room for a new one.
+ *
+ * The generation can hold most of memory, so the pages are moved in
+ * batches and the lru_lock is dropped in between.  Only the holder of
+ * lrugen->walking increments max_seq, so the generation numbers stay put
+ * meanwhile.  Reclaim may isolate pages from the generation being folded,
+ * and rotates pages onto it, min_seq, for as long as it is not retired:
+ * so it is only retired once all of its lists were found empty in one go
+ * under the lock.  Each page is accounted to whatever generation it is
+ * tagged with at the time.
+ */
+static void lru_gen_fold_oldest(struct lruvec *lruvec, int type)
+{
+	struct pglist_data *pgdat = lruvec_pgdat(lruvec);
+	struct lru_gen_struct *lrugen = &lruvec->lrugen;
+	unsigned long seq = lrugen->min_seq[type];
+	int old_gen = lru_gen_from_seq(seq);
+	int new_gen = lru_gen_from_seq(seq + 1);
+	int batch = 0;
+	int zone;
+
+	VM_BUG_ON(lru_gen_is_active(lruvec, new_gen));
+again:
+	for (zone = 0; zone < MAX_NR_ZONES; zone++) {
+		struct list_head *head = &lrugen->lists[old_gen][type][zone];
+		struct list_head *next = &lrugen->lists[new_gen][type][zone];
+
+		/*
+		 * Older than anything on the next list, so keep them last.
+		 * Moving the youngest first keeps their relative order.
+		 */
+		while (!list_empty(head)) {
+			struct page *page = list_first_entry(head, struct page,
+							     lru);
+			int nr_pages = hpage_nr_pages(page);
+
+			page_set_lru_gen(page, new_gen, 0);
+			list_move_tail(&page->lru, next);
+			lrugen->nr_pages[old_gen][type][zone] -= nr_pages;
+			lrugen->nr_pages[new_gen][type][zone] += nr_pages;
+
+			if (++batch < SWAP_CLUSTER_MAX)
+				continue;
+			batch = 0;
+			spin_unlock_irq(&pgdat->lru_lock);
+			cond_resched();
+			spin_lock_irq(&pgdat->lru_lock);
+		}
+	}
+
+	/* Pages rotated onto the lists drained before the lock was dropped */
+	for (zone = 0; zone < MAX_NR_ZONES; zone++) {
+		if (!list_empty(&lrugen->lists[old_gen][type][zone]))
+			goto again;
+	}
+
+	/*
+	 * Reclaim may have emptied and retired the generation already, in
+	 * which case nothing can have been added to it since.
+	 */
+	if (lrugen->min_seq[type] == seq)
+		WRITE_ONCE(lrugen->min_seq[type], seq + 1);
+}
+
+static void lru_gen_inc_max_seq(struct lruvec *lruvec, unsigned long max_seq)
+{
+	struct lru_gen_struct *lrugen = &lruvec->lrugen;
+	int gen, type, zone;
+
+	lockdep_assert_held(&lruvec_pgdat(lruvec)->lru_lock);
+
+	/* Somebody else aged this lruvec in the meantime */
+	if (max_seq != lrugen->max_seq)
+		return;
+
+	for (type = 0; type < ANON_AND_FILE; type++) {
+		lru_gen_inc_min_seq(lruvec, type);
+		if (max_seq - lrugen->min_seq[type] + 1 == MAX_NR_GENS)
+			lru_gen_fold_oldest(lruvec, type);
+	}
+
+	/* The second youngest generation is about to become inactive */
+	gen = lru_gen_from_seq(max_seq - 1);
+	for (type = 0; type < ANON_AND_FILE; type++) {
+		for (zone = 0; zone < MAX_NR_ZONES; zone++) {
+			int nr_pages = lrugen->nr_pages[gen][type][zone];
+
+			if (!nr_pages)
+				continue;
+
+			__update_lru_size(lruvec, type * LRU_FILE + LRU_ACTIVE,
+					  zone, -nr_pages);
+			__update_lru_size(lruvec, type * LRU_FILE, zone,
+					  nr_pages);
+		}
+	}
+
+	WRITE_ONCE(lrugen->max_seq, max_seq + 1);
+}
+
+static void lru_gen_age_lruvec(struct lruvec *lruvec, struct mem_cgroup *memcg)
+{
+	struct lru_gen_struct *lrugen = &lruvec->lrugen;
+	struct pglist_data *pgdat = lruvec_pgdat(lruvec);
+	unsigned long max_seq = READ_ONCE(lrugen->max_seq);
+
+	/* One walk per generation is plenty, the others can go on evicting */
+	if (atomic_cmpxchg(&lrugen->walking, 0, 1))
+		return;
+
+	lru_gen_walk_mms(lruvec, memcg);
+
+	spin_lock_irq(&pgdat->lru_lock);
+	lru_gen_inc_max_seq(lruvec, max_seq);
+	spin_unlock_irq(&pgdat->lru_lock);
+
+	atomic_set(&lrugen->walking, 0);
+}
+
+/*
+ * Age when @type has nothing left in its inactive generations that this
+ * reclaim could take, but has pages in the active ones.
+ */
+static bool lru_gen_should_age(struct lruvec *lruvec, int type,
+			       struct scan_control *sc)
+{
+	struct lru_gen_struct *lrugen = &lruvec->lrugen;
+	unsigned long max_seq = READ_ONCE(lrugen->max_seq);
+	unsigned long seq;
+	bool young = false;
+	int zone;
+
+	for (seq = READ_ONCE(lrugen->min_seq[type]); seq <= max_seq; seq++) {
+		int gen = lru_gen_from_seq(seq);
+
+		for (zone = 0; zone <= sc->reclaim_idx; zone++) {
+			if (!READ_ONCE(lrugen->nr_pages[gen][type][zone]))
+				continue;
+			if (seq + MIN_NR_GENS <= max_seq)
+				return false;
+			young = true;
+		}
+	}
+
+	return young;
+}
+
+static int lru_gen_pick_type(struct lruvec *lruvec, struct mem_cgroup *memcg,
+			     struct scan_control *sc)
+{
+	struct lru_gen_struct *lrugen = &lruvec->lrugen;
+
+	/* The same reasons as in get_scan_count() not to scan anon at all */
+	if (!sc->may_swap || mem_cgroup_get_nr_swap_pages(memcg) <= 0 ||
+	    !mem_cgroup_swappiness(memcg))
+		return LRU_GEN_FILE;
+
+	/* Evict whichever type has the older pages, file pages on a tie */
+	if (READ_ONCE(lrugen->min_seq[LRU_GEN_ANON]) <
+	    READ_ONCE(lrugen->min_seq[LRU_GEN_FILE]))
+		return LRU_GEN_ANON;
+
+	return LRU_GEN_FILE;
+}
+
+/*
+ * The multi-gen counterpart of the shrink_node_memcg() scan loop: evict
+ * from the oldest generation of the chosen type through
+ * shrink_inactive_list(), aging the lruvec whenever it runs out of
+ * inactive generations.
+ */
+static void lru_gen_shrink_lruvec(struct lruvec *lruvec,
+				  struct mem_cgroup *memcg,
+				  struct scan_control *sc,
+				  unsigned long *lru_pages)
+{
+	unsigned long nr_reclaimed = 0;
+	unsigned long nr_to_scan;
+	struct blk_plug plug;
+	enum lru_list lru;
+
+	*lru_pages = 0;
+	for_each_evictable_lru(lru)
+		*lru_pages += lruvec_lru_size(lruvec, lru, sc->reclaim_idx);
+
+	/* Scan (total_size >> priority) pages at once */
+	nr_to_scan = max(*lru_pages >> sc->priority, SWAP_CLUSTER_MAX);
+
+	blk_start_plug(&plug);
+	while (nr_to_scan && nr_reclaimed < sc->nr_to_reclaim) {
+		int type = lru_gen_pick_type(lruvec, memcg, sc);
+		unsigned long nr = min(nr_to_scan, SWAP_CLUSTER_MAX);
+
+		if (lru_gen_should_age(lruvec, type, sc))
+			lru_gen_age_lruvec(lruvec, memcg);
+
+		nr_reclaimed += shrink_inactive_list(nr, lruvec, sc,
+						     type * LRU_FILE);
+		nr_to_scan -= nr;
+
+		cond_resched();
+	}
+	blk_finish_plug(&plug);
+	sc->nr_reclaimed += nr_reclaimed;
+}
+#else
+static void lru_gen_shrink_lruvec(struct lruvec *lruvec,
+				  struct mem_cgroup *memcg,
+				  struct scan_control *sc,
+				  unsigned long *lru_pages)
+{
+}
+#endif /* CONFIG_LRU_GEN */
+
 /*
  * This is a basic per-node page freer.  Used by both kswapd and direct reclaim.
  */
@@ -2391,6 +2872,11 @@ static void shrink_node_memcg(struct pglist_data *pgdat, struct mem_cgroup *memc
 	struct blk_plug plug;
 	bool scan_adjusted;
 
+	if (lru_gen_enabled()) {
+		lru_gen_shrink_lruvec(lruvec, memcg, sc, lru_pages);
+		return;
+	}
+
 	get_scan_count(lruvec, memcg, sc, nr, lru_pages);
 
 	/* Record the original scan target for proportional adjustments later */
@@ -3163,6 +3649,10 @@ static void age_active_anon(struct pglist_data *pgdat,
 	if (!total_swap_pages)
 		return;
 
+	/* The multi-gen LRU ages on demand when it runs out of old pages */
+	if (lru_gen_enabled())
+		return;
+
 	memcg = mem_cgroup_iter(NULL, NULL, NULL);
 	do {
 		struct lruvec *lruvec = mem_cgroup_lruvec(pgdat, memcg);
@@ -15,6 +15,7 @@
 #include <linux/dax.h>
 #include <linux/fs.h>
 #include <linux/mm.h>
+#include <linux/mm_inline.h>
 
 /*
  *		Double CLOCK lists
@@ -197,6 +198,38 @@ static void unpack_shadow(void *shadow, int *memcgidp, pg_data_t **pgdat,
 	*evictionp = entry << bucket_order;
 }
 
+#ifdef CONFIG_LRU_GEN
+/*
+ * With the multi-generational LRU, the shadow entry records the oldest
+ * file generation at the time of eviction instead of an inactive_age
+ * snapshot.  A page refaulting before that generation number advanced
+ * by MIN_NR_GENS would still be resident had it been promoted to the
+ * youngest generation instead of evicted, so it is activated.
+ */
+static unsigned long lru_gen_eviction(struct lruvec *lruvec)
+{
+	return READ_ONCE(lruvec->lrugen.min_seq[LRU_GEN_FILE]) << bucket_order;
+}
+
+static bool lru_gen_refault(struct lruvec *lruvec, unsigned long eviction)
+{
+	unsigned long min_seq = READ_ONCE(lruvec->lrugen.min_seq[LRU_GEN_FILE]);
+
+	return ((min_seq - (eviction >> bucket_order)) & EVICTION_MASK) <
+		MIN_NR_GENS;
+}
+#else
+static unsigned long lru_gen_eviction(struct lruvec *lruvec)
+{
+	return 0;
+}
+
+static bool lru_gen_refault(struct lruvec *lruvec, unsigned long eviction)
+{
+	return false;
+}
+#endif /* CONFIG_LRU_GEN */
+
 /**
  * workingset_eviction - note the eviction of a page from memory
  * @mapping: address space the page was backing
@@ -219,7 +252,10 @@ void *workingset_eviction(struct address_space *mapping, struct page *page)
 	VM_BUG_ON_PAGE(!PageLocked(page), page);
 
 	lruvec = mem_cgroup_lruvec(pgdat, memcg);
-	eviction = atomic_long_inc_return(&lruvec->inactive_age);
+	if (lru_gen_enabled())
+		eviction = lru_gen_eviction(lruvec);
+	else
+		eviction = atomic_long_inc_return(&lruvec->inactive_age);
 	return pack_shadow(memcgid, pgdat, eviction);
 }
 
@@ -241,6 +277,7 @@ bool workingset_refault(void *shadow)
 	struct lruvec *lruvec;
 	unsigned long refault;
 	struct pglist_data *pgdat;
+	bool activate;
 	int memcgid;
 
 	unpack_shadow(shadow, &memcgid, &pgdat, &eviction);
@@ -268,6 +305,10 @@ bool workingset_refault(void *shadow)
 		return false;
 	}
 	lruvec = mem_cgroup_lruvec(pgdat, memcg);
+	if (lru_gen_enabled()) {
+		activate = lru_gen_refault(lruvec, eviction);
+		goto out;
+	}
 	refault = atomic_long_read(&lruvec->inactive_age);
 	active_file = lruvec_lru_size(lruvec, LRU_ACTIVE_FILE, MAX_NR_ZONES);
 
@@ -288,16 +329,13 @@ bool workingset_refault(void *shadow)
 	 * list is not a problem.
 	 */
 	refault_distance = (refault - eviction) & EVICTION_MASK;
-
+	activate = refault_distance <= active_file;
+out:
 	inc_lruvec_state(lruvec, WORKINGSET_REFAULT);
-
-	if (refault_distance <= active_file) {
+	if (activate)
 		inc_lruvec_state(lruvec, WORKINGSET_ACTIVATE);
-		rcu_read_unlock();
-		return true;
-	}
 	rcu_read_unlock();
-	return false;
+	return activate;
 }
 
 /**
@@ -309,6 +347,10 @@ void workingset_activation(struct page *page)
 	struct mem_cgroup *memcg;
 	struct lruvec *lruvec;
 
+	/* Generations do not need to count activations */
+	if (lru_gen_enabled())
+		return;
+
 	rcu_read_lock();
 	/*
 	 * Filter non-memcg pages here, e.g. unmap can call
@@ -30,7 +30,7 @@
 #include <linux/types.h>
 #include <linux/atomic.h>
 #include <linux/frontswap.h>
-#include <linux/rbtree.h>
+#include <linux/radix-tree.h>
 #include <linux/swap.h>
 #include <linux/crypto.h>
 #include <linux/mempool.h>
@@ -41,6 +41,8 @@
 #include <linux/swapops.h>
 #include <linux/writeback.h>
 #include <linux/pagemap.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
 
 /*********************************
 * statistics
@@ -72,6 +74,26 @@ static u64 zswap_reject_kmemcache_fail;
 /* Duplicate store was encountered (rare) */
 static u64 zswap_duplicate_entry;
 
+/*
+ * Store and load latency distributions, per page: bucket i counts the
+ * operations which took from 2^(i + ZSWAP_LAT_SHIFT) ns up to twice that,
+ * with the first and last buckets also taking anything faster or slower.
+ */
+#define ZSWAP_LAT_SHIFT		8
+#define ZSWAP_LAT_BUCKETS	16
+
+enum zswap_lat_item {
+	ZSWAP_LAT_STORE,
+	ZSWAP_LAT_LOAD,
+	NR_ZSWAP_LAT_ITEMS,
+};
+
+struct zswap_lat_hist {
+	unsigned long count[NR_ZSWAP_LAT_ITEMS][ZSWAP_LAT_BUCKETS];
+};
+
+static DEFINE_PER_CPU(struct zswap_lat_hist, zswap_lat_hist);
+
 /*********************************
 * tunables
 **********************************/
@@ -136,23 +158,23 @@ struct zswap_pool {
  * This structure contains the metadata for tracking a single compressed
  * page within zswap.
  *
- * rbnode - links the entry into red-black tree for the appropriate swap type
- * offset - the swap offset for the entry.  Index into the red-black tree.
+ * rcu - frees the entry after a grace period, for lockless tree lookups
+ * offset - the swap offset for the entry.  Index into the radix tree.
  * refcount - the number of outstanding reference to the entry. This is needed
  *            to protect against premature freeing of the entry by code
- *            concurrent calls to load, invalidate, and writeback.  The lock
- *            for the zswap_tree structure that contains the entry must
- *            be held while changing the refcount.  Since the lock must
- *            be held, there is no reason to also make refcount atomic.
+ *            concurrent calls to load, invalidate, and writeback.  A lookup
+ *            under rcu_read_lock() only takes a reference if the count is
+ *            not already zero; the last reference removes the entry from
+ *            the tree, if still there, and frees it.
  * length - the length in bytes of the compressed page data.  Needed during
  *          decompression
  * pool - the zswap_pool the entry's data is in
  * handle - zpool allocation handle that stores the compressed page data
  */
 struct zswap_entry {
-	struct rb_node rbnode;
+	struct rcu_head rcu;
 	pgoff_t offset;
-	int refcount;
+	atomic_t refcount;
 	unsigned int length;
 	struct zswap_pool *pool;
 	unsigned long handle;
@@ -163,13 +185,13 @@ struct zswap_header {
 };
 
 /*
- * The tree lock in the zswap_tree struct protects a few things:
- * - the rbtree
- * - the refcount field of each entry in the tree
+ * The tree lock in the zswap_tree struct serializes changes to the radix
+ * tree; lookups only need rcu_read_lock().
  */
 struct zswap_tree {
-	struct rb_root rbroot;
+	struct radix_tree_root root;
 	spinlock_t lock;
+	struct rcu_head rcu;
 };
 
 static struct zswap_tree *zswap_trees[MAX_SWAPFILES];
@@ -249,8 +271,7 @@ static struct zswap_entry *zswap_entry_cache_alloc(gfp_t gfp)
 	entry = kmem_cache_alloc(zswap_entry_cache, gfp);
 	if (!entry)
 		return NULL;
-	entry->refcount = 1;
-	RB_CLEAR_NODE(&entry->rbnode);
+	atomic_set(&entry->refcount, 1);
 	return entry;
 }
 
@@ -259,59 +280,9 @@ static void zswap_entry_cache_free(struct zswap_entry *entry)
 	kmem_cache_free(zswap_entry_cache, entry);
 }
 
-/*********************************
-* rbtree functions
-**********************************/
-static struct zswap_entry *zswap_rb_search(struct rb_root *root, pgoff_t offset)
+static void zswap_entry_free_rcu(struct rcu_head *rcu)
 {
-	struct rb_node *node = root->rb_node;
-	struct zswap_entry *entry;
-
-	while (node) {
-		entry = rb_entry(node, struct zswap_entry, rbnode);
-		if (entry->offset > offset)
-			node = node->rb_left;
-		else if (entry->offset < offset)
-			node = node->rb_right;
-		else
-			return entry;
-	}
-	return NULL;
-}
-
-/*
- * In the case that a entry with the same offset is found, a pointer to
- * the existing entry is stored in dupentry and the function returns -EEXIST
- */
-static int zswap_rb_insert(struct rb_root *root, struct zswap_entry *entry,
-			struct zswap_entry **dupentry)
-{
-	struct rb_node **link = &root->rb_node, *parent = NULL;
-	struct zswap_entry *myentry;
-
-	while (*link) {
-		parent = *link;
-		myentry = rb_entry(parent, struct zswap_entry, rbnode);
-		if (myentry->offset > entry->offset)
-			link = &(*link)->rb_left;
-		else if (myentry->offset < entry->offset)
-			link = &(*link)->rb_right;
-		else {
-			*dupentry = myentry;
-			return -EEXIST;
-		}
-	}
-	rb_link_node(&entry->rbnode, parent, link);
-	rb_insert_color(&entry->rbnode, root);
-	return 0;
-}
-
-static void zswap_rb_erase(struct rb_root *root, struct zswap_entry *entry)
-{
-	if (!RB_EMPTY_NODE(&entry->rbnode)) {
-		rb_erase(&entry->rbnode, root);
-		RB_CLEAR_NODE(&entry->rbnode);
-	}
+	zswap_entry_cache_free(container_of(rcu, struct zswap_entry, rcu));
 }
 
 /*
@@ -322,45 +293,65 @@ static void zswap_free_entry(struct zswap_entry *entry)
 {
 	zpool_free(entry->pool->zpool, entry->handle);
 	zswap_pool_put(entry->pool);
-	zswap_entry_cache_free(entry);
+	call_rcu(&entry->rcu, zswap_entry_free_rcu);
 	atomic_dec(&zswap_stored_pages);
 	zswap_update_total_size();
 }
 
-/* caller must hold the tree lock */
-static void zswap_entry_get(struct zswap_entry *entry)
-{
-	entry->refcount++;
-}
-
 /* caller must hold the tree lock
 * remove from the tree and free it, if nobody reference the entry
 */
-static void zswap_entry_put(struct zswap_tree *tree,
+static void __zswap_entry_put(struct zswap_tree *tree,
 			struct zswap_entry *entry)
 {
-	int refcount = --entry->refcount;
+	int refcount = atomic_dec_return(&entry->refcount);
 
 	BUG_ON(refcount < 0);
 	if (refcount == 0) {
-		zswap_rb_erase(&tree->rbroot, entry);
+		radix_tree_delete_item(&tree->root, entry->offset, entry);
 		zswap_free_entry(entry);
 	}
 }
 
-/* caller must hold the tree lock */
-static struct zswap_entry *zswap_entry_find_get(struct rb_root *root,
+/* as above, taking the tree lock only to drop the last reference */
+static void zswap_entry_put(struct zswap_tree *tree,
+			struct zswap_entry *entry)
+{
+	if (atomic_add_unless(&entry->refcount, -1, 1))
+		return;
+
+	spin_lock(&tree->lock);
+	__zswap_entry_put(tree, entry);
+	spin_unlock(&tree->lock);
+}
+
+/* lockless: only returns an entry still referenced from elsewhere */
+static struct zswap_entry *zswap_entry_find_get(struct zswap_tree *tree,
 				pgoff_t offset)
 {
 	struct zswap_entry *entry;
 
-	entry = zswap_rb_search(root, offset);
-	if (entry)
-		zswap_entry_get(entry);
+	rcu_read_lock();
+	entry = radix_tree_lookup(&tree->root, offset);
+	if (entry && !atomic_inc_not_zero(&entry->refcount))
+		entry = NULL;
+	rcu_read_unlock();
 
 	return entry;
 }
 
+static void zswap_lat_account(enum zswap_lat_item item, u64 start,
+			      unsigned int nr)
+{
+	u64 ns = div_u64(ktime_get_ns() - start, nr);
+	int bucket = 0;
+
+	if (ns >> ZSWAP_LAT_SHIFT)
+		bucket = min_t(int, ilog2(ns) - ZSWAP_LAT_SHIFT,
+			       ZSWAP_LAT_BUCKETS - 1);
+	this_cpu_add(zswap_lat_hist.count[item][bucket], nr);
+}
+
 /*********************************
 * per-cpu code
 **********************************/
@@ -855,14 +846,11 @@ static int zswap_writeback_entry(struct zpool *pool, unsigned long handle)
 	offset = swp_offset(swpentry);
 
 	/* find and ref zswap entry */
-	spin_lock(&tree->lock);
-	entry = zswap_entry_find_get(&tree->rbroot, offset);
+	entry = zswap_entry_find_get(tree, offset);
 	if (!entry) {
 		/* entry was invalidated */
-		spin_unlock(&tree->lock);
 		return 0;
 	}
-	spin_unlock(&tree->lock);
 	BUG_ON(offset != entry->offset);
 
 	/* try to allocate swap cache page */
@@ -905,18 +893,17 @@ static int zswap_writeback_entry(struct zpool *pool, unsigned long handle)
 	zswap_written_back_pages++;
 
 	spin_lock(&tree->lock);
-	/* drop local reference */
-	zswap_entry_put(tree, entry);
-
 	/*
 	* There are two possible situations for entry here:
-	* (1) refcount is 1(normal case),  entry is valid and on the tree
-	* (2) refcount is 0, entry is freed and not on the tree
-	*     because invalidate happened during writeback
-	*  search the tree and free the entry if find entry
+	* (1) entry is valid and on the tree (normal case): take it off and
+	*     drop the reference the tree held
+	* (2) entry is not on the tree because invalidate happened during
+	*     writeback, and already dropped that reference
 	*/
-	if (entry == zswap_rb_search(&tree->rbroot, offset))
-		zswap_entry_put(tree, entry);
+	if (radix_tree_delete_item(&tree->root, offset, entry))
+		__zswap_entry_put(tree, entry);
+	/* drop local reference */
+	__zswap_entry_put(tree, entry);
 	spin_unlock(&tree->lock);
 
 	goto end;
@@ -929,9 +916,7 @@ static int zswap_writeback_entry(struct zpool *pool, unsigned long handle)
 	* it it either okay to return !0
 	*/
 fail:
-	spin_lock(&tree->lock);
 	zswap_entry_put(tree, entry);
-	spin_unlock(&tree->lock);
 
 end:
 	return ret;
@@ -956,61 +941,32 @@ static int zswap_shrink(void)
 /*********************************
 * frontswap hooks
 **********************************/
-/* attempts to compress and store an single page */
-static int zswap_frontswap_store(unsigned type, pgoff_t offset,
-				struct page *page)
+static void zswap_frontswap_invalidate_page(unsigned type, pgoff_t offset);
+
+/*
+ * Pages of a batch are compressed this many at a time with preemption
+ * disabled, on the per-cpu transform and destination buffer, and then
+ * added to the tree under a single lock acquisition.
+ */
+#define ZSWAP_STORE_BATCH	16
+
+/* compress a page into a new zpool allocation; preemption is disabled */
+static int zswap_compress(struct zswap_entry *entry, struct crypto_comp *tfm,
+			  u8 *dst, unsigned type, struct page *page)
 {
-	struct zswap_tree *tree = zswap_trees[type];
-	struct zswap_entry *entry, *dupentry;
-	struct crypto_comp *tfm;
-	int ret;
 	unsigned int dlen = PAGE_SIZE, len;
 	unsigned long handle;
 	char *buf;
-	u8 *src, *dst;
+	u8 *src;
 	struct zswap_header *zhdr;
-
-	if (!zswap_enabled || !tree) {
-		ret = -ENODEV;
-		goto reject;
-	}
-
-	/* reclaim space if needed */
-	if (zswap_is_full()) {
-		zswap_pool_limit_hit++;
-		if (zswap_shrink()) {
-			zswap_reject_reclaim_fail++;
-			ret = -ENOMEM;
-			goto reject;
-		}
-	}
-
-	/* allocate entry */
-	entry = zswap_entry_cache_alloc(GFP_KERNEL);
-	if (!entry) {
-		zswap_reject_kmemcache_fail++;
-		ret = -ENOMEM;
-		goto reject;
-	}
-
-	/* if entry is successfully added, it keeps the reference */
-	entry->pool = zswap_pool_current_get();
-	if (!entry->pool) {
-		ret = -EINVAL;
-		goto freepage;
-	}
+	int ret;
 
 	/* compress */
-	dst = get_cpu_var(zswap_dstmem);
-	tfm = *get_cpu_ptr(entry->pool->tfm);
 	src = kmap_atomic(page);
 	ret = crypto_comp_compress(tfm, src, PAGE_SIZE, dst, &dlen);
 	kunmap_atomic(src);
-	put_cpu_ptr(entry->pool->tfm);
-	if (ret) {
-		ret = -EINVAL;
-		goto put_dstmem;
-	}
+	if (ret)
+		return -EINVAL;
 
 	/* store */
 	len = dlen + sizeof(struct zswap_header);
@@ -1019,52 +975,181 @@ static int zswap_frontswap_store(unsigned type, pgoff_t offset,
 			   &handle);
 	if (ret == -ENOSPC) {
 		zswap_reject_compress_poor++;
-		goto put_dstmem;
+		return ret;
 	}
 	if (ret) {
 		zswap_reject_alloc_fail++;
-		goto put_dstmem;
+		return ret;
 	}
 	zhdr = zpool_map_handle(entry->pool->zpool, handle, ZPOOL_MM_RW);
-	zhdr->swpentry = swp_entry(type, offset);
+	zhdr->swpentry = swp_entry(type, entry->offset);
 	buf = (u8 *)(zhdr + 1);
 	memcpy(buf, dst, dlen);
 	zpool_unmap_handle(entry->pool->zpool, handle);
-	put_cpu_var(zswap_dstmem);
 
 	/* populate entry */
-	entry->offset = offset;
 	entry->handle = handle;
 	entry->length = dlen;
+	return 0;
+}
+
+/*
+ * Compress and store up to ZSWAP_STORE_BATCH pages, setting *stored to the
+ * number of them that made it into the tree.
+ */
+static int zswap_store_batch(struct zswap_tree *tree, struct zswap_pool *pool,
+			     unsigned type, pgoff_t offset, struct page *page,
+			     unsigned int nr, unsigned int *stored)
+{
+	struct zswap_entry *entries[ZSWAP_STORE_BATCH];
+	struct zswap_entry *dupentries[ZSWAP_STORE_BATCH];
+	struct crypto_comp *tfm;
+	unsigned int i, nr_alloc, nr_comp = 0, inserted = 0, nr_dup = 0;
+	void **slot;
+	u8 *dst;
+	int ret = 0;
+
+	*stored = 0;
+
+	/* allocate entries */
+	for (nr_alloc = 0; nr_alloc < nr; nr_alloc++) {
+		entries[nr_alloc] = zswap_entry_cache_alloc(GFP_KERNEL);
+		if (!entries[nr_alloc]) {
+			zswap_reject_kmemcache_fail++;
+			ret = -ENOMEM;
+			goto freeentries;
+		}
+		/* if entry is successfully added, it keeps the reference */
+		zswap_pool_get(pool);
+		entries[nr_alloc]->pool = pool;
+		entries[nr_alloc]->offset = offset + nr_alloc;
+	}
+
+	/* compress */
+	dst = get_cpu_var(zswap_dstmem);
+	tfm = *this_cpu_ptr(pool->tfm);
+	for (; nr_comp < nr; nr_comp++) {
+		ret = zswap_compress(entries[nr_comp], tfm, dst, type,
+				     page + nr_comp);
+		if (ret)
+			break;
+	}
+	put_cpu_var(zswap_dstmem);
+	if (ret)
+		goto freehandles;
 
 	/* map */
+	if (radix_tree_preload(GFP_KERNEL)) {
+		ret = -ENOMEM;
+		goto freehandles;
+	}
 	spin_lock(&tree->lock);
-	do {
-		ret = zswap_rb_insert(&tree->rbroot, entry, &dupentry);
-		if (ret == -EEXIST) {
+	for (; inserted < nr; inserted++) {
+		slot = radix_tree_lookup_slot(&tree->root, offset + inserted);
+		if (slot) {
+			/* replace, the old entry is put once unlocked */
 			zswap_duplicate_entry++;
-			/* remove from rbtree */
-			zswap_rb_erase(&tree->rbroot, dupentry);
-			zswap_entry_put(tree, dupentry);
+			dupentries[nr_dup++] = radix_tree_deref_slot_protected(
+							slot, &tree->lock);
+			radix_tree_replace_slot(&tree->root, slot,
+						entries[inserted]);
+			continue;
 		}
-	} while (ret == -EEXIST);
+		ret = radix_tree_insert(&tree->root, offset + inserted,
+					entries[inserted]);
+		if (ret)
+			break;
+	}
 	spin_unlock(&tree->lock);
+	radix_tree_preload_end();
+
+	for (i = 0; i < nr_dup; i++)
+		zswap_entry_put(tree, dupentries[i]);
 
 	/* update stats */
-	atomic_inc(&zswap_stored_pages);
+	atomic_add(inserted, &zswap_stored_pages);
 	zswap_update_total_size();
+	*stored = inserted;
+	if (!ret)
+		return 0;
+
+freehandles:
+	for (i = inserted; i < nr_comp; i++)
+		zpool_free(pool->zpool, entries[i]->handle);
+freeentries:
+	for (i = inserted; i < nr_alloc; i++) {
+		zswap_pool_put(pool);
+		zswap_entry_cache_free(entries[i]);
+	}
+	return ret;
+}
+
+/* attempts to compress and store nr contiguous pages of a swap cluster */
+static int zswap_store(unsigned type, pgoff_t offset, struct page *page,
+		       unsigned int nr)
+{
+	struct zswap_tree *tree = zswap_trees[type];
+	struct zswap_pool *pool;
+	unsigned int done, batch, stored;
+	u64 start = ktime_get_ns();
+	int ret;
+
+	if (!zswap_enabled || !tree) {
+		ret = -ENODEV;
+		goto reject;
+	}
+
+	/* reclaim space if needed */
+	if (zswap_is_full()) {
+		zswap_pool_limit_hit++;
+		if (zswap_shrink()) {
+			zswap_reject_reclaim_fail++;
+			ret = -ENOMEM;
+			goto reject;
+		}
+	}
+
+	pool = zswap_pool_current_get();
+	if (!pool) {
+		ret = -EINVAL;
+		goto reject;
+	}
+
+	for (done = 0; done < nr; done += stored) {
+		batch = min_t(unsigned int, nr - done, ZSWAP_STORE_BATCH);
+		ret = zswap_store_batch(tree, pool, type, offset + done,
+					page + done, batch, &stored);
+		if (ret) {
+			/* all or nothing: the caller writes to swap instead */
+			done += stored;
+			while (done--)
+				zswap_frontswap_invalidate_page(type,
+								offset + done);
+			zswap_pool_put(pool);
+			goto reject;
+		}
+	}
+	zswap_pool_put(pool);
 
+	zswap_lat_account(ZSWAP_LAT_STORE, start, nr);
 	return 0;
 
-put_dstmem:
-	put_cpu_var(zswap_dstmem);
-	zswap_pool_put(entry->pool);
-freepage:
-	zswap_entry_cache_free(entry);
 reject:
 	return ret;
 }
 
+static int zswap_frontswap_store(unsigned type, pgoff_t offset,
+				struct page *page)
+{
+	return zswap_store(type, offset, page, 1);
+}
+
+static int zswap_frontswap_store_pages(unsigned type, pgoff_t offset,
+				struct page *page, unsigned int nr)
+{
+	return zswap_store(type, offset, page, nr);
+}
+
 /*
  * returns 0 if the page was successfully decompressed
  * return -1 on entry not found or error
@@ -1077,17 +1162,15 @@ static int zswap_frontswap_load(unsigned type, pgoff_t offset,
 	struct crypto_comp *tfm;
 	u8 *src, *dst;
 	unsigned int dlen;
+	u64 start = ktime_get_ns();
 	int ret;
 
 	/* find */
-	spin_lock(&tree->lock);
-	entry = zswap_entry_find_get(&tree->rbroot, offset);
+	entry = zswap_entry_find_get(tree, offset);
 	if (!entry) {
 		/* entry was written back */
-		spin_unlock(&tree->lock);
 		return -1;
 	}
-	spin_unlock(&tree->lock);
 
 	/* decompress */
 	dlen = PAGE_SIZE;
@@ -1101,10 +1184,9 @@ static int zswap_frontswap_load(unsigned type, pgoff_t offset,
 	zpool_unmap_handle(entry->pool->zpool, entry->handle);
 	BUG_ON(ret);
 
-	spin_lock(&tree->lock);
 	zswap_entry_put(tree, entry);
-	spin_unlock(&tree->lock);
 
+	zswap_lat_account(ZSWAP_LAT_LOAD, start, 1);
 	return 0;
 }
 
@@ -1114,41 +1196,42 @@ static void zswap_frontswap_invalidate_page(unsigned type, pgoff_t offset)
 	struct zswap_tree *tree = zswap_trees[type];
 	struct zswap_entry *entry;
 
-	/* find */
+	/* find and remove from the tree */
 	spin_lock(&tree->lock);
-	entry = zswap_rb_search(&tree->rbroot, offset);
+	entry = radix_tree_delete(&tree->root, offset);
+	spin_unlock(&tree->lock);
 	if (!entry) {
 		/* entry was written back */
-		spin_unlock(&tree->lock);
 		return;
 	}
 
-	/* remove from rbtree */
-	zswap_rb_erase(&tree->rbroot, entry);
-
 	/* drop the initial reference from entry creation */
 	zswap_entry_put(tree, entry);
-
-	spin_unlock(&tree->lock);
 }
 
 /* frees all zswap entries for the given swap type */
 static void zswap_frontswap_invalidate_area(unsigned type)
 {
 	struct zswap_tree *tree = zswap_trees[type];
-	struct zswap_entry *entry, *n;
+	struct radix_tree_iter iter;
+	void **slot;
 
 	if (!tree)
 		return;
 
 	/* walk the tree and free everything */
 	spin_lock(&tree->lock);
-	rbtree_postorder_for_each_entry_safe(entry, n, &tree->rbroot, rbnode)
+	radix_tree_for_each_slot(slot, &tree->root, &iter, 0) {
+		struct zswap_entry *entry;
+
+		entry = radix_tree_deref_slot_protected(slot, &tree->lock);
+		radix_tree_iter_delete(&tree->root, &iter, slot);
 		zswap_free_entry(entry);
-	tree->rbroot = RB_ROOT;
+	}
 	spin_unlock(&tree->lock);
-	kfree(tree);
 	zswap_trees[type] = NULL;
+	/* lockless lookups may still be walking the tree */
+	kfree_rcu(tree, rcu);
 }
 
 static void zswap_frontswap_init(unsigned type)
@@ -1161,13 +1244,14 @@ static void zswap_frontswap_init(unsigned type)
 		return;
 	}
 
-	tree->rbroot = RB_ROOT;
+	INIT_RADIX_TREE(&tree->root, GFP_ATOMIC | __GFP_NOWARN);
 	spin_lock_init(&tree->lock);
 	zswap_trees[type] = tree;
 }
 
 static struct frontswap_ops zswap_frontswap_ops = {
 	.store = zswap_frontswap_store,
+	.store_pages = zswap_frontswap_store_pages,
 	.load = zswap_frontswap_load,
 	.invalidate_page = zswap_frontswap_invalidate_page,
 	.invalidate_area = zswap_frontswap_invalidate_area,
@@ -1179,9 +1263,42 @@ static struct frontswap_ops zswap_frontswap_ops = {
 **********************************/
 #ifdef CONFIG_DEBUG_FS
 #include <linux/debugfs.h>
+#include <linux/seq_file.h>
 
 static struct dentry *zswap_debugfs_root;
 
+static int zswap_lat_show(struct seq_file *m, void *v)
+{
+	enum zswap_lat_item item = (unsigned long)m->private;
+	struct zswap_lat_hist *hist;
+	int bucket, cpu;
+
+	for (bucket = 0; bucket < ZSWAP_LAT_BUCKETS; bucket++) {
+		unsigned long count = 0;
+
+		for_each_possible_cpu(cpu) {
+			hist = per_cpu_ptr(&zswap_lat_hist, cpu);
+			count += hist->count[item][bucket];
+		}
+		seq_printf(m, "%lu-%lu %lu\n",
+			   bucket ? 1UL << (bucket + ZSWAP_LAT_SHIFT) : 0,
+			   (1UL << (bucket + ZSWAP_LAT_SHIFT + 1)) - 1, count);
+	}
+	return 0;
+}
+
+static int zswap_lat_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, zswap_lat_show, inode->i_private);
+}
+
+static const struct file_operations zswap_lat_fops = {
+	.open		= zswap_lat_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
 static int __init zswap_debugfs_init(void)
 {
 	if (!debugfs_initialized())
@@ -1209,6 +1326,10 @@ static int __init zswap_debugfs_init(void)
 			zswap_debugfs_root, &zswap_pool_total_size);
 	debugfs_create_atomic_t("stored_pages", S_IRUGO,
 			zswap_debugfs_root, &zswap_stored_pages);
+	debugfs_create_file("store_latency", S_IRUGO, zswap_debugfs_root,
+			(void *)ZSWAP_LAT_STORE, &zswap_lat_fops);
+	debugfs_create_file("load_latency", S_IRUGO, zswap_debugfs_root,
+			(void *)ZSWAP_LAT_LOAD, &zswap_lat_fops);
 
 	return 0;
 }
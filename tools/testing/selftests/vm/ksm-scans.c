@@ -0,0 +1,205 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Run ksmd through several full scans with merging enabled.
+ *
+ * ksmd takes pages from its cursor in batches, and a batch can be cut
+ * short at the end of a full scan.  The pages merged from it must go into
+ * the unstable tree of the scan they were taken in, or the next scan frees
+ * unstable tree nodes that are not in its tree.  So pages_to_scan is set to
+ * a value that is not a multiple of the batch size, and part of the region
+ * is rewritten between scans, which keeps pages moving in and out of the
+ * unstable tree.
+ *
+ *   -n nr	number of full scans to wait for (default: 8)
+ *   -m MiB	size of the region (default: 16)
+ *
+ * The content of every page is checked after each scan, and ksmd must have
+ * merged some of the duplicates by the end: it exits with 1 otherwise.
+ * Needs root, and is skipped when the kernel has no KSM.
+ */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define KSM_SYSFS	"/sys/kernel/mm/ksm/"
+#define NR_PATTERNS	16
+#define SCAN_TIMEOUT	60	/* seconds per full scan */
+
+static unsigned long page_size;
+static size_t region_size = 16UL << 20;
+static int nr_scans = 8;
+
+static int ksm_read(const char *name, unsigned long *val)
+{
+	char path[128];
+	FILE *f;
+	int ret;
+
+	snprintf(path, sizeof(path), KSM_SYSFS "%s", name);
+	f = fopen(path, "r");
+	if (!f)
+		return -1;
+	ret = fscanf(f, "%lu", val) == 1 ? 0 : -1;
+	fclose(f);
+	return ret;
+}
+
+static int ksm_write(const char *name, unsigned long val)
+{
+	char path[128];
+	FILE *f;
+	int ret;
+
+	snprintf(path, sizeof(path), KSM_SYSFS "%s", name);
+	f = fopen(path, "w");
+	if (!f)
+		return -1;
+	ret = fprintf(f, "%lu", val) > 0 ? 0 : -1;
+	if (fclose(f))
+		ret = -1;
+	return ret;
+}
+
+/*
+ * Most pages hold one of a few patterns and so can be merged; every fourth
+ * one of the second half is unique to the page and the round, and is
+ * rewritten between scans.
+ */
+static unsigned long page_pattern(unsigned long i, unsigned long nr_pages,
+				  int round)
+{
+	if (i >= nr_pages / 2 && !(i % 4))
+		return 0x80000000UL | ((unsigned long)round << 24) | i;
+	return i % NR_PATTERNS;
+}
+
+static void fill_page(char *page, unsigned long pattern)
+{
+	unsigned long *p = (unsigned long *)page;
+	unsigned long j;
+
+	for (j = 0; j < page_size / sizeof(*p); j++)
+		p[j] = pattern ^ j;
+}
+
+static bool check_page(char *page, unsigned long pattern)
+{
+	unsigned long *p = (unsigned long *)page;
+	unsigned long j;
+
+	for (j = 0; j < page_size / sizeof(*p); j++)
+		if (p[j] != (pattern ^ j))
+			return false;
+	return true;
+}
+
+static int wait_full_scan(unsigned long target)
+{
+	unsigned long full_scans;
+	int i;
+
+	for (i = 0; i < SCAN_TIMEOUT * 10; i++) {
+		if (ksm_read("full_scans", &full_scans))
+			return -1;
+		if (full_scans >= target)
+			return 0;
+		usleep(100000);
+	}
+	errno = ETIMEDOUT;
+	return -1;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long old_run, old_pages, old_sleep;
+	unsigned long full_scans, shared = 0;
+	unsigned long nr_pages, i;
+	int opt, round, ret = 0;
+	char *region;
+
+	while ((opt = getopt(argc, argv, "n:m:")) != -1) {
+		switch (opt) {
+		case 'n':
+			nr_scans = atoi(optarg);
+			break;
+		case 'm':
+			region_size = strtoul(optarg, NULL, 0) << 20;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n scans] [-m MiB]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+
+	if (ksm_read("run", &old_run) ||
+	    ksm_read("pages_to_scan", &old_pages) ||
+	    ksm_read("sleep_millisecs", &old_sleep)) {
+		printf("KSM not available, skipping\n");
+		return 0;
+	}
+	if (geteuid()) {
+		printf("Please run this test as root\n");
+		return 0;
+	}
+
+	page_size = sysconf(_SC_PAGESIZE);
+	nr_pages = region_size / page_size;
+	region = mmap(NULL, region_size, PROT_READ | PROT_WRITE,
+		      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (region == MAP_FAILED)
+		err(1, "mmap");
+	for (i = 0; i < nr_pages; i++)
+		fill_page(region + i * page_size, page_pattern(i, nr_pages, 0));
+	if (madvise(region, region_size, MADV_MERGEABLE))
+		err(1, "madvise(MADV_MERGEABLE)");
+
+	/* Not a multiple of the batch, so batches end mid mm and mid scan */
+	if (ksm_write("pages_to_scan", 97) || ksm_write("sleep_millisecs", 0) ||
+	    ksm_write("run", 1) || ksm_read("full_scans", &full_scans))
+		err(1, "setting up ksmd");
+
+	for (round = 1; round <= nr_scans; round++) {
+		if (wait_full_scan(full_scans + round)) {
+			warn("waiting for full scan %d", round);
+			ret = 1;
+			break;
+		}
+
+		for (i = 0; i < nr_pages; i++) {
+			if (!check_page(region + i * page_size,
+					page_pattern(i, nr_pages, round - 1))) {
+				fprintf(stderr,
+					"page %lu corrupted after scan %d\n",
+					i, round);
+				ret = 1;
+				goto out;
+			}
+		}
+
+		for (i = (nr_pages / 2 + 3) & ~3UL; i < nr_pages; i += 4)
+			fill_page(region + i * page_size,
+				  page_pattern(i, nr_pages, round));
+	}
+
+	if (!ret && (ksm_read("pages_shared", &shared) || !shared)) {
+		fprintf(stderr, "no pages merged after %d full scans\n",
+			nr_scans);
+		ret = 1;
+	}
+	if (!ret)
+		printf("%d full scans, %lu pages shared\n", nr_scans, shared);
+out:
+	munmap(region, region_size);
+	ksm_write("run", old_run);
+	ksm_write("pages_to_scan", old_pages);
+	ksm_write("sleep_millisecs", old_sleep);
+	return ret;
+}
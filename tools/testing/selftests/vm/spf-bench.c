@@ -0,0 +1,243 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Page fault scalability benchmark, in the style of will-it-scale's
+ * page_fault tests, for the speculative page fault path.
+ *
+ * Each thread repeatedly maps a private region, touches every page of it
+ * and unmaps it again.  Optionally another thread keeps calling mmap() and
+ * munmap() on an unrelated region, which makes faulting threads contend on
+ * mmap_sem unless their faults are handled speculatively.
+ *
+ *   -t nr	number of faulting threads (default: online cpus)
+ *   -s secs	duration (default: 5)
+ *   -m MiB	size of each thread's region (default: 16)
+ *   -f		fault on a shared page cache backed file instead of
+ *		anonymous memory; the file is read-faulted only
+ *   -c		run the mmap/munmap churn thread
+ *
+ * Faulted-in memory is checked, anonymous pages must read as zero and
+ * file pages must hold what was written to the file, so this also serves
+ * as a correctness test: it exits with 1 on a mismatch.
+ */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static unsigned long page_size;
+static size_t region_size = 16UL << 20;
+static int nr_threads;
+static int duration = 5;
+static bool file_mode;
+static bool churn;
+static int file_fd = -1;
+
+static volatile bool stop;
+static volatile bool failed;
+
+struct worker {
+	pthread_t thread;
+	unsigned long faults;
+} __attribute__((aligned(64)));
+
+static uint64_t page_pattern(size_t pgoff)
+{
+	return 0x5350465350460000ULL | pgoff;
+}
+
+static void *fault_thread(void *arg)
+{
+	struct worker *w = arg;
+	size_t nr_pages = region_size / page_size;
+
+	while (!stop) {
+		char *p;
+		size_t i;
+
+		if (file_mode)
+			p = mmap(NULL, region_size, PROT_READ, MAP_SHARED,
+				 file_fd, 0);
+		else
+			p = mmap(NULL, region_size, PROT_READ | PROT_WRITE,
+				 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED)
+			err(2, "mmap");
+		/* Exercise the pte level: huge pmds take the locked path */
+		if (!file_mode)
+			madvise(p, region_size, MADV_NOHUGEPAGE);
+
+		for (i = 0; i < nr_pages && !stop; i++) {
+			uint64_t *v = (uint64_t *)(p + i * page_size);
+
+			if (file_mode) {
+				if (*v != page_pattern(i))
+					failed = true;
+			} else if (__sync_fetch_and_add(v, i + 1) != 0) {
+				/* Written first so it takes a single fault */
+				failed = true;
+			}
+			w->faults++;
+		}
+
+		munmap(p, region_size);
+	}
+
+	return NULL;
+}
+
+static void *churn_thread(void *arg)
+{
+	while (!stop) {
+		void *p = mmap(NULL, page_size, PROT_READ | PROT_WRITE,
+			       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+		if (p == MAP_FAILED)
+			err(2, "mmap");
+		munmap(p, page_size);
+	}
+
+	return NULL;
+}
+
+static void setup_file(void)
+{
+	char path[] = "/tmp/spf-bench.XXXXXX";
+	size_t nr_pages = region_size / page_size;
+	char *buf;
+	size_t i;
+
+	file_fd = mkstemp(path);
+	if (file_fd < 0)
+		err(2, "mkstemp");
+	unlink(path);
+
+	buf = calloc(1, page_size);
+	if (!buf)
+		err(2, "calloc");
+	for (i = 0; i < nr_pages; i++) {
+		*(uint64_t *)buf = page_pattern(i);
+		if (pwrite(file_fd, buf, page_size, i * page_size) !=
+		    (ssize_t)page_size)
+			err(2, "pwrite");
+	}
+	free(buf);
+}
+
+static bool read_vmstat(const char *name, unsigned long *val)
+{
+	char key[64];
+	bool found = false;
+	FILE *f;
+
+	f = fopen("/proc/vmstat", "r");
+	if (!f)
+		return false;
+	while (fscanf(f, "%63s %lu", key, val) == 2) {
+		if (!strcmp(key, name)) {
+			found = true;
+			break;
+		}
+	}
+	fclose(f);
+
+	return found;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long spf_before = 0, spf_after = 0;
+	unsigned long abort_before = 0, abort_after = 0;
+	unsigned long total = 0;
+	struct worker *workers;
+	pthread_t churner;
+	bool have_spf;
+	int opt, i;
+
+	page_size = sysconf(_SC_PAGESIZE);
+	nr_threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+	while ((opt = getopt(argc, argv, "t:s:m:fch")) != -1) {
+		switch (opt) {
+		case 't':
+			nr_threads = atoi(optarg);
+			break;
+		case 's':
+			duration = atoi(optarg);
+			break;
+		case 'm':
+			region_size = (size_t)atoi(optarg) << 20;
+			break;
+		case 'f':
+			file_mode = true;
+			break;
+		case 'c':
+			churn = true;
+			break;
+		default:
+			errx(1, "usage: %s [-t threads] [-s secs] [-m MiB] [-f] [-c]",
+			     argv[0]);
+		}
+	}
+	if (nr_threads < 1 || duration < 1 || region_size < page_size)
+		errx(1, "invalid arguments");
+
+	if (file_mode)
+		setup_file();
+
+	workers = calloc(nr_threads, sizeof(*workers));
+	if (!workers)
+		err(2, "calloc");
+
+	have_spf = read_vmstat("speculative_pgfault", &spf_before) &&
+		   read_vmstat("speculative_pgfault_abort", &abort_before);
+
+	for (i = 0; i < nr_threads; i++) {
+		errno = pthread_create(&workers[i].thread, NULL, fault_thread,
+				       &workers[i]);
+		if (errno)
+			err(2, "pthread_create");
+	}
+	if (churn) {
+		errno = pthread_create(&churner, NULL, churn_thread, NULL);
+		if (errno)
+			err(2, "pthread_create");
+	}
+
+	sleep(duration);
+	stop = true;
+
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		total += workers[i].faults;
+	}
+	if (churn)
+		pthread_join(churner, NULL);
+
+	printf("%s faults, %d threads%s: %lu faults/sec (%lu per thread)\n",
+	       file_mode ? "file" : "anon", nr_threads,
+	       churn ? ", mmap churn" : "", total / duration,
+	       total / duration / nr_threads);
+
+	if (have_spf && read_vmstat("speculative_pgfault", &spf_after) &&
+	    read_vmstat("speculative_pgfault_abort", &abort_after))
+		printf("speculative: %lu handled, %lu fell back\n",
+		       spf_after - spf_before, abort_after - abort_before);
+	else
+		printf("speculative page faults not available\n");
+
+	if (failed) {
+		printf("[FAIL] unexpected data in faulted-in pages\n");
+		return 1;
+	}
+
+	return 0;
+}